@@ -67,6 +67,19 @@ CREATE OR REPLACE FUNCTION load_from_mgf(varchar)
     AS 'pgms', 'load_mgf_varchar'
     LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
 
+--- Read given server file in Mascote Generic Format and returns the set of records
+--- Requires privileges of pg_read_server_files role
+--- @param text path of the file on the server
+--- @return Set of untyped records with selected columns
+--- select * from pgms.load_from_mgf_file('/data/isdb.mgf') as (
+---    "PEPMASS" float,
+---    spectrum pgms.spectrum
+---);
+CREATE FUNCTION load_from_mgf_file(text)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mgf_file'
+    LANGUAGE C VOLATILE STRICT;
+
 --- Compute cosine greedy similarity score
 --- @param spectrum reference spectrum
 --- @param spectrum query spectrum
@@ -91,6 +104,44 @@ CREATE FUNCTION cosine_hungarian(spectrum, spectrum, float4=0.1, float4=0.0, flo
     AS 'pgms'
     LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
 
+--- Compute upper bound of cosine greedy and cosine hungarian similarity score
+--- @param spectrum reference spectrum
+--- @param spectrum query spectrum
+--- @param float4 tolerance
+--- @param float4 mass power
+--- @param float4 intenzity power
+--- @return upper bound of cosine similarity score
+CREATE FUNCTION cosine_upper_bound(spectrum, spectrum, float4=0.1, float4=0.0, float4=1.0)
+    RETURNS float4
+    AS 'pgms'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 50;
+
+--- Test cosine greedy similarity score against threshold (pairs are prefiltered by upper bound)
+--- @param spectrum reference spectrum
+--- @param spectrum query spectrum
+--- @param float4 threshold
+--- @param float4 tolerance
+--- @param float4 mass power
+--- @param float4 intenzity power
+--- @return true when cosine greedy similarity score reaches threshold
+CREATE FUNCTION cosine_greedy_above(spectrum, spectrum, float4, float4=0.1, float4=0.0, float4=1.0)
+    RETURNS boolean
+    AS 'pgms'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
+
+--- Test cosine hungarian similarity score against threshold (pairs are prefiltered by upper bound)
+--- @param spectrum reference spectrum
+--- @param spectrum query spectrum
+--- @param float4 threshold
+--- @param float4 tolerance
+--- @param float4 mass power
+--- @param float4 intenzity power
+--- @return true when cosine hungarian similarity score reaches threshold
+CREATE FUNCTION cosine_hungarian_above(spectrum, spectrum, float4, float4=0.1, float4=0.0, float4=1.0)
+    RETURNS boolean
+    AS 'pgms'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
+
 --- Normalize mass spectrum (provides peaks in interval <0, 1>)
 --- @param spectrum ion spectrum
 --- @return normalized spectrum
@@ -110,18 +161,74 @@ $BODY$
   LANGUAGE plpgsql IMMUTABLE;
 
 -----------------------------------------------------------------------------------------------------------------------
+--- Returns the m/z span of the spectrum (NULL for spectrum without peaks)
+--- @param spectrum ion spectrum
+--- @param varchar range bounds ('[]', '[)', '(]' or '()')
+--- @return range from the lowest to the highest m/z
+--- create index on isdb using gist (pgms.spectrum_range(spectrum, '[]'));
 CREATE OR REPLACE FUNCTION spectrum_range( s spectrum, bounds varchar )
-  RETURNS spectrumrange AS
-$BODY$
-declare
-    mz_l float4;
-    mz_r float4;
-BEGIN
-    select into mz_l, mz_r min(t.mz) over (), max(t.mz) over () as mz FROM unnest((s::float[])[1:1]) AS t(mz);
-    return (left(bounds, 1) || mz_l || ','|| mz_r || right(bounds, 1))::pgms.spectrumrange;
-END;
-$BODY$
-  LANGUAGE plpgsql IMMUTABLE;
+  RETURNS spectrumrange
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Test whether the m/z span of the spectrum overlaps the window
+--- @param spectrum ion spectrum
+--- @param spectrumrange m/z window
+--- @return true if the span and the window overlap
+CREATE FUNCTION spectrum_overlaps(spectrum, spectrumrange)
+  RETURNS boolean
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Test whether the spectrum has a peak within the window
+--- @param spectrum ion spectrum
+--- @param spectrumrange m/z window
+--- @return true if any peak m/z lies within the window
+CREATE FUNCTION spectrum_peak_within(spectrum, spectrumrange)
+  RETURNS boolean
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+CREATE OPERATOR && (
+    LEFTARG = spectrum,
+    RIGHTARG = spectrumrange,
+    FUNCTION = spectrum_overlaps,
+    RESTRICT = areasel,
+    JOIN = areajoinsel
+);
+
+CREATE OPERATOR @> (
+    LEFTARG = spectrum,
+    RIGHTARG = spectrumrange,
+    FUNCTION = spectrum_peak_within,
+    RESTRICT = areasel,
+    JOIN = areajoinsel
+);
+
+CREATE FUNCTION spectrum_gist_compress(internal)
+  RETURNS internal
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+CREATE FUNCTION spectrum_gist_consistent(internal, spectrumrange, smallint, oid, internal)
+  RETURNS boolean
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- GiST index of spectra keyed by m/z span, supports && and @> operators
+--- create index on isdb using gist (spectrum);
+--- select * from isdb where spectrum @> '[299.9, 300.1]';
+CREATE OPERATOR CLASS spectrum_mz_ops
+    DEFAULT FOR TYPE spectrum USING gist AS
+        OPERATOR 3 && (spectrum, spectrumrange),
+        OPERATOR 7 @> (spectrum, spectrumrange),
+        FUNCTION 1 spectrum_gist_consistent(internal, spectrumrange, smallint, oid, internal),
+        FUNCTION 2 range_gist_union(internal, internal),
+        FUNCTION 3 spectrum_gist_compress(internal),
+        FUNCTION 5 range_gist_penalty(internal, internal, internal),
+        FUNCTION 6 range_gist_picksplit(internal, internal),
+        FUNCTION 7 range_gist_same(anyrange, anyrange, internal),
+        STORAGE spectrumrange;
 
 --- Read given text literal in JSON format and returns the set of records
 --- @param jsonb JSON formated text
@@ -236,3 +343,407 @@ CREATE FUNCTION cosine_neutral_losses(spectrum, spectrum, float4, float4, float4
   RETURNS float4
   AS 'pgms'
   LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
+
+--- Search library table for spectra most similar to query spectrum (cosine greedy score)
+--- Heap blocks of library are scanned by parallel workers
+--- @param spectrum query spectrum
+--- @param regclass library table
+--- @param name library spectrum column
+--- @param float4 tolerance
+--- @param float4 score threshold
+--- @param integer number of best hits (0 returns all hits above threshold)
+--- @param integer number of parallel workers
+--- @return set of library row ctids with score
+CREATE FUNCTION library_search(spectrum, regclass, name, float4=0.1, float4=0.0, integer=10, integer=4)
+  RETURNS TABLE(ctid tid, score float4)
+  AS 'pgms'
+  LANGUAGE C STABLE STRICT COST 100000 ROWS 10;
+
+--- Load library spectra into shared memory cache (requires pgms in shared_preload_libraries)
+--- @param regclass library table
+--- @param name library spectrum column
+--- @param name library precursor column (optional, enables library_search_precursor)
+--- @return number of loaded spectra
+CREATE FUNCTION library_load(regclass, name, name=NULL)
+  RETURNS bigint
+  AS 'pgms'
+  LANGUAGE C VOLATILE;
+
+--- Drop library from shared memory cache
+--- @param regclass library table
+--- @return true if library was loaded
+CREATE FUNCTION library_unload(regclass)
+  RETURNS boolean
+  AS 'pgms'
+  LANGUAGE C VOLATILE STRICT;
+
+--- Trigger function dropping library from shared memory cache on its change
+--- create trigger library_cache after insert or update or delete or truncate on isdb
+---     for each statement execute function pgms.library_cache_invalidate();
+CREATE FUNCTION library_cache_invalidate()
+  RETURNS trigger
+  AS 'pgms'
+  LANGUAGE C;
+
+--- Search library loaded in shared memory cache for spectra within precursor window
+--- @param spectrum query spectrum
+--- @param float4 query precursor
+--- @param float4 precursor tolerance
+--- @param regclass library table
+--- @param name library spectrum column
+--- @param float4 tolerance
+--- @param float4 score threshold
+--- @param integer number of best hits (0 returns all hits above threshold)
+--- @return set of library row ctids with score
+CREATE FUNCTION library_search_precursor(spectrum, float4, float4, regclass, name, float4=0.1, float4=0.0, integer=10)
+  RETURNS TABLE(ctid tid, score float4)
+  AS 'pgms'
+  LANGUAGE C STABLE STRICT COST 1000 ROWS 10;
+
+--- Copy library spectra into a precursor sorted table of columnar chunks
+--- @param regclass library table
+--- @param name library spectrum column
+--- @param name library precursor column
+--- @param text name of created chunk table
+--- @param integer number of spectra per chunk
+--- @return number of packed spectra
+CREATE FUNCTION library_pack(regclass, name, name, text, integer=1024)
+  RETURNS bigint
+  AS 'pgms'
+  LANGUAGE C VOLATILE STRICT;
+
+--- Trigger function marking chunk table stale on change of its library, created by library_pack
+CREATE FUNCTION library_pack_invalidate()
+  RETURNS trigger
+  AS 'pgms'
+  LANGUAGE C;
+
+--- Search chunk table created by library_pack for spectra within precursor window
+--- @param spectrum query spectrum
+--- @param regclass chunk table
+--- @param float4 query precursor
+--- @param float4 precursor tolerance
+--- @param float4 tolerance
+--- @param float4 score threshold
+--- @param integer number of best hits (0 returns all hits above threshold)
+--- @return set of library row ctids with score
+CREATE FUNCTION library_search_packed(spectrum, regclass, float4, float4, float4=0.1, float4=0.0, integer=10)
+  RETURNS TABLE(ctid tid, score float4)
+  AS 'pgms'
+  LANGUAGE C STABLE STRICT COST 10000 ROWS 10;
+
+--- Import Large Object in Mascote Generic Format into table
+--- MGF keys are mapped to columns of the same name, spectrum goes to column of spectrum type
+--- @param Oid Large Object identificator
+--- @param regclass target table
+--- @param jsonb options {"batch_size": 1000, "freeze": false, "columns": {"PEPMASS": "pepmass"}}
+--- @return number of imported records
+CREATE FUNCTION import_mgf(Oid, regclass, jsonb='{}')
+  RETURNS bigint
+  AS 'pgms'
+  LANGUAGE C VOLATILE STRICT;
+
+--- Import Large Object in Mascote Generic Format into table by parallel background workers
+--- Large Object is split on BEGIN IONS lines, each worker commits its records independently
+--- The Large Object and the table have to be committed, the import is not atomic
+--- @param Oid Large Object identificator
+--- @param regclass target table (without row triggers)
+--- @param jsonb options (as import_mgf)
+--- @param integer number of background workers
+--- @return number of imported records
+CREATE FUNCTION import_mgf_parallel(Oid, regclass, jsonb='{}', integer=4)
+  RETURNS bigint
+  AS 'pgms'
+  LANGUAGE C VOLATILE STRICT;
+
+--- Checkpoints of import_mgf_checkpoint, offset of the next record to import
+CREATE TABLE mgf_import_checkpoint (
+    loid oid NOT NULL,
+    target regclass NOT NULL,
+    "offset" bigint NOT NULL,
+    imported bigint NOT NULL DEFAULT 0,
+    failed bigint NOT NULL DEFAULT 0,
+    finished boolean NOT NULL DEFAULT false,
+    updated timestamptz NOT NULL DEFAULT now(),
+    PRIMARY KEY (loid, target)
+);
+
+--- Records skipped by import_mgf_checkpoint
+CREATE TABLE mgf_import_error (
+    loid oid NOT NULL,
+    target regclass NOT NULL,
+    "offset" bigint NOT NULL,
+    sqlstate text NOT NULL,
+    reason text NOT NULL,
+    created timestamptz NOT NULL DEFAULT now()
+);
+
+--- Import Large Object in Mascote Generic Format into table with checkpoints
+--- Commits every checkpoint records and resumes from the last checkpoint when called again
+--- Failed records are skipped and logged to mgf_import_error
+--- @param Oid Large Object identificator
+--- @param regclass target table (without row triggers)
+--- @param jsonb options (as import_mgf) and checkpoint - number of records per commit (default 100000)
+--- call pgms.import_mgf_checkpoint(:LASTOID, 'isdb', '{"checkpoint": 10000}');
+CREATE PROCEDURE import_mgf_checkpoint(Oid, regclass, jsonb='{}')
+  AS 'pgms'
+  LANGUAGE C;
+
+--- Progress of running imports and library searches, reported in COPY progress slots (PostgreSQL 14+, empty before)
+--- select command, relid::regclass, bytes_processed * 100 / nullif(bytes_total, 0) as percent from pgms.stat_progress;
+CREATE VIEW stat_progress AS
+  SELECT s.pid, s.datid, d.datname, s.relid,
+    CASE s.param20 WHEN 1 THEN 'import' WHEN 2 THEN 'search' END AS command,
+    s.param1 AS bytes_processed,
+    s.param2 AS bytes_total,
+    s.param11 AS records_parsed,
+    s.param3 AS rows_inserted,
+    s.param12 AS rows_scanned,
+    s.param13 AS rows_scored,
+    s.param14 AS rows_total
+  FROM pg_stat_get_progress_info(CASE WHEN current_setting('server_version_num')::integer >= 140000 THEN 'COPY' END) AS s
+    LEFT JOIN pg_database d ON s.datid = d.oid
+  WHERE s.param20 <> 0;
+
+--- Read given Large Object Oid in Mascote Generic Format with spectrum preprocessing
+--- @param Oid Large Object identificator
+--- @param jsonb preprocessing options
+---     sort - sort peaks by m/z
+---     normalize - scale intensities by the highest one (as spectrum_normalize)
+---     min_intensity - drop peaks below the fraction of the highest intensity
+---     top_n - keep n most intense peaks
+---     mz_range - [min, max] m/z of kept peaks
+---     remove_precursor - drop peaks within the tolerance of precursor m/z
+---     merge_tolerance - merge neighbouring peaks closer than the tolerance
+---     precursor - key holding precursor m/z (default PEPMASS)
+--- @return Set of untyped records with selected columns
+--- select * from pgms.load_from_mgf(:LASTOID, '{"normalize": true, "top_n": 100}') as (
+---    "PEPMASS" float,
+---    spectrum pgms.spectrum
+---);
+CREATE FUNCTION load_from_mgf(Oid, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mgf_lo'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Read given text literal in Mascote Generic Format with spectrum preprocessing
+--- @param varchar MGF formated text
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_mgf(varchar, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mgf_varchar'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Read given server file in Mascote Generic Format with spectrum preprocessing
+--- @param text path of the file on the server
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_mgf_file(text, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mgf_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read given text literal in JSON format with spectrum preprocessing
+--- @param jsonb JSON formated text
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_json(jsonb, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_from_json'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Read JSON spectrum library from Large Object incrementally, the document is
+--- an array of objects (as load_from_json) of any size, each object becomes one row
+--- @param Oid Large Object identificator
+--- @return Set of untyped records with selected columns
+--- select * from pgms.load_from_json_lo(:LASTOID) as (
+---    "TITLE" varchar,
+---    peaks pgms.spectrum
+---);
+CREATE FUNCTION load_from_json_lo(Oid)
+    RETURNS SETOF record
+    AS 'pgms', 'load_json_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read JSON spectrum library from Large Object incrementally with spectrum preprocessing
+--- @param Oid Large Object identificator
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_json_lo(Oid, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_json_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read JSON spectrum library from server file incrementally
+--- Requires privileges of pg_read_server_files role
+--- @param text path of the file on the server
+--- @return Set of untyped records with selected columns
+--- select * from pgms.load_from_json_file('/data/gnps.json') as (
+---    "TITLE" varchar,
+---    peaks pgms.spectrum
+---);
+CREATE FUNCTION load_from_json_file(text)
+    RETURNS SETOF record
+    AS 'pgms', 'load_json_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read JSON spectrum library from server file incrementally with spectrum preprocessing
+--- Requires privileges of pg_read_server_files role
+--- @param text path of the file on the server
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_json_file(text, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_json_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Write rows of the query into Large Object in Mascote Generic Format, the
+--- first spectrum column is written as peak list, other columns as KEY=value
+--- lines named by the column, NULL values are skipped
+--- @param text query
+--- @param Oid existing Large Object identificator, its content is replaced
+--- @return number of exported records
+--- select pgms.export_mgf('select name as "TITLE", pepmass as "PEPMASS", spectrum from isdb', lo_create(0));
+CREATE FUNCTION export_mgf(text, Oid)
+    RETURNS bigint
+    AS 'pgms', 'export_mgf_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Write rows of the query into server file in Mascote Generic Format (as export_mgf(text, Oid))
+--- Requires privileges of pg_write_server_files role
+--- @param text query
+--- @param text absolute path of the file on the server, an existing file is replaced
+--- @return number of exported records
+CREATE FUNCTION export_mgf(text, text)
+    RETURNS bigint
+    AS 'pgms', 'export_mgf_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Write rows of the query into Large Object as Arrow IPC stream, spectrum columns
+--- are list<struct<mz: float, intensity: float>>, bool, integer and float columns
+--- keep their binary values, other columns are utf8 text
+--- @param text query
+--- @param Oid existing Large Object identificator, its content is replaced
+--- @return number of exported rows
+--- select pgms.export_arrow('select name, spectrum from isdb', lo_create(0));
+CREATE FUNCTION export_arrow(text, Oid)
+    RETURNS bigint
+    AS 'pgms', 'export_arrow_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Write rows of the query into server file as Arrow IPC stream (as export_arrow(text, Oid))
+--- Requires privileges of pg_write_server_files role
+--- @param text query
+--- @param text absolute path of the file on the server, an existing file is replaced
+--- @return number of exported rows
+CREATE FUNCTION export_arrow(text, text)
+    RETURNS bigint
+    AS 'pgms', 'export_arrow_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read given Large Object in mzML format and returns the set of records, one per spectrum.
+--- The spectrum column is decoded from m/z and intensity binary data arrays (base64,
+--- optionally zlib compressed 32 or 64 bit floats), other columns are matched by
+--- cvParam/userParam name or cvParam accession, "id" and "index" by spectrum attributes
+--- @param Oid Large Object identificator
+--- @return Set of untyped records with selected columns
+--- select * from pgms.load_from_mzml(:LASTOID) as (
+---    id varchar,
+---    "ms level" integer,
+---    "selected ion m/z" float4,
+---    spectrum pgms.spectrum
+---);
+CREATE FUNCTION load_from_mzml(Oid)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mzml_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read given Large Object in mzML format with spectrum preprocessing
+--- @param Oid Large Object identificator
+--- @param jsonb preprocessing options (as load_from_mgf(Oid, jsonb)), precursor defaults to selected ion m/z
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_mzml(Oid, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mzml_lo'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read given server file in mzML format (as load_from_mzml(Oid))
+--- Requires privileges of pg_read_server_files role
+--- @param text path of the file on the server
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_mzml_file(text)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mzml_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Read given server file in mzML format with spectrum preprocessing
+--- Requires privileges of pg_read_server_files role
+--- @param text path of the file on the server
+--- @param jsonb preprocessing options (as load_from_mzml(Oid, jsonb))
+--- @return Set of untyped records with selected columns
+CREATE FUNCTION load_from_mzml_file(text, jsonb)
+    RETURNS SETOF record
+    AS 'pgms', 'load_mzml_file'
+    LANGUAGE C VOLATILE STRICT;
+
+--- Apply preprocessing filters to the spectrum in one pass
+--- @param spectrum ion spectrum
+--- @param jsonb preprocessing options (as for load_from_mgf)
+--- @param float4 precursor m/z used by remove_precursor
+--- @return filtered spectrum
+--- select pgms.spectrum_filter(spectrum, '{"mz_range": [50, 1000], "merge_tolerance": 0.01, "top_n": 100}', pepmass) from isdb;
+CREATE FUNCTION spectrum_filter(spectrum, jsonb, float4=NULL)
+  RETURNS spectrum
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+--- Convert spectrum to neutral losses (precursor m/z minus fragment m/z), sorted by loss
+--- @param spectrum ion spectrum
+--- @param float4 precursor m/z
+--- @return neutral loss spectrum
+--- alter table isdb add column losses pgms.spectrum generated always as (pgms.to_neutral_losses(spectrum, pepmass)) stored;
+CREATE FUNCTION to_neutral_losses(spectrum, float4)
+  RETURNS spectrum
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT;
+
+--- Compute neutral losses cosine similarity score of precomputed neutral loss spectra (greedy cosine)
+--- @param spectrum reference neutral loss spectrum
+--- @param spectrum query neutral loss spectrum
+--- @param float4 tolerance (default value 0.1)
+--- @param float4 mass power (default value 0.0)
+--- @param float4 intenzity power (default value 1.0)
+--- @return neutral losses cosine similarity score
+--- select pgms.cosine_neutral_losses_greedy(r.losses, q.losses, 0.1) from isdb r, queries q;
+CREATE FUNCTION cosine_neutral_losses_greedy(spectrum, spectrum, float4=0.1, float4=0.0, float4=1.0)
+  RETURNS float4
+  AS 'pgms', 'cosine_greedy'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
+
+--- Compute modified cosine similarity scores for several pepmass shifts in one sweep
+--- @param spectrum reference spectrum
+--- @param spectrum query spectrum
+--- @param float4[] pepmass shifts (e.g. per adduct)
+--- @param float4 tolerance (default value 0.1)
+--- @param float4 mass power (default value 0.0)
+--- @param float4 intenzity power (default value 1.0)
+--- @return modified cosine similarity score of each shift
+CREATE FUNCTION cosine_modified_shifts(spectrum, spectrum, float4[], float4=0.1, float4=0.0, float4=1.0)
+  RETURNS float4[]
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
+
+--- Compute the best modified cosine similarity score over several pepmass shifts in one sweep
+--- @param spectrum reference spectrum
+--- @param spectrum query spectrum
+--- @param float4[] pepmass shifts (e.g. per adduct)
+--- @param float4 tolerance (default value 0.1)
+--- @param float4 mass power (default value 0.0)
+--- @param float4 intenzity power (default value 1.0)
+--- @return the best score and its shift (NULL for no shifts)
+--- select (pgms.cosine_modified_best(r.spectrum, q.spectrum, array[r.pepmass - q.pepmass, r.pepmass - q.pepmass + 21.98194])).* from isdb r, queries q;
+CREATE FUNCTION cosine_modified_best(spectrum, spectrum, float4[], float4=0.1, float4=0.0, float4=1.0, OUT score float4, OUT shift float4)
+  RETURNS record
+  AS 'pgms'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE STRICT COST 1000;
@@ -0,0 +1,691 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Arrow IPC export
+ *
+ * export_arrow() writes rows of a query as Arrow IPC stream: the schema
+ * message, one record batch per cursor fetch and the end of stream marker.
+ * Spectra are list<struct<mz: float, intensity: float>> columns, m/z and
+ * intensity buffers are copied from the spectrum arrays as they are, so
+ * readers can map them without parsing. Fixed width columns (bool, integers,
+ * float4, float8) keep their binary values, everything else is written as
+ * utf8 text.
+ *
+ * The flatbuffer metadata is encoded here directly, only a small subset of
+ * Schema.fbs and Message.fbs is needed. Objects are written front to back,
+ * so offsets always point forward to objects written later and are patched
+ * once the object is placed.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <mb/pg_wchar.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "reader.h"
+#include "spectrum.h"
+
+#define ARROW_FETCH_SIZE            10000
+#define ARROW_ALIGNMENT             8
+#define ARROW_MAX_FIELDS            6
+#define ARROW_CONTINUATION          0xFFFFFFFF
+#define ARROW_METADATA_V5           4
+
+// members of MessageHeader and Type unions
+#define ARROW_HEADER_SCHEMA         1
+#define ARROW_HEADER_RECORD_BATCH   3
+#define ARROW_TYPE_INT              2
+#define ARROW_TYPE_FLOATING_POINT   3
+#define ARROW_TYPE_UTF8             5
+#define ARROW_TYPE_BOOL             6
+#define ARROW_TYPE_LIST             12
+#define ARROW_TYPE_STRUCT           13
+
+#define ARROW_PRECISION_SINGLE      1
+#define ARROW_PRECISION_DOUBLE      2
+
+typedef enum ArrowKind
+{
+    ARROW_BOOL,
+    ARROW_INT16,
+    ARROW_INT32,
+    ARROW_INT64,
+    ARROW_FLOAT,
+    ARROW_DOUBLE,
+    ARROW_UTF8,
+    ARROW_SPECTRUM,
+}
+ArrowKind;
+
+typedef struct ArrowColumn
+{
+    ArrowKind       kind;
+    char            *name;
+    bool            direct;         // text like varlena is copied without output function
+    FmgrInfo        output;
+    int64           null_count;
+    StringInfoData  validity;
+    StringInfoData  offsets;        // utf8 byte and spectrum peak offsets
+    StringInfoData  data;           // values, m/z of spectra
+    StringInfoData  intensities;    // spectra only
+} ArrowColumn;
+
+typedef struct ArrowBuffer
+{
+    const char      *data;
+    int64           length;
+} ArrowBuffer;
+
+typedef struct FbField
+{
+    int             size;           // 0 for absent field
+    uint64          value;          // offsets are linked after the table is written
+} FbField;
+
+static void fb_pad(StringInfo fb, int align)
+{
+    while(fb->len % align)
+        appendStringInfoCharMacro(fb, '\0');
+}
+
+// flatbuffers are little endian regardless of the platform
+static void fb_put(StringInfo fb, uint64 value, int size)
+{
+    for(int i = 0; i < size; i++)
+        appendStringInfoCharMacro(fb, (char) (value >> (8 * i)));
+}
+
+static void fb_link(StringInfo fb, int pos, int target)
+{
+    uint32 offset = target - pos;
+
+    for(int i = 0; i < 4; i++)
+        fb->data[pos + i] = (char) (offset >> (8 * i));
+}
+
+/*
+ * Writes vtable followed by the table of fields indexed by their id and
+ * returns position of the table. Positions of the fields are stored into
+ * positions when given, to link offset fields later.
+ */
+static int fb_table(StringInfo fb, const FbField *fields, int count, int *positions)
+{
+    uint16 offsets[ARROW_MAX_FIELDS];
+    int vtable_size = 4 + 2 * count;
+    int table_size = 4;
+    int vtable = 0;
+    int table = 0;
+
+    Assert(count <= ARROW_MAX_FIELDS);
+
+    for(int i = 0; i < count; i++)
+    {
+        offsets[i] = 0;
+        if(fields[i].size == 0)
+            continue;
+
+        table_size = TYPEALIGN(fields[i].size, table_size);
+        offsets[i] = table_size;
+        table_size += fields[i].size;
+    }
+
+    // the table starts 8 byte aligned right after its vtable
+    fb_pad(fb, 2);
+    while((fb->len + vtable_size) % ARROW_ALIGNMENT)
+        fb_put(fb, 0, 2);
+
+    vtable = fb->len;
+    fb_put(fb, vtable_size, 2);
+    fb_put(fb, table_size, 2);
+    for(int i = 0; i < count; i++)
+        fb_put(fb, offsets[i], 2);
+
+    table = fb->len;
+    fb_put(fb, table - vtable, 4);
+
+    for(int i = 0; i < count; i++)
+    {
+        if(fields[i].size == 0)
+            continue;
+
+        while(fb->len < table + offsets[i])
+            appendStringInfoCharMacro(fb, '\0');
+        if(positions)
+            positions[i] = fb->len;
+        fb_put(fb, fields[i].value, fields[i].size);
+    }
+
+    return table;
+}
+
+static int fb_string(StringInfo fb, const char *value)
+{
+    int pos = 0;
+
+    fb_pad(fb, 4);
+    pos = fb->len;
+    fb_put(fb, strlen(value), 4);
+    appendBinaryStringInfo(fb, value, strlen(value) + 1);
+
+    return pos;
+}
+
+// offsets of the elements at pos + 4 * (i + 1) are linked by the caller
+static int fb_offset_vector(StringInfo fb, int count)
+{
+    int pos = 0;
+
+    fb_pad(fb, 4);
+    pos = fb->len;
+    fb_put(fb, count, 4);
+    for(int i = 0; i < count; i++)
+        fb_put(fb, 0, 4);
+
+    return pos;
+}
+
+// vector of FieldNode or Buffer structs, both are pairs of longs
+static int fb_pair_vector(StringInfo fb, const int64 *values, int count)
+{
+    int pos = 0;
+
+    fb_pad(fb, 4);
+    if((fb->len + 4) % ARROW_ALIGNMENT)
+        fb_put(fb, 0, 4);
+
+    pos = fb->len;
+    fb_put(fb, count, 4);
+    for(int i = 0; i < 2 * count; i++)
+        fb_put(fb, values[i], 8);
+
+    return pos;
+}
+
+// Message table, returns position of the header offset to link
+static int arrow_message(StringInfo fb, uint8 header_type, int64 body_length)
+{
+    FbField fields[4] = {{2, ARROW_METADATA_V5}, {1, header_type}, {4, 0}, {8, body_length}};
+    int positions[4];
+
+    resetStringInfo(fb);
+    fb_put(fb, 0, 4);
+    fb_link(fb, 0, fb_table(fb, fields, 4, positions));
+
+    return positions[2];
+}
+
+// Field table linked from link, returns position of its children vector
+static int arrow_field(StringInfo fb, int link, const char *name, uint8 type, const FbField *type_fields, int type_count, int children)
+{
+    FbField fields[6] = {{4, 0}, {1, true}, {1, type}, {4, 0}, {0, 0}, {4, 0}};
+    int positions[6];
+    int vector = 0;
+
+    fb_link(fb, link, fb_table(fb, fields, 6, positions));
+    fb_link(fb, positions[0], fb_string(fb, name));
+    fb_link(fb, positions[3], fb_table(fb, type_fields, type_count, NULL));
+
+    // readers require children vector even for leaf fields
+    vector = fb_offset_vector(fb, children);
+    fb_link(fb, positions[5], vector);
+
+    return vector;
+}
+
+static void arrow_column_field(StringInfo fb, int link, ArrowColumn *column)
+{
+    FbField float_type[1] = {{2, ARROW_PRECISION_SINGLE}};
+    int vector = 0;
+
+    switch(column->kind)
+    {
+        case ARROW_BOOL:
+            arrow_field(fb, link, column->name, ARROW_TYPE_BOOL, NULL, 0, 0);
+            break;
+        case ARROW_INT16:
+        case ARROW_INT32:
+        case ARROW_INT64:
+        {
+            int width = column->kind == ARROW_INT16 ? 16 : column->kind == ARROW_INT32 ? 32 : 64;
+            FbField int_type[2] = {{4, width}, {1, true}};
+
+            arrow_field(fb, link, column->name, ARROW_TYPE_INT, int_type, 2, 0);
+            break;
+        }
+        case ARROW_FLOAT:
+            arrow_field(fb, link, column->name, ARROW_TYPE_FLOATING_POINT, float_type, 1, 0);
+            break;
+        case ARROW_DOUBLE:
+        {
+            FbField double_type[1] = {{2, ARROW_PRECISION_DOUBLE}};
+
+            arrow_field(fb, link, column->name, ARROW_TYPE_FLOATING_POINT, double_type, 1, 0);
+            break;
+        }
+        case ARROW_UTF8:
+            arrow_field(fb, link, column->name, ARROW_TYPE_UTF8, NULL, 0, 0);
+            break;
+        case ARROW_SPECTRUM:
+            vector = arrow_field(fb, link, column->name, ARROW_TYPE_LIST, NULL, 0, 1);
+            vector = arrow_field(fb, vector + 4, "item", ARROW_TYPE_STRUCT, NULL, 0, 2);
+            arrow_field(fb, vector + 4, "mz", ARROW_TYPE_FLOATING_POINT, float_type, 1, 0);
+            arrow_field(fb, vector + 8, "intensity", ARROW_TYPE_FLOATING_POINT, float_type, 1, 0);
+            break;
+    }
+}
+
+static void arrow_write_message(Writer *writer, StringInfo fb, const ArrowBuffer *buffers, int count)
+{
+    static const char padding[ARROW_ALIGNMENT] = {0};
+    StringInfoData prefix;
+
+    // metadata size includes padding, the body follows 8 byte aligned
+    fb_pad(fb, ARROW_ALIGNMENT);
+    initStringInfo(&prefix);
+    fb_put(&prefix, ARROW_CONTINUATION, 4);
+    fb_put(&prefix, fb->len, 4);
+    writer_write(writer, prefix.data, prefix.len);
+    writer_write(writer, fb->data, fb->len);
+    pfree(prefix.data);
+
+    for(int i = 0; i < count; i++)
+    {
+        writer_write(writer, buffers[i].data, buffers[i].length);
+        writer_write(writer, padding, TYPEALIGN(ARROW_ALIGNMENT, buffers[i].length) - buffers[i].length);
+    }
+}
+
+static void arrow_write_schema(Writer *writer, StringInfo fb, ArrowColumn *columns, int count)
+{
+#ifdef WORDS_BIGENDIAN
+    FbField fields[2] = {{2, 1}, {4, 0}};
+#else
+    FbField fields[2] = {{0, 0}, {4, 0}};
+#endif
+    int positions[2];
+    int link = arrow_message(fb, ARROW_HEADER_SCHEMA, 0);
+    int vector = 0;
+
+    fb_link(fb, link, fb_table(fb, fields, 2, positions));
+    vector = fb_offset_vector(fb, count);
+    fb_link(fb, positions[1], vector);
+
+    for(int i = 0; i < count; i++)
+        arrow_column_field(fb, vector + 4 * (i + 1), &columns[i]);
+
+    arrow_write_message(writer, fb, NULL, 0);
+}
+
+static void arrow_add_node(int64 *nodes, int *node_count, int64 length, int64 null_count)
+{
+    nodes[2 * *node_count] = length;
+    nodes[2 * *node_count + 1] = null_count;
+    (*node_count)++;
+}
+
+static void arrow_add_buffer(ArrowBuffer *buffers, int *buffer_count, const char *data, int64 length)
+{
+    buffers[*buffer_count].data = data;
+    buffers[*buffer_count].length = length;
+    (*buffer_count)++;
+}
+
+static void arrow_write_batch(Writer *writer, StringInfo fb, ArrowColumn *columns, int count, int64 rows)
+{
+    int64 *nodes = palloc(4 * 2 * count * sizeof(int64));
+    ArrowBuffer *buffers = palloc(6 * count * sizeof(ArrowBuffer));
+    int64 *layout = NULL;
+    int node_count = 0;
+    int buffer_count = 0;
+    int64 body_length = 0;
+    FbField fields[3] = {{8, rows}, {4, 0}, {4, 0}};
+    int positions[3];
+    int link = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        ArrowColumn *column = &columns[i];
+        // validity bitmap may be omitted when there is no null
+        int64 validity = column->null_count ? column->validity.len : 0;
+
+        arrow_add_node(nodes, &node_count, rows, column->null_count);
+        arrow_add_buffer(buffers, &buffer_count, column->validity.data, validity);
+
+        switch(column->kind)
+        {
+            case ARROW_UTF8:
+                arrow_add_buffer(buffers, &buffer_count, column->offsets.data, column->offsets.len);
+                arrow_add_buffer(buffers, &buffer_count, column->data.data, column->data.len);
+                break;
+            case ARROW_SPECTRUM:
+            {
+                int64 peaks = column->data.len / sizeof(float4);
+
+                arrow_add_buffer(buffers, &buffer_count, column->offsets.data, column->offsets.len);
+                arrow_add_node(nodes, &node_count, peaks, 0);
+                arrow_add_buffer(buffers, &buffer_count, NULL, 0);
+                arrow_add_node(nodes, &node_count, peaks, 0);
+                arrow_add_buffer(buffers, &buffer_count, NULL, 0);
+                arrow_add_buffer(buffers, &buffer_count, column->data.data, column->data.len);
+                arrow_add_node(nodes, &node_count, peaks, 0);
+                arrow_add_buffer(buffers, &buffer_count, NULL, 0);
+                arrow_add_buffer(buffers, &buffer_count, column->intensities.data, column->intensities.len);
+                break;
+            }
+            default:
+                arrow_add_buffer(buffers, &buffer_count, column->data.data, column->data.len);
+                break;
+        }
+    }
+
+    layout = palloc(2 * buffer_count * sizeof(int64));
+    for(int i = 0; i < buffer_count; i++)
+    {
+        layout[2 * i] = body_length;
+        layout[2 * i + 1] = buffers[i].length;
+        body_length += TYPEALIGN(ARROW_ALIGNMENT, buffers[i].length);
+    }
+
+    link = arrow_message(fb, ARROW_HEADER_RECORD_BATCH, body_length);
+    fb_link(fb, link, fb_table(fb, fields, 3, positions));
+    fb_link(fb, positions[1], fb_pair_vector(fb, nodes, node_count));
+    fb_link(fb, positions[2], fb_pair_vector(fb, layout, buffer_count));
+
+    arrow_write_message(writer, fb, buffers, buffer_count);
+
+    pfree(layout);
+    pfree(buffers);
+    pfree(nodes);
+}
+
+static void arrow_set_bit(StringInfo bitmap, int64 index, bool value)
+{
+    while(bitmap->len <= index / 8)
+        appendStringInfoCharMacro(bitmap, '\0');
+
+    if(value)
+        bitmap->data[index / 8] |= (char) (1 << (index % 8));
+}
+
+static void arrow_add_offset(StringInfo offsets, int64 offset)
+{
+    int32 value = (int32) offset;
+
+    if(offset > PG_INT32_MAX)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED)
+            , errmsg("arrow batch exceeds 2GB of column data")));
+
+    appendBinaryStringInfo(offsets, (char *) &value, sizeof(int32));
+}
+
+static void arrow_reset(ArrowColumn *columns, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        ArrowColumn *column = &columns[i];
+
+        column->null_count = 0;
+        resetStringInfo(&column->validity);
+        resetStringInfo(&column->offsets);
+        resetStringInfo(&column->data);
+        resetStringInfo(&column->intensities);
+
+        if(column->kind == ARROW_UTF8 || column->kind == ARROW_SPECTRUM)
+            arrow_add_offset(&column->offsets, 0);
+    }
+}
+
+static void arrow_append(ArrowColumn *column, int64 row, Datum value, bool isnull)
+{
+    arrow_set_bit(&column->validity, row, !isnull);
+    column->null_count += isnull ? 1 : 0;
+
+    switch(column->kind)
+    {
+        case ARROW_BOOL:
+            arrow_set_bit(&column->data, row, !isnull && DatumGetBool(value));
+            break;
+        case ARROW_INT16:
+        {
+            int16 v = isnull ? 0 : DatumGetInt16(value);
+            appendBinaryStringInfo(&column->data, (char *) &v, sizeof(v));
+            break;
+        }
+        case ARROW_INT32:
+        {
+            int32 v = isnull ? 0 : DatumGetInt32(value);
+            appendBinaryStringInfo(&column->data, (char *) &v, sizeof(v));
+            break;
+        }
+        case ARROW_INT64:
+        {
+            int64 v = isnull ? 0 : DatumGetInt64(value);
+            appendBinaryStringInfo(&column->data, (char *) &v, sizeof(v));
+            break;
+        }
+        case ARROW_FLOAT:
+        {
+            float4 v = isnull ? 0.0f : DatumGetFloat4(value);
+            appendBinaryStringInfo(&column->data, (char *) &v, sizeof(v));
+            break;
+        }
+        case ARROW_DOUBLE:
+        {
+            float8 v = isnull ? 0.0 : DatumGetFloat8(value);
+            appendBinaryStringInfo(&column->data, (char *) &v, sizeof(v));
+            break;
+        }
+        case ARROW_UTF8:
+            if(!isnull)
+            {
+                char *text = NULL;
+                char *converted = NULL;
+                int len = 0;
+
+                if(column->direct)
+                {
+                    struct varlena *varlena = PG_DETOAST_DATUM_PACKED(value);
+
+                    text = VARDATA_ANY(varlena);
+                    len = VARSIZE_ANY_EXHDR(varlena);
+                }
+                else
+                {
+                    text = OutputFunctionCall(&column->output, value);
+                    len = strlen(text);
+                }
+
+                // arrow strings are utf8, the input is returned as is for utf8 database
+                converted = pg_server_to_any(text, len, PG_UTF8);
+                if(converted != text)
+                    len = strlen(converted);
+                appendBinaryStringInfo(&column->data, converted, len);
+            }
+            arrow_add_offset(&column->offsets, column->data.len);
+            break;
+        case ARROW_SPECTRUM:
+            if(!isnull)
+            {
+                Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(value));
+                size_t len = spectrum_length(spectrum);
+                float4 *mzs = spectrum_data(spectrum);
+
+                appendBinaryStringInfo(&column->data, (char *) mzs, len * sizeof(float4));
+                appendBinaryStringInfo(&column->intensities, (char *) (mzs + len), len * sizeof(float4));
+            }
+            arrow_add_offset(&column->offsets, column->data.len / sizeof(float4));
+            break;
+    }
+}
+
+static ArrowColumn *arrow_columns(TupleDesc tupdesc)
+{
+    ArrowColumn *columns = palloc0(tupdesc->natts * sizeof(ArrowColumn));
+
+    for(int i = 0; i < tupdesc->natts; i++)
+    {
+        ArrowColumn *column = &columns[i];
+        Oid type = TupleDescAttr(tupdesc, i)->atttypid;
+
+        column->name = pstrdup(NameStr(TupleDescAttr(tupdesc, i)->attname));
+        initStringInfo(&column->validity);
+        initStringInfo(&column->offsets);
+        initStringInfo(&column->data);
+        initStringInfo(&column->intensities);
+
+        switch(type)
+        {
+            case BOOLOID:
+                column->kind = ARROW_BOOL;
+                break;
+            case INT2OID:
+                column->kind = ARROW_INT16;
+                break;
+            case INT4OID:
+                column->kind = ARROW_INT32;
+                break;
+            case INT8OID:
+                column->kind = ARROW_INT64;
+                break;
+            case FLOAT4OID:
+                column->kind = ARROW_FLOAT;
+                break;
+            case FLOAT8OID:
+                column->kind = ARROW_DOUBLE;
+                break;
+            case TEXTOID:
+            case VARCHAROID:
+            case BPCHAROID:
+                column->kind = ARROW_UTF8;
+                column->direct = true;
+                break;
+            default:
+                if(is_spectrum_type(type))
+                    column->kind = ARROW_SPECTRUM;
+                else
+                {
+                    Oid output = InvalidOid;
+                    bool varlena = false;
+
+                    column->kind = ARROW_UTF8;
+                    getTypeOutputInfo(type, &output, &varlena);
+                    fmgr_info(output, &column->output);
+                }
+                break;
+        }
+    }
+
+    return columns;
+}
+
+static int64 export_arrow(const char *query, Writer *writer)
+{
+    StringInfoData fb;
+    MemoryContext context = NULL;
+    ArrowColumn *columns = NULL;
+    TupleDesc tupdesc = NULL;
+    SPIPlanPtr plan = NULL;
+    Portal portal = NULL;
+    int64 exported = 0;
+    static const char end_of_stream[8] = {'\xff', '\xff', '\xff', '\xff', 0, 0, 0, 0};
+
+    initStringInfo(&fb);
+
+    SPI_connect();
+
+    plan = SPI_prepare(query, 0, NULL);
+    if(plan == NULL)
+        elog(ERROR, "export arrow: %s", SPI_result_code_string(SPI_result));
+
+    if(!SPI_is_cursor_plan(plan))
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE)
+            , errmsg("export query must return rows")));
+
+    portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+    tupdesc = portal->tupDesc;
+    columns = arrow_columns(tupdesc);
+    context = AllocSetContextCreate(CurrentMemoryContext, "pgms export", ALLOCSET_DEFAULT_SIZES);
+
+    arrow_write_schema(writer, &fb, columns, tupdesc->natts);
+
+    while(true)
+    {
+        MemoryContext oldcontext = NULL;
+
+        CHECK_FOR_INTERRUPTS();
+
+        SPI_cursor_fetch(portal, true, ARROW_FETCH_SIZE);
+        if(SPI_processed == 0)
+            break;
+
+        arrow_reset(columns, tupdesc->natts);
+
+        for(uint64 row = 0; row < SPI_processed; row++)
+        {
+            oldcontext = MemoryContextSwitchTo(context);
+
+            for(int i = 0; i < tupdesc->natts; i++)
+            {
+                bool isnull = false;
+                Datum value = SPI_getbinval(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, i + 1, &isnull);
+
+                arrow_append(&columns[i], row, value, isnull);
+            }
+
+            MemoryContextSwitchTo(oldcontext);
+            MemoryContextReset(context);
+        }
+
+        arrow_write_batch(writer, &fb, columns, tupdesc->natts, SPI_processed);
+        exported += SPI_processed;
+        SPI_freetuptable(SPI_tuptable);
+    }
+
+    SPI_cursor_close(portal);
+    MemoryContextDelete(context);
+    SPI_finish();
+
+    writer_write(writer, end_of_stream, sizeof(end_of_stream));
+    writer_close(writer);
+    pfree(fb.data);
+
+    return exported;
+}
+
+PG_FUNCTION_INFO_V1(export_arrow_lo);
+Datum export_arrow_lo(PG_FUNCTION_ARGS)
+{
+    char *query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+    PG_RETURN_INT64(export_arrow(query, writer_open_lo(PG_GETARG_OID(1))));
+}
+
+PG_FUNCTION_INFO_V1(export_arrow_file);
+Datum export_arrow_file(PG_FUNCTION_ARGS)
+{
+    char *query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+    PG_RETURN_INT64(export_arrow(query, writer_open_file(text_to_cstring(PG_GETARG_TEXT_PP(1)))));
+}
@@ -1,4 +1,6 @@
 #include <postgres.h>
+#include <float.h>
+#include <math.h>
 #include "cosine.h"
 
 static float4 calc_score_simple(const float4 intensity1,
@@ -152,3 +154,64 @@ calc_norm_func_t determine_calc_norm(const float4 mz_power,const float4 intensit
             return calc_norm_full;
     }
 }
+
+/*
+ * Buckets are built only for m/z sorted spectra of finite values, NULL is
+ * returned otherwise and the kernels keep walking the peaks. Bucket width
+ * grows for wide spectra so there are not more buckets than peaks.
+ */
+MzBuckets *mz_buckets_build(const float4 *mzs, const float4 *peaks, const size_t len,
+    const float4 tolerance, const float4 mz_power, const float4 intensity_power)
+{
+    calc_score_func_t calc_score = determine_calc_score(mz_power, intensity_power);
+    MzBuckets *buckets = NULL;
+    float4 span = 0.0f;
+    Index bucket = 0;
+
+    if(len == 0 || !isfinite(mzs[0]) || !isfinite(mzs[len - 1]))
+        return NULL;
+
+    for(size_t i = 1; i < len; i++)
+        if(!(mzs[i - 1] <= mzs[i]))
+            return NULL;
+
+    span = mzs[len - 1] - mzs[0];
+
+    buckets = palloc(sizeof(MzBuckets));
+    buckets->origin = mzs[0];
+    buckets->width = Max(Max(tolerance, span / len), FLT_MIN);
+    buckets->count = Min((size_t) (span / buckets->width), len) + 1;
+    buckets->starts = palloc((buckets->count + 1) * sizeof(Index));
+    buckets->weights = palloc((len + 1) * sizeof(float8));
+    buckets->mz_power = mz_power;
+    buckets->intensity_power = intensity_power;
+
+    buckets->weights[0] = 0.0;
+    buckets->starts[0] = 0;
+
+    for(Index i = 0; i < len; i++)
+    {
+        Index peak_bucket = Min((size_t) ((mzs[i] - buckets->origin) / buckets->width), buckets->count);
+
+        while(bucket < peak_bucket)
+            buckets->starts[++bucket] = i;
+
+        buckets->weights[i + 1] = buckets->weights[i]
+            + calc_score(peaks[i], peaks[i], mzs[i], mzs[i], intensity_power, mz_power);
+    }
+
+    while(bucket < buckets->count)
+        buckets->starts[++bucket] = len;
+
+    return buckets;
+}
+
+void mz_buckets_free(MzBuckets *buckets)
+{
+    if(buckets == NULL)
+        return;
+
+    pfree(buckets->starts);
+    pfree(buckets->weights);
+    pfree(buckets);
+}
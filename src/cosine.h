@@ -34,7 +34,72 @@ typedef float4 (*calc_norm_func_t)(const float4 *restrict,
     const float4,
     const float4);
 
+/*
+ * Peaks of a sorted spectrum grouped into m/z buckets at least the tolerance
+ * wide, so the first peak of a tolerance window is found in constant time
+ * instead of walking the spectrum. Only the query is bucketed, once per
+ * search, and only the greedy and upper bound kernels use the buckets. They
+ * pay off for a query much longer than the library spectra, a long library
+ * spectrum is walked as before.
+ */
+typedef struct MzBuckets
+{
+    float4      origin;
+    float4      width;
+    size_t      count;
+    Index       *starts;    // first peak of every bucket, count + 1 entries
+    float8      *weights;   // prefix sums of peak weights of the upper bound
+    float4      mz_power;
+    float4      intensity_power;
+} MzBuckets;
+
+// the shorter side has to be at least that many times shorter for the lookup
+#define MZ_BUCKETS_RATIO    8
+
+static inline Index mz_buckets_find(const MzBuckets *buckets, const float4 *mzs, const size_t len,
+    const float4 value, const bool inclusive)
+{
+    float4 offset = value - buckets->origin;
+    Index index = 0;
+
+    if(offset >= 0.0f)
+    {
+        if(offset / buckets->width >= (float4) buckets->count)
+            return len;
+
+        index = buckets->starts[(size_t) (offset / buckets->width)];
+    }
+
+    // first peak above value, or not below value when inclusive
+    while(index < len && (inclusive ? float4_lt(mzs[index], value) : !float4_gt(mzs[index], value)))
+        index++;
+
+    return index;
+}
+
+static inline bool mz_buckets_usable(const MzBuckets *buckets, const size_t len, const size_t other_len)
+{
+    return buckets != NULL && len >= MZ_BUCKETS_RATIO * other_len;
+}
+
+MzBuckets *mz_buckets_build(const float4 *mzs, const float4 *peaks, const size_t len,
+    const float4 tolerance, const float4 mz_power, const float4 intensity_power);
+void mz_buckets_free(MzBuckets *buckets);
+
 calc_score_func_t determine_calc_score(const float4 mz_power,const float4 intenzity_power);
 calc_norm_func_t  determine_calc_norm(const float4 mz_power,const float4 intenzity_power);
 
+float4 cosine_upper_bound_peaks(const float4 *restrict reference_mzs, const float4 *restrict reference_peaks,
+    const size_t reference_len, const float8 reference_norm, const float4 *restrict query_mzs,
+    const float4 *restrict query_peaks, const size_t query_len, const float8 query_norm,
+    const MzBuckets *query_buckets, const float4 tolerance, const float4 mz_power, const float4 intensity_power);
+float4 cosine_upper_bound_calc(Datum reference, Datum query, const float4 tolerance,
+    const float4 mz_power, const float4 intensity_power);
+bool cosine_upper_bound_supported(PGFunction kernel);
+
+float4 cosine_greedy_calc(const float4 *restrict reference_mzs, const float4 *restrict reference_peaks,
+    const size_t reference_len, const float4 *restrict query_mzs, const float4 *restrict query_peaks,
+    const size_t query_len, const MzBuckets *query_buckets, const float4 tolerance, const float4 mz_power,
+    const float4 intensity_power);
+
 #endif /* COSINE_H */
@@ -23,36 +23,19 @@
 #include "cosine.h"
 #include "spectrum.h"
 
-PG_FUNCTION_INFO_V1(cosine_greedy);
-Datum cosine_greedy(PG_FUNCTION_ARGS)
+float4 cosine_greedy_calc(const float4 *restrict reference_mzs, const float4 *restrict reference_peaks,
+    const size_t reference_len, const float4 *restrict query_mzs, const float4 *restrict query_peaks,
+    const size_t query_len, const MzBuckets *query_buckets, const float4 tolerance, const float4 mz_power,
+    const float4 intensity_power)
 {
-    size_t reference_len = 0;
-    size_t query_len = 0;
-    float4 *restrict reference_mzs = NULL;
-    float4 *restrict reference_peaks = NULL;
-    float4 *restrict query_mzs = NULL;
-    float4 *restrict query_peaks = NULL;
     Index *restrict query_used = NULL;
     Index *restrict query_stack = NULL;
     Index lowest_idx = 0;
     float4 score = 0.0f;
-
-    Datum reference = PG_GETARG_DATUM(0);
-    Datum query = PG_GETARG_DATUM(1);
-    float4 tolerance = PG_GETARG_FLOAT4(2);
-    float4 mz_power = PG_GETARG_FLOAT4(3);
-    float4 intensity_power = PG_GETARG_FLOAT4(4);
+    bool lookup = mz_buckets_usable(query_buckets, query_len, reference_len);
     calc_score_func_t calc_score = determine_calc_score(mz_power, intensity_power);
     calc_norm_func_t calc_norm = determine_calc_norm(mz_power, intensity_power);
 
-    reference_len = spectrum_length(reference);
-    reference_mzs = spectrum_data(reference);
-    reference_peaks = reference_mzs + reference_len;
-
-    query_len = spectrum_length(query);
-    query_mzs = spectrum_data(query);
-    query_peaks = query_mzs + query_len;
-
     query_used = (Index*) palloc0(query_len * sizeof(Index));
     query_stack = (Index*) palloc(query_len * sizeof(Index));
 
@@ -64,6 +47,10 @@ Datum cosine_greedy(PG_FUNCTION_ARGS)
         float4 highest_intensity = -get_float4_infinity();
         Index stack_top = 0;
 
+        // long query is not walked, its window starts at the first peak within the bounds
+        if(lookup)
+            lowest_idx = mz_buckets_find(query_buckets, query_mzs, query_len, low_bound, true);
+
         for(Index query_index = lowest_idx; query_index < query_len; query_index++)
         {
             if(float4_gt(query_mzs[query_index], high_bound))
@@ -128,6 +115,8 @@ Datum cosine_greedy(PG_FUNCTION_ARGS)
             {
                 if(forward >= reference_len)
                 {
+                    // every matched query peak is used once, as the upper bound assumes
+                    query_used[query_stack[0]] = 1;
                     best_match_mz = query_mzs[query_stack[0]];
                     best_match_peak = query_peaks[query_stack[0]];
                 }
@@ -151,13 +140,32 @@ Datum cosine_greedy(PG_FUNCTION_ARGS)
 
     pfree(query_used);
     pfree(query_stack);
-    PG_FREE_IF_COPY(PG_DETOAST_DATUM(reference), 0);
-    PG_FREE_IF_COPY(PG_DETOAST_DATUM(query), 1);
 
     if(float4_lt(score, 0.0f))
         score = 0.0f;
     else if(float4_gt(score, 1.0f))
         score = 1.0f;
 
+    return score;
+}
+
+PG_FUNCTION_INFO_V1(cosine_greedy);
+Datum cosine_greedy(PG_FUNCTION_ARGS)
+{
+    Datum reference = PG_GETARG_DATUM(0);
+    Datum query = PG_GETARG_DATUM(1);
+    float4 tolerance = PG_GETARG_FLOAT4(2);
+    float4 mz_power = PG_GETARG_FLOAT4(3);
+    float4 intensity_power = PG_GETARG_FLOAT4(4);
+    size_t reference_len = spectrum_length(reference);
+    float4 *reference_mzs = spectrum_data(reference);
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    float4 score = cosine_greedy_calc(reference_mzs, reference_mzs + reference_len, reference_len,
+        query_mzs, query_mzs + query_len, query_len, NULL, tolerance, mz_power, intensity_power);
+
+    PG_FREE_IF_COPY(PG_DETOAST_DATUM(reference), 0);
+    PG_FREE_IF_COPY(PG_DETOAST_DATUM(query), 1);
+
     PG_RETURN_FLOAT4(score);
 }
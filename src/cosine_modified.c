@@ -17,171 +17,302 @@
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <funcapi.h>
+#include <access/htup_details.h>
+#include <catalog/pg_type.h>
+#include <utils/array.h>
 #include <utils/float.h>
 
 #include "cosine.h"
 #include "spectrum.h"
 
-PG_FUNCTION_INFO_V1(cosine_modified);
-Datum cosine_modified(PG_FUNCTION_ARGS)
+/*
+ * Greedy matching state of one shift. Peaks of query are matched to reference
+ * peaks either directly or shifted, every shift consumes its own query peaks.
+ */
+typedef struct ModifiedShift
 {
-    size_t reference_len = 0;
-    size_t query_len = 0;
-    float4 *restrict reference_mzs = NULL;
-    float4 *restrict reference_peaks = NULL;
-    float4 *restrict query_mzs = NULL;
-    float4 *restrict query_peaks = NULL;
-    Index *restrict query_used = NULL;
-    Index *restrict query_stack = NULL;
-    Index lowest_idx = 0;
-    float4 score = 0.0f;
+    float4      shift;
+    Index       lowest_idx;
+    Index       *used;
+    float4      score;
+} ModifiedShift;
 
-    Datum reference = PG_GETARG_DATUM(0);
-    Datum query = PG_GETARG_DATUM(1);
-    const float4 shift = PG_GETARG_FLOAT4(2);
-    const float4 tolerance = PG_GETARG_FLOAT4(3);
-    const float4 mz_power = PG_GETARG_FLOAT4(4);
-    const float4 intensity_power = PG_GETARG_FLOAT4(5);
-    calc_score_func_t calc_score = determine_calc_score(mz_power, intensity_power);
-    calc_norm_func_t calc_norm = determine_calc_norm(mz_power, intensity_power);
-
-    reference_len = spectrum_length(reference);
-    reference_mzs = spectrum_data(reference);
-    reference_peaks = reference_mzs + reference_len;
+/*
+ * Query peaks from window_start to window_end match the reference peak
+ * unshifted, the window is found once for all shifts.
+ */
+static inline void cosine_modified_match(ModifiedShift *restrict state, const Index reference_index,
+    const float4 *restrict reference_mzs, const float4 *restrict reference_peaks, const size_t reference_len,
+    const float4 *restrict query_mzs, const float4 *restrict query_peaks, const size_t query_len,
+    const Index window_start, const Index window_end, Index *restrict query_stack, const float4 tolerance,
+    calc_score_func_t calc_score, const float4 mz_power, const float4 intensity_power)
+{
+    Index *restrict query_used = state->used;
+    float4 low_bound = reference_mzs[reference_index] - tolerance;
+    float4 high_bound = reference_mzs[reference_index] + tolerance;
+    float4 best_match_peak = 1.0f;
+    float4 highest_intensity = -get_float4_infinity();
+    Index stack_top = 0;
 
-    query_len = spectrum_length(query);
-    query_mzs = spectrum_data(query);
-    query_peaks = query_mzs + query_len;
+    // peaks below the shifted window of previous reference peaks are not matched again
+    for(Index peak2 = Max(window_start, state->lowest_idx); peak2 < window_end; peak2++)
+    {
+        if(float4_gt(query_peaks[peak2], highest_intensity) && !query_used[peak2])
+        {
+            query_stack[stack_top++] = peak2;
+            highest_intensity = query_peaks[peak2];
+            elog(DEBUG1, "stacked [%f,%f]", reference_mzs[reference_index], query_mzs[peak2]);
+        }
+    }
 
-    query_used = (Index*) palloc0(query_len * sizeof(Index));
-    query_stack = (Index*) palloc(query_len * sizeof(Index));
+    low_bound = low_bound + state->shift;
+    high_bound = high_bound + state->shift;
 
-    for(Index reference_index = 0; reference_index < reference_len; reference_index++)
+    for(Index query_index = state->lowest_idx; query_index < query_len; query_index++)
     {
-        float4 low_bound = reference_mzs[reference_index] - tolerance;
-        float4 high_bound = reference_mzs[reference_index] + tolerance;
-        float4 best_match_peak = 1.0f;
-        float4 highest_intensity = -get_float4_infinity();
-        Index stack_top = 0;
-
-        for(Index peak2 = lowest_idx; peak2 < query_len; peak2++)
+        if(float4_gt(query_mzs[query_index], high_bound))
         {
-            if(float4_gt(query_mzs[peak2], high_bound))
-            {
-                elog(DEBUG1, "break [%f,%f]", reference_mzs[reference_index], query_mzs[peak2]);
-                break;
-            }
+            elog(DEBUG1, "break-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
+            break;
+        }
 
-            if(float4_lt(query_mzs[peak2], low_bound))
-            {
-                elog(DEBUG1, "skip [%f,%f]", reference_mzs[reference_index], query_mzs[peak2]);
-                continue;
-            }
+        if(float4_lt(query_mzs[query_index], low_bound))
+        {
+            elog(DEBUG1, "skip-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
+            state->lowest_idx = query_index;
+            continue;
+        }
 
-            if(float4_gt(query_peaks[peak2], highest_intensity) && !query_used[peak2])
-            {
-                query_stack[stack_top++] = peak2;
-                highest_intensity = query_peaks[peak2];
-                elog(DEBUG1, "stacked [%f,%f]", reference_mzs[reference_index], query_mzs[peak2]);
-            }
+        if(float4_gt(query_peaks[query_index], highest_intensity) && !query_used[query_index])
+        {
+            query_stack[stack_top++] = query_index;
+            highest_intensity = query_peaks[query_index];
+            elog(DEBUG1, "stacked-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
         }
+    }
 
-        low_bound = low_bound + shift;
-        high_bound = high_bound + shift;
+    if(stack_top > 0)
+    {
+        Index forward = reference_index + 1;
+        float4 best_match_mz = NAN;
 
-        for(Index query_index = lowest_idx; query_index < query_len; query_index++)
+        while(forward < reference_len)
         {
-            if(float4_gt(query_mzs[query_index], high_bound))
+            if(float4_gt(reference_mzs[forward], query_mzs[query_stack[stack_top - 1]] + tolerance))
             {
-                elog(DEBUG1, "break-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
+                elog(DEBUG1, "forward break [%f,%f]", reference_mzs[forward], query_mzs[query_stack[stack_top - 1]]);
+                query_used[query_stack[stack_top - 1]] = 1;
+                best_match_peak = query_peaks[query_stack[stack_top - 1]];
+                best_match_mz = query_mzs[query_stack[stack_top - 1]];
                 break;
             }
 
-            if(float4_lt(query_mzs[query_index], low_bound))
+            if(float4_gt(reference_peaks[forward], highest_intensity))
             {
-                elog(DEBUG1, "skip-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
-                lowest_idx = query_index;
-                continue;
+                elog(DEBUG1, "forward colide [%f,%f]", reference_mzs[forward], query_mzs[query_stack[stack_top - 1]]);
+                forward = reference_index + 1;
+                highest_intensity = query_peaks[query_stack[stack_top - 1]];
+                best_match_mz = query_mzs[query_stack[stack_top - 1]];
+                best_match_peak = query_peaks[query_stack[stack_top - 1]];
+                stack_top--;
+                elog(DEBUG1, "best match: %f", best_match_peak);
             }
 
-            if(float4_gt(query_peaks[query_index], highest_intensity) && !query_used[query_index])
+            if(!stack_top)
             {
-                query_stack[stack_top++] = query_index;
-                highest_intensity = query_peaks[query_index];
-                elog(DEBUG1, "stacked-shift [%f,%f]", reference_mzs[reference_index], query_mzs[query_index]);
+                elog(DEBUG1, "backtrace break");
+                break;
             }
+
+            forward++;
         }
 
-        if(stack_top > 0)
+        if(stack_top)
         {
-            Index forward = reference_index + 1;
-            float4 best_match_mz = NAN;
-
-            while(forward < reference_len)
+            if(forward >= reference_len)
             {
-                if(float4_gt(reference_mzs[forward], query_mzs[query_stack[stack_top - 1]] + tolerance))
-                {
-                    elog(DEBUG1, "forward break [%f,%f]", reference_mzs[forward], query_mzs[query_stack[stack_top - 1]]);
-                    query_used[query_stack[stack_top - 1]] = 1;
-                    best_match_peak = query_peaks[query_stack[stack_top - 1]];
-                    best_match_mz = query_mzs[query_stack[stack_top - 1]];
-                    break;
-                }
-
-                if(float4_gt(reference_peaks[forward], highest_intensity))
-                {
-                    elog(DEBUG1, "forward colide [%f,%f]", reference_mzs[forward], query_mzs[query_stack[stack_top - 1]]);
-                    forward = reference_index + 1;
-                    highest_intensity = query_peaks[query_stack[stack_top - 1]];
-                    best_match_mz = query_mzs[query_stack[stack_top - 1]];
-                    best_match_peak = query_peaks[query_stack[stack_top - 1]];
-                    stack_top--;
-                    elog(DEBUG1, "best match: %f", best_match_peak);
-                }
-
-                if(!stack_top)
-                {
-                    elog(DEBUG1, "backtrace break");
-                    break;
-                }
-
-                forward++;
+                best_match_mz = query_mzs[query_stack[0]];
+                best_match_peak = query_peaks[query_stack[0]];
             }
 
-            if(stack_top)
-            {
-                if(forward >= reference_len)
-                {
-                    best_match_mz = query_mzs[query_stack[0]];
-                    best_match_peak = query_peaks[query_stack[0]];
-                }
-
-                elog(DEBUG1, "calc:[%f, %f] - [%f, %f]", reference_mzs[reference_index]
-                    , reference_peaks[reference_index]
-                    , best_match_mz, best_match_peak);
-                score = float4_pl(score, 
-                    calc_score(reference_peaks[reference_index], best_match_peak, reference_mzs[reference_index], best_match_mz, intensity_power, mz_power));
-            }
+            elog(DEBUG1, "calc:[%f, %f] - [%f, %f]", reference_mzs[reference_index]
+                , reference_peaks[reference_index]
+                , best_match_mz, best_match_peak);
+            state->score = float4_pl(state->score,
+                calc_score(reference_peaks[reference_index], best_match_peak, reference_mzs[reference_index], best_match_mz, intensity_power, mz_power));
         }
     }
+}
+
+/*
+ * Scores of all shifts computed in a single sweep over reference peaks, the
+ * unshifted window of every reference peak is scanned once and shared by all
+ * shifts, each shift keeps its own consumed peaks and shifted window. Spectra
+ * are detoasted and their norms computed only once.
+ */
+static void cosine_modified_calc(Datum reference, Datum query, const float4 *shifts, const int nshifts,
+    const float4 tolerance, const float4 mz_power, const float4 intensity_power, float4 *scores)
+{
+    size_t reference_len = spectrum_length(reference);
+    float4 *restrict reference_mzs = spectrum_data(reference);
+    float4 *restrict reference_peaks = reference_mzs + reference_len;
+    size_t query_len = spectrum_length(query);
+    float4 *restrict query_mzs = spectrum_data(query);
+    float4 *restrict query_peaks = query_mzs + query_len;
+    Index *restrict query_used = (Index*) palloc0(Max(nshifts * query_len, 1) * sizeof(Index));
+    Index *restrict query_stack = (Index*) palloc(Max(query_len, 1) * sizeof(Index));
+    ModifiedShift *states = (ModifiedShift*) palloc0(Max(nshifts, 1) * sizeof(ModifiedShift));
+    calc_score_func_t calc_score = determine_calc_score(mz_power, intensity_power);
+    calc_norm_func_t calc_norm = determine_calc_norm(mz_power, intensity_power);
+    float4 norm = 0.0f;
+    Index window_start = 0;
+
+    for(int i = 0; i < nshifts; i++)
+    {
+        states[i].shift = shifts[i];
+        states[i].used = query_used + i * query_len;
+    }
+
+    for(Index reference_index = 0; reference_index < reference_len; reference_index++)
+    {
+        float4 low_bound = reference_mzs[reference_index] - tolerance;
+        float4 high_bound = reference_mzs[reference_index] + tolerance;
+        Index window_end = 0;
+
+        while(window_start < query_len && float4_lt(query_mzs[window_start], low_bound))
+            window_start++;
+
+        window_end = window_start;
+        while(window_end < query_len && !float4_gt(query_mzs[window_end], high_bound))
+            window_end++;
+
+        for(int i = 0; i < nshifts; i++)
+            cosine_modified_match(&states[i], reference_index, reference_mzs, reference_peaks, reference_len,
+                query_mzs, query_peaks, query_len, window_start, window_end, query_stack, tolerance,
+                calc_score, mz_power, intensity_power);
+    }
 
-    if(float4_ne(score, 0.0f))
+    for(int i = 0; i < nshifts; i++)
     {
-        float4 norm1 = calc_norm(reference_peaks, reference_mzs, reference_len, intensity_power, mz_power);
-        float4 norm2 = calc_norm(query_peaks, query_mzs, query_len, intensity_power, mz_power);
+        float4 score = states[i].score;
+
+        if(float4_ne(score, 0.0f))
+        {
+            if(norm == 0.0f)
+            {
+                float4 norm1 = calc_norm(reference_peaks, reference_mzs, reference_len, intensity_power, mz_power);
+                float4 norm2 = calc_norm(query_peaks, query_mzs, query_len, intensity_power, mz_power);
+
+                norm = sqrtf(norm1 * norm2);
+            }
+
+            score = float4_div(score, norm);
+        }
+
+        if(float4_lt(score, 0.0f))
+            score = 0.0f;
+        else if(float4_gt(score, 1.0f))
+            score = 1.0f;
 
-        score = float4_div(score, sqrtf(norm1 * norm2));
+        scores[i] = score;
     }
 
     pfree(query_used);
     pfree(query_stack);
-    PG_FREE_IF_COPY(PG_DETOAST_DATUM(reference), 0);
-    PG_FREE_IF_COPY(PG_DETOAST_DATUM(query), 1);
+    pfree(states);
+}
+
+static float4 *cosine_modified_shifts_arg(FunctionCallInfo fcinfo, int argno, int *nshifts)
+{
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(argno);
+
+    if(ARR_NDIM(array) > 1 || ARR_HASNULL(array))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("shifts must be a one-dimensional array without nulls")));
+
+    *nshifts = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    return (float4 *) ARR_DATA_PTR(array);
+}
+
+PG_FUNCTION_INFO_V1(cosine_modified);
+Datum cosine_modified(PG_FUNCTION_ARGS)
+{
+    Datum reference = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(1)));
+    const float4 shift = PG_GETARG_FLOAT4(2);
+    const float4 tolerance = PG_GETARG_FLOAT4(3);
+    const float4 mz_power = PG_GETARG_FLOAT4(4);
+    const float4 intensity_power = PG_GETARG_FLOAT4(5);
+    float4 score = 0.0f;
 
-    if(float4_lt(score, 0.0f))
-        score = 0.0f;
-    else if(float4_gt(score, 1.0f))
-        score = 1.0f;
+    cosine_modified_calc(reference, query, &shift, 1, tolerance, mz_power, intensity_power, &score);
+
+    PG_FREE_IF_COPY(DatumGetPointer(reference), 0);
+    PG_FREE_IF_COPY(DatumGetPointer(query), 1);
 
     PG_RETURN_FLOAT4(score);
 }
+
+PG_FUNCTION_INFO_V1(cosine_modified_shifts);
+Datum cosine_modified_shifts(PG_FUNCTION_ARGS)
+{
+    Datum reference = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(1)));
+    int nshifts = 0;
+    const float4 *shifts = cosine_modified_shifts_arg(fcinfo, 2, &nshifts);
+    const float4 tolerance = PG_GETARG_FLOAT4(3);
+    const float4 mz_power = PG_GETARG_FLOAT4(4);
+    const float4 intensity_power = PG_GETARG_FLOAT4(5);
+    float4 *scores = (float4*) palloc(Max(nshifts, 1) * sizeof(float4));
+    Datum *elems = (Datum*) palloc(Max(nshifts, 1) * sizeof(Datum));
+
+    cosine_modified_calc(reference, query, shifts, nshifts, tolerance, mz_power, intensity_power, scores);
+
+    for(int i = 0; i < nshifts; i++)
+        elems[i] = Float4GetDatum(scores[i]);
+
+    PG_FREE_IF_COPY(DatumGetPointer(reference), 0);
+    PG_FREE_IF_COPY(DatumGetPointer(query), 1);
+
+    PG_RETURN_ARRAYTYPE_P(construct_array(elems, nshifts, FLOAT4OID, sizeof(float4), FLOAT4PASSBYVAL, 'i'));
+}
+
+PG_FUNCTION_INFO_V1(cosine_modified_best);
+Datum cosine_modified_best(PG_FUNCTION_ARGS)
+{
+    Datum reference = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(1)));
+    int nshifts = 0;
+    const float4 *shifts = cosine_modified_shifts_arg(fcinfo, 2, &nshifts);
+    const float4 tolerance = PG_GETARG_FLOAT4(3);
+    const float4 mz_power = PG_GETARG_FLOAT4(4);
+    const float4 intensity_power = PG_GETARG_FLOAT4(5);
+    float4 *scores = (float4*) palloc(Max(nshifts, 1) * sizeof(float4));
+    TupleDesc tupdesc = NULL;
+    Datum values[2] = {0};
+    bool nulls[2] = {false, false};
+    int best = 0;
+
+    if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("function returning record called in context that cannot accept type record")));
+
+    if(nshifts == 0)
+        PG_RETURN_NULL();
+
+    cosine_modified_calc(reference, query, shifts, nshifts, tolerance, mz_power, intensity_power, scores);
+
+    // the first of equally scored shifts wins
+    for(int i = 1; i < nshifts; i++)
+        if(float4_gt(scores[i], scores[best]))
+            best = i;
+
+    values[0] = Float4GetDatum(scores[best]);
+    values[1] = Float4GetDatum(shifts[best]);
+
+    PG_FREE_IF_COPY(DatumGetPointer(reference), 0);
+    PG_FREE_IF_COPY(DatumGetPointer(query), 1);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
@@ -17,9 +17,12 @@
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <catalog/pg_type.h>
+#include <utils/array.h>
 #include <utils/float.h>
 
 #include "cosine.h"
+#include "filter.h"
 #include "spectrum.h"
 
 PG_FUNCTION_INFO_V1(cosine_neutral_losses);
@@ -182,3 +185,46 @@ Datum cosine_neutral_losses(PG_FUNCTION_ARGS)
 
     PG_RETURN_FLOAT4(score);
 }
+
+/*
+ * Neutral loss spectrum with peaks at precursor minus m/z of fragments
+ * lighter than the precursor. Losses of m/z sorted spectrum come out sorted
+ * when the peaks are walked backwards, so the result can be scored by the
+ * plain greedy cosine and stored or indexed as any other spectrum.
+ */
+PG_FUNCTION_INFO_V1(to_neutral_losses);
+Datum to_neutral_losses(PG_FUNCTION_ARGS)
+{
+    Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    const float4 precursor_mz = PG_GETARG_FLOAT4(1);
+    size_t len = spectrum_length(spectrum);
+    float4 *mzs = spectrum_data(spectrum);
+    float4 *peaks = mzs + len;
+    float4 *losses = palloc(Max(len, 1) * sizeof(float4));
+    float4 *intensities = palloc(Max(len, 1) * sizeof(float4));
+    bool sorted = true;
+    size_t count = 0;
+    Datum result = 0;
+
+    for(size_t i = len; i-- > 0;)
+    {
+        if(!(mzs[i] <= precursor_mz))
+            continue;
+
+        losses[count] = precursor_mz - mzs[i];
+        intensities[count] = peaks[i];
+        sorted = sorted && (count == 0 || losses[count - 1] <= losses[count]);
+        count++;
+    }
+
+    if(!sorted)
+        spectrum_sort_peaks(losses, intensities, count);
+
+    result = count ? spectrum_build(losses, intensities, count) : PointerGetDatum(construct_empty_array(FLOAT4OID));
+
+    pfree(losses);
+    pfree(intensities);
+    PG_FREE_IF_COPY(DatumGetPointer(spectrum), 0);
+
+    PG_RETURN_DATUM(result);
+}
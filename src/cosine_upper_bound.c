@@ -0,0 +1,205 @@
+/* 
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Upper bound of cosine similarity scores
+ *
+ * Both greedy and hungarian cosine sum the products w(r) * w(q) of peak
+ * pairs within tolerance, every peak being used at most once, where
+ * w = mz^mz_power * intensity^intensity_power. By Cauchy-Schwarz the sum is
+ * bounded by sqrt(sum w(r)^2 * sum w(q)^2) taken over the peaks which have
+ * at least one partner within tolerance, so the normalized score can not
+ * exceed that value divided by the norms of both spectra. The bound is
+ * computed by a single merge of both peak lists.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <utils/float.h>
+
+#include "cosine.h"
+#include "spectrum.h"
+
+// relative slack covering the float4 rounding of the exact kernels
+#define UPPER_BOUND_SLACK   1e-4
+
+extern Datum cosine_greedy(PG_FUNCTION_ARGS);
+extern Datum cosine_hungarian(PG_FUNCTION_ARGS);
+
+// negative norm is computed from the peaks, otherwise only matched peaks are weighted
+float4 cosine_upper_bound_peaks(const float4 *restrict reference_mzs, const float4 *restrict reference_peaks,
+    const size_t reference_len, const float8 reference_norm, const float4 *restrict query_mzs,
+    const float4 *restrict query_peaks, const size_t query_len, const float8 query_norm,
+    const MzBuckets *query_buckets, const float4 tolerance, const float4 mz_power, const float4 intensity_power)
+{
+    calc_score_func_t calc_score = determine_calc_score(mz_power, intensity_power);
+    bool reference_known = reference_norm >= 0.0;
+    bool query_known = query_norm >= 0.0;
+    float8 reference_total = reference_known ? reference_norm : 0.0;
+    float8 query_total = query_known ? query_norm : 0.0;
+    float8 reference_matched = 0.0;
+    float8 query_matched = 0.0;
+    Index index = 0;
+    float8 bound = 0.0;
+    bool lookup = mz_buckets_usable(query_buckets, query_len, reference_len)
+        && float4_eq(query_buckets->mz_power, mz_power) && float4_eq(query_buckets->intensity_power, intensity_power);
+    Index covered = 0;
+
+    // reference peak has a partner if some query mz is within its bounds
+    for(Index reference_index = 0; reference_index < reference_len; reference_index++)
+    {
+        float4 low_bound = reference_mzs[reference_index] - tolerance;
+        float4 high_bound = reference_mzs[reference_index] + tolerance;
+        bool matched = false;
+        float8 weight = 0.0;
+
+        if(lookup)
+            index = mz_buckets_find(query_buckets, query_mzs, query_len, low_bound, true);
+
+        while(index < query_len && float4_lt(query_mzs[index], low_bound))
+            index++;
+
+        matched = index < query_len && !float4_gt(query_mzs[index], high_bound);
+
+        // query peaks within the window are summed from the prefix weights
+        if(lookup && matched)
+        {
+            Index end = mz_buckets_find(query_buckets, query_mzs, query_len, high_bound, false);
+
+            index = Max(index, covered);
+            if(end > index)
+                query_matched += query_buckets->weights[end] - query_buckets->weights[index];
+
+            covered = Max(covered, end);
+        }
+
+        if(matched || !reference_known)
+            weight = calc_score(reference_peaks[reference_index], reference_peaks[reference_index],
+                reference_mzs[reference_index], reference_mzs[reference_index], intensity_power, mz_power);
+
+        if(!reference_known)
+            reference_total += weight;
+
+        if(matched)
+            reference_matched += weight;
+    }
+
+    if(lookup && !query_known)
+        query_total = query_buckets->weights[query_len];
+
+    // high bounds grow with reference mz, so the first reference peak not
+    // below the query mz has the lowest low bound of all candidates
+    index = 0;
+    for(Index query_index = 0; query_index < query_len && !lookup; query_index++)
+    {
+        bool matched = false;
+        float8 weight = 0.0;
+
+        while(index < reference_len && float4_gt(query_mzs[query_index], reference_mzs[index] + tolerance))
+            index++;
+
+        matched = index < reference_len && !float4_lt(query_mzs[query_index], reference_mzs[index] - tolerance);
+
+        if(matched || !query_known)
+            weight = calc_score(query_peaks[query_index], query_peaks[query_index],
+                query_mzs[query_index], query_mzs[query_index], intensity_power, mz_power);
+
+        if(!query_known)
+            query_total += weight;
+
+        if(matched)
+            query_matched += weight;
+    }
+
+    elog(DEBUG1, "upper bound: matched [%f, %f] of [%f, %f]", reference_matched, query_matched,
+        reference_total, query_total);
+
+    if(reference_matched <= 0.0 || query_matched <= 0.0)
+        return 0.0f;
+
+    bound = sqrt(reference_matched * query_matched) / sqrt(reference_total * query_total);
+    bound *= 1.0 + UPPER_BOUND_SLACK;
+
+    return bound > 1.0 ? 1.0f : (float4) bound;
+}
+
+float4 cosine_upper_bound_calc(Datum reference, Datum query, const float4 tolerance,
+    const float4 mz_power, const float4 intensity_power)
+{
+    size_t reference_len = spectrum_length(reference);
+    size_t query_len = spectrum_length(query);
+    float4 *reference_mzs = spectrum_data(reference);
+    float4 *query_mzs = spectrum_data(query);
+
+    return cosine_upper_bound_peaks(reference_mzs, reference_mzs + reference_len, reference_len, -1.0,
+        query_mzs, query_mzs + query_len, query_len, -1.0, NULL, tolerance, mz_power, intensity_power);
+}
+
+bool cosine_upper_bound_supported(PGFunction kernel)
+{
+    return kernel == cosine_greedy || kernel == cosine_hungarian;
+}
+
+PG_FUNCTION_INFO_V1(cosine_upper_bound);
+Datum cosine_upper_bound(PG_FUNCTION_ARGS)
+{
+    Datum reference = PG_GETARG_DATUM(0);
+    Datum query = PG_GETARG_DATUM(1);
+    float4 tolerance = PG_GETARG_FLOAT4(2);
+    float4 mz_power = PG_GETARG_FLOAT4(3);
+    float4 intensity_power = PG_GETARG_FLOAT4(4);
+    float4 bound = cosine_upper_bound_calc(reference, query, tolerance, mz_power, intensity_power);
+
+    PG_FREE_IF_COPY(PG_DETOAST_DATUM(reference), 0);
+    PG_FREE_IF_COPY(PG_DETOAST_DATUM(query), 1);
+
+    PG_RETURN_FLOAT4(bound);
+}
+
+static Datum cosine_above(FunctionCallInfo fcinfo, PGFunction kernel)
+{
+    Datum reference = PG_GETARG_DATUM(0);
+    Datum query = PG_GETARG_DATUM(1);
+    float4 threshold = PG_GETARG_FLOAT4(2);
+    float4 tolerance = PG_GETARG_FLOAT4(3);
+    float4 mz_power = PG_GETARG_FLOAT4(4);
+    float4 intensity_power = PG_GETARG_FLOAT4(5);
+    float4 score = cosine_upper_bound_calc(reference, query, tolerance, mz_power, intensity_power);
+
+    if(float4_ge(score, threshold))
+    {
+        score = DatumGetFloat4(DirectFunctionCall5(kernel, reference, query,
+            Float4GetDatum(tolerance), Float4GetDatum(mz_power), Float4GetDatum(intensity_power)));
+    }
+    else
+        elog(DEBUG1, "pruned by upper bound: %f < %f", score, threshold);
+
+    PG_RETURN_BOOL(float4_ge(score, threshold));
+}
+
+PG_FUNCTION_INFO_V1(cosine_greedy_above);
+Datum cosine_greedy_above(PG_FUNCTION_ARGS)
+{
+    return cosine_above(fcinfo, cosine_greedy);
+}
+
+PG_FUNCTION_INFO_V1(cosine_hungarian_above);
+Datum cosine_hungarian_above(PG_FUNCTION_ARGS)
+{
+    return cosine_above(fcinfo, cosine_hungarian);
+}
@@ -0,0 +1,301 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * MGF export
+ *
+ * export_mgf() runs the query through a cursor and writes each row as one
+ * MGF record. The first spectrum column becomes the peak list, all other
+ * non-NULL columns are written as KEY=value lines named by the column, one
+ * dimensional arrays as space separated values. Floats are printed as the
+ * shortest text which reads back to the same value. Output is collected in
+ * a buffer flushed to the target whenever it reaches EXPORT_BUFFER_SIZE.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+
+#include <catalog/pg_type.h>
+#include <common/shortest_dec.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "reader.h"
+#include "spectrum.h"
+
+#define EXPORT_BUFFER_SIZE  (1 << 20) //1MB
+#define EXPORT_FETCH_SIZE   1000
+
+typedef struct ExportColumn
+{
+    Oid         type;
+    Oid         elemtype;
+    int16       elemlen;
+    bool        elembyval;
+    char        elemalign;
+    FmgrInfo    output;
+    bool        skip;
+} ExportColumn;
+
+static void export_flush(Writer *writer, StringInfo buffer)
+{
+    writer_write(writer, buffer->data, buffer->len);
+    resetStringInfo(buffer);
+}
+
+static inline void export_float4(StringInfo buffer, float4 value)
+{
+    enlargeStringInfo(buffer, FLOAT_SHORTEST_DECIMAL_LEN);
+    buffer->len += float_to_shortest_decimal_bufn(value, buffer->data + buffer->len);
+    buffer->data[buffer->len] = '\0';
+}
+
+static inline void export_float8(StringInfo buffer, float8 value)
+{
+    enlargeStringInfo(buffer, DOUBLE_SHORTEST_DECIMAL_LEN);
+    buffer->len += double_to_shortest_decimal_bufn(value, buffer->data + buffer->len);
+    buffer->data[buffer->len] = '\0';
+}
+
+// line breaks would start a new MGF line, they are replaced by spaces
+static void export_text(StringInfo buffer, const char *text)
+{
+    for(const char *p = text; *p; p++)
+        appendStringInfoCharMacro(buffer, *p == '\n' || *p == '\r' ? ' ' : *p);
+}
+
+static void export_scalar(StringInfo buffer, Oid type, FmgrInfo *output, Datum value)
+{
+    if(type == FLOAT4OID)
+        export_float4(buffer, DatumGetFloat4(value));
+    else if(type == FLOAT8OID)
+        export_float8(buffer, DatumGetFloat8(value));
+    else
+        export_text(buffer, OutputFunctionCall(output, value));
+}
+
+static void export_value(StringInfo buffer, ExportColumn *column, Datum value)
+{
+    ArrayType *array = NULL;
+    Datum *elems = NULL;
+    bool *nulls = NULL;
+    int count = 0;
+    bool first = true;
+
+    if(!OidIsValid(column->elemtype))
+    {
+        export_scalar(buffer, column->type, &column->output, value);
+        return;
+    }
+
+    array = DatumGetArrayTypeP(value);
+
+    // multidimensional arrays have no MGF notation, they are kept as literals
+    if(ARR_NDIM(array) > 1)
+    {
+        export_text(buffer, OutputFunctionCall(&column->output, value));
+        return;
+    }
+
+    deconstruct_array(array, column->elemtype, column->elemlen, column->elembyval, column->elemalign, &elems, &nulls, &count);
+
+    for(int i = 0; i < count; i++)
+    {
+        if(nulls[i])
+            continue;
+
+        if(!first)
+            appendStringInfoCharMacro(buffer, ' ');
+        export_scalar(buffer, column->elemtype, &column->output, elems[i]);
+        first = false;
+    }
+}
+
+static void export_spectrum(StringInfo buffer, Datum spectrum)
+{
+    size_t len = spectrum_length(spectrum);
+    float4 *mzs = spectrum_data(spectrum);
+    float4 *intensities = mzs + len;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        export_float4(buffer, mzs[i]);
+        appendStringInfoCharMacro(buffer, ' ');
+        export_float4(buffer, intensities[i]);
+        appendStringInfoCharMacro(buffer, '\n');
+    }
+}
+
+static ExportColumn *export_columns(TupleDesc tupdesc, int *spectrum_column)
+{
+    ExportColumn *columns = palloc0(tupdesc->natts * sizeof(ExportColumn));
+
+    *spectrum_column = -1;
+
+    for(int i = 0; i < tupdesc->natts; i++)
+    {
+        ExportColumn *column = &columns[i];
+        Oid output = InvalidOid;
+        bool varlena = false;
+
+        column->type = TupleDescAttr(tupdesc, i)->atttypid;
+        column->skip = TupleDescAttr(tupdesc, i)->attisdropped;
+
+        if(column->skip)
+            continue;
+
+        if(*spectrum_column < 0 && is_spectrum_type(column->type))
+        {
+            *spectrum_column = i;
+            continue;
+        }
+
+        column->elemtype = is_spectrum_type(column->type) ? InvalidOid : get_element_type(column->type);
+
+        if(OidIsValid(column->elemtype))
+        {
+            get_typlenbyvalalign(column->elemtype, &column->elemlen, &column->elembyval, &column->elemalign);
+            getTypeOutputInfo(column->elemtype, &output, &varlena);
+        }
+        else
+            getTypeOutputInfo(column->type, &output, &varlena);
+
+        fmgr_info(output, &column->output);
+    }
+
+    return columns;
+}
+
+static void export_record(StringInfo buffer, HeapTuple tuple, TupleDesc tupdesc, ExportColumn *columns, int spectrum_column)
+{
+    bool isnull = false;
+
+    appendStringInfoString(buffer, "BEGIN IONS\n");
+
+    for(int i = 0; i < tupdesc->natts; i++)
+    {
+        Datum value = 0;
+
+        if(columns[i].skip || i == spectrum_column)
+            continue;
+
+        value = SPI_getbinval(tuple, tupdesc, i + 1, &isnull);
+        if(isnull)
+            continue;
+
+        appendStringInfoString(buffer, NameStr(TupleDescAttr(tupdesc, i)->attname));
+        appendStringInfoCharMacro(buffer, '=');
+        export_value(buffer, &columns[i], value);
+        appendStringInfoCharMacro(buffer, '\n');
+    }
+
+    if(spectrum_column >= 0)
+    {
+        Datum spectrum = SPI_getbinval(tuple, tupdesc, spectrum_column + 1, &isnull);
+
+        if(!isnull)
+            export_spectrum(buffer, PointerGetDatum(PG_DETOAST_DATUM(spectrum)));
+    }
+
+    appendStringInfoString(buffer, "END IONS\n\n");
+}
+
+static int64 export_mgf(const char *query, Writer *writer)
+{
+    StringInfoData buffer;
+    MemoryContext context = NULL;
+    ExportColumn *columns = NULL;
+    int spectrum_column = -1;
+    SPIPlanPtr plan = NULL;
+    Portal portal = NULL;
+    int64 exported = 0;
+
+    initStringInfo(&buffer);
+    enlargeStringInfo(&buffer, EXPORT_BUFFER_SIZE);
+
+    SPI_connect();
+
+    plan = SPI_prepare(query, 0, NULL);
+    if(plan == NULL)
+        elog(ERROR, "export mgf: %s", SPI_result_code_string(SPI_result));
+
+    if(!SPI_is_cursor_plan(plan))
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE)
+            , errmsg("export query must return rows")));
+
+    portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+    context = AllocSetContextCreate(CurrentMemoryContext, "pgms export", ALLOCSET_DEFAULT_SIZES);
+
+    while(true)
+    {
+        MemoryContext oldcontext = NULL;
+
+        CHECK_FOR_INTERRUPTS();
+
+        SPI_cursor_fetch(portal, true, EXPORT_FETCH_SIZE);
+        if(SPI_processed == 0)
+            break;
+
+        if(columns == NULL)
+            columns = export_columns(SPI_tuptable->tupdesc, &spectrum_column);
+
+        for(uint64 i = 0; i < SPI_processed; i++)
+        {
+            oldcontext = MemoryContextSwitchTo(context);
+            export_record(&buffer, SPI_tuptable->vals[i], SPI_tuptable->tupdesc, columns, spectrum_column);
+            MemoryContextSwitchTo(oldcontext);
+            MemoryContextReset(context);
+
+            if(buffer.len >= EXPORT_BUFFER_SIZE)
+                export_flush(writer, &buffer);
+        }
+
+        exported += SPI_processed;
+        SPI_freetuptable(SPI_tuptable);
+    }
+
+    SPI_cursor_close(portal);
+    MemoryContextDelete(context);
+    SPI_finish();
+
+    export_flush(writer, &buffer);
+    writer_close(writer);
+    pfree(buffer.data);
+
+    return exported;
+}
+
+PG_FUNCTION_INFO_V1(export_mgf_lo);
+Datum export_mgf_lo(PG_FUNCTION_ARGS)
+{
+    char *query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+    PG_RETURN_INT64(export_mgf(query, writer_open_lo(PG_GETARG_OID(1))));
+}
+
+PG_FUNCTION_INFO_V1(export_mgf_file);
+Datum export_mgf_file(PG_FUNCTION_ARGS)
+{
+    char *query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+    PG_RETURN_INT64(export_mgf(query, writer_open_file(text_to_cstring(PG_GETARG_TEXT_PP(1)))));
+}
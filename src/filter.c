@@ -0,0 +1,327 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Spectrum preprocessing
+ *
+ * Options are given as jsonb object:
+ *     sort - sort peaks by m/z
+ *     normalize - scale intensities by the highest one, implies sort
+ *     min_intensity - drop peaks below the fraction of the highest intensity
+ *     top_n - keep n most intense peaks, implies sort
+ *     mz_range - [min, max] m/z of kept peaks
+ *     remove_precursor - drop peaks within the tolerance of precursor m/z
+ *     merge_tolerance - merge neighbouring peaks closer than the tolerance, implies sort
+ *     precursor - record key holding precursor m/z (default PEPMASS)
+ * The filters are applied in this order: sort, mz_range, remove_precursor,
+ * merge_tolerance, min_intensity, top_n and normalize.
+ */
+
+#include "filter.h"
+#include "spectrum.h"
+
+#include <math.h>
+#include <catalog/pg_type.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+
+#define FILTER_PRECURSOR_KEY    "PEPMASS"
+
+typedef struct Peak
+{
+    float4      mz;
+    float4      intensity;
+} Peak;
+
+static int peak_mz_cmp(const void *a, const void *b)
+{
+    float4 mza = ((const Peak*) a)->mz;
+    float4 mzb = ((const Peak*) b)->mz;
+
+    return mza < mzb ? -1 : mza > mzb ? 1 : 0;
+}
+
+static int peak_intensity_cmp(const void *a, const void *b)
+{
+    const Peak *pa = (const Peak*) a;
+    const Peak *pb = (const Peak*) b;
+
+    // the most intense first, lower m/z wins ties
+    if(pa->intensity != pb->intensity)
+        return pa->intensity > pb->intensity ? -1 : 1;
+
+    return peak_mz_cmp(a, b);
+}
+
+void spectrum_sort_peaks(float4 *mzs, float4 *intensities, size_t len)
+{
+    Peak *peaks = palloc(Max(len, 1) * sizeof(Peak));
+
+    for(size_t i = 0; i < len; i++)
+    {
+        peaks[i].mz = mzs[i];
+        peaks[i].intensity = intensities[i];
+    }
+
+    qsort(peaks, len, sizeof(Peak), peak_mz_cmp);
+
+    for(size_t i = 0; i < len; i++)
+    {
+        mzs[i] = peaks[i].mz;
+        intensities[i] = peaks[i].intensity;
+    }
+
+    pfree(peaks);
+}
+
+static float4 filter_number(JsonbValue *v, const char *key)
+{
+    if(v->type != jbvNumeric)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("filter option \"%s\" must be a number", key)));
+
+    return DatumGetFloat4(DirectFunctionCall1(numeric_float4, NumericGetDatum(v->val.numeric)));
+}
+
+static bool filter_bool(JsonbValue *v, const char *key)
+{
+    if(v->type != jbvBool)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("filter option \"%s\" must be a boolean", key)));
+
+    return v->val.boolean;
+}
+
+static void filter_range(SpectrumFilter *filter, JsonbValue *v)
+{
+    JsonbIterator *it = NULL;
+    JsonbIteratorToken token;
+    JsonbValue elem;
+    int count = 0;
+
+    if(v->type == jbvBinary)
+    {
+        it = JsonbIteratorInit(v->val.binary.data);
+        while((token = JsonbIteratorNext(&it, &elem, true)) != WJB_DONE)
+        {
+            if(token != WJB_ELEM)
+                continue;
+
+            if(count == 0)
+                filter->min_mz = filter_number(&elem, "mz_range");
+            else if(count == 1)
+                filter->max_mz = filter_number(&elem, "mz_range");
+
+            count++;
+        }
+    }
+
+    if(count != 2 || float4_gt(filter->min_mz, filter->max_mz))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("filter option \"mz_range\" must be an array of minimal and maximal m/z")));
+}
+
+SpectrumFilter *spectrum_filter_parse(JsonbContainer *options)
+{
+    SpectrumFilter *filter = palloc0(sizeof(SpectrumFilter));
+    JsonbIterator *it = NULL;
+    JsonbIteratorToken token;
+    JsonbValue v;
+
+    if(!JsonContainerIsObject(options))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("filter options must be a JSON object")));
+
+    filter->min_mz = -get_float4_infinity();
+    filter->max_mz = get_float4_infinity();
+    filter->precursor_tolerance = -1.0f;
+    filter->merge_tolerance = -1.0f;
+    filter->precursor = FILTER_PRECURSOR_KEY;
+
+    it = JsonbIteratorInit(options);
+    while((token = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+    {
+        char *key = NULL;
+
+        if(token != WJB_KEY)
+            continue;
+
+        key = pnstrdup(v.val.string.val, v.val.string.len);
+        token = JsonbIteratorNext(&it, &v, true);
+
+        if(!strcmp(key, "sort"))
+            filter->sort = filter_bool(&v, key);
+        else if(!strcmp(key, "normalize"))
+            filter->normalize = filter_bool(&v, key);
+        else if(!strcmp(key, "min_intensity"))
+            filter->min_intensity = filter_number(&v, key);
+        else if(!strcmp(key, "top_n"))
+            filter->top_n = (int32) filter_number(&v, key);
+        else if(!strcmp(key, "mz_range"))
+            filter_range(filter, &v);
+        else if(!strcmp(key, "remove_precursor"))
+            filter->precursor_tolerance = filter_number(&v, key);
+        else if(!strcmp(key, "merge_tolerance"))
+            filter->merge_tolerance = filter_number(&v, key);
+        else if(!strcmp(key, "precursor") && v.type == jbvString)
+            filter->precursor = pnstrdup(v.val.string.val, v.val.string.len);
+        else
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+                , errmsg("invalid filter option \"%s\"", key)));
+    }
+
+    if(filter->top_n < 0 || filter->min_intensity < 0.0f)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("filter options \"top_n\" and \"min_intensity\" must not be negative")));
+
+    return filter;
+}
+
+/*
+ * Filters peaks in place and returns their new count. Precursor is NaN when
+ * the record does not have one, its peak is kept then.
+ */
+size_t spectrum_filter_apply(const SpectrumFilter *filter, float4 *mzs, float4 *intensities, size_t len, float4 precursor)
+{
+    bool remove_precursor = filter->precursor_tolerance >= 0.0f && !isnan(precursor);
+    bool merge = filter->merge_tolerance >= 0.0f;
+    float4 merge_mz = 0.0f;
+    bool sorted = true;
+    float4 max = 0.0f;
+    size_t count = 0;
+
+    for(size_t i = 1; i < len && sorted; i++)
+        sorted = mzs[i - 1] <= mzs[i];
+
+    if(!sorted && (filter->sort || filter->normalize || filter->top_n > 0 || merge))
+        spectrum_sort_peaks(mzs, intensities, len);
+
+    for(size_t i = 0; i < len; i++)
+    {
+        if(mzs[i] < filter->min_mz || mzs[i] > filter->max_mz)
+            continue;
+
+        if(remove_precursor && fabsf(mzs[i] - precursor) <= filter->precursor_tolerance)
+            continue;
+
+        // peak within the tolerance of the previous one joins it, m/z is weighted by intensities
+        if(merge && count > 0 && mzs[i] - merge_mz <= filter->merge_tolerance)
+        {
+            float4 sum = intensities[count - 1] + intensities[i];
+
+            if(sum > 0.0f)
+                mzs[count - 1] = (mzs[count - 1] * intensities[count - 1] + mzs[i] * intensities[i]) / sum;
+
+            merge_mz = mzs[i];
+            intensities[count - 1] = sum;
+            max = Max(max, sum);
+            continue;
+        }
+
+        merge_mz = mzs[i];
+        mzs[count] = mzs[i];
+        intensities[count] = intensities[i];
+        max = Max(max, intensities[count]);
+        count++;
+    }
+
+    if(filter->min_intensity > 0.0f)
+    {
+        float4 cutoff = filter->min_intensity * max;
+
+        len = count;
+        count = 0;
+
+        for(size_t i = 0; i < len; i++)
+        {
+            if(intensities[i] < cutoff)
+                continue;
+
+            mzs[count] = mzs[i];
+            intensities[count] = intensities[i];
+            count++;
+        }
+    }
+
+    if(filter->top_n > 0 && count > (size_t) filter->top_n)
+    {
+        Peak *peaks = palloc(count * sizeof(Peak));
+
+        for(size_t i = 0; i < count; i++)
+        {
+            peaks[i].mz = mzs[i];
+            peaks[i].intensity = intensities[i];
+        }
+
+        qsort(peaks, count, sizeof(Peak), peak_intensity_cmp);
+        count = filter->top_n;
+        qsort(peaks, count, sizeof(Peak), peak_mz_cmp);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            mzs[i] = peaks[i].mz;
+            intensities[i] = peaks[i].intensity;
+        }
+
+        pfree(peaks);
+    }
+
+    if(filter->normalize && max > 0.0f)
+    {
+        for(size_t i = 0; i < count; i++)
+            intensities[i] /= max;
+    }
+
+    return count;
+}
+
+/*
+ * SQL interface of the preprocessing, the spectrum is filtered in one pass
+ * over a copy of its buffers. Precursor is needed by remove_precursor only.
+ */
+PG_FUNCTION_INFO_V1(spectrum_filter);
+Datum spectrum_filter(PG_FUNCTION_ARGS)
+{
+    Datum spectrum = 0;
+    SpectrumFilter *filter = NULL;
+    float4 precursor = get_float4_nan();
+    size_t len = 0;
+    float4 *mzs = NULL;
+    float4 *intensities = NULL;
+    size_t count = 0;
+
+    if(PG_ARGISNULL(0) || PG_ARGISNULL(1))
+        PG_RETURN_NULL();
+
+    spectrum = PointerGetDatum(PG_DETOAST_DATUM_COPY(PG_GETARG_DATUM(0)));
+    filter = spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root);
+
+    if(PG_NARGS() > 2 && !PG_ARGISNULL(2))
+        precursor = PG_GETARG_FLOAT4(2);
+
+    len = spectrum_length(spectrum);
+    mzs = spectrum_data(spectrum);
+    intensities = mzs + len;
+
+    count = spectrum_filter_apply(filter, mzs, intensities, len, precursor);
+
+    if(count == 0)
+        PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    PG_RETURN_DATUM(spectrum_build(mzs, intensities, count));
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <postgres.h>
+#include <utils/jsonb.h>
+
+/*
+ * Peak preprocessing applied to float buffers of a spectrum, e.g. while the
+ * record is parsed, so the spectrum is stored in its final form at once.
+ */
+typedef struct SpectrumFilter
+{
+    bool        sort;
+    bool        normalize;
+    float4      min_intensity;
+    int32       top_n;
+    float4      min_mz;
+    float4      max_mz;
+    float4      precursor_tolerance;
+    float4      merge_tolerance;
+    char        *precursor;
+} SpectrumFilter;
+
+SpectrumFilter *spectrum_filter_parse(JsonbContainer *options);
+size_t spectrum_filter_apply(const SpectrumFilter *filter, float4 *mzs, float4 *intensities, size_t len, float4 precursor);
+
+// sorts peaks kept in separate m/z and intensity buffers by m/z
+void spectrum_sort_peaks(float4 *mzs, float4 *intensities, size_t len);
+
+#endif /* FILTER_H_ */
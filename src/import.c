@@ -0,0 +1,894 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bulk import
+ *
+ * import_mgf() parses MGF records straight into slots of the target table
+ * and writes them by table_multi_insert() with bulk insert state, the way
+ * COPY FROM does. Indexes, constraints, column defaults and statement
+ * triggers are maintained, tables with row triggers are refused. Tables
+ * created or truncated in the current transaction skip the free space map
+ * and may be loaded frozen.
+ *
+ * import_mgf_checkpoint() commits every checkpoint records and keeps offset
+ * of the next record in mgf_import_checkpoint, so interrupted import resumes
+ * there. Records which fail to parse or to pass constraints are rolled back
+ * by subtransaction and logged to mgf_import_error instead of aborting.
+ */
+
+#include "filter.h"
+#include "mgf.h"
+#include "pgms.h"
+#include "progress.h"
+#include "reader.h"
+#include "spectrum.h"
+
+#include <access/heapam.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <access/xlog.h>
+#include <catalog/pg_type.h>
+#include <commands/trigger.h>
+#include <executor/executor.h>
+#include <executor/spi.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <optimizer/optimizer.h>
+#include <parser/parsetree.h>
+#include <port/atomics.h>
+#include <postmaster/bgworker.h>
+#include <rewrite/rewriteHandler.h>
+#include <storage/dsm.h>
+#include <tcop/tcopprot.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/jsonb.h>
+#include <utils/portal.h>
+#include <utils/resowner.h>
+#include <utils/snapmgr.h>
+
+#define IMPORT_BATCH_SIZE       1000
+#define IMPORT_CHECKPOINT_SIZE  100000
+#define IMPORT_CHUNKS_PER_WORKER    4
+#define IMPORT_MESSAGE_SIZE     256
+
+#if PG_VERSION_NUM >= 140000
+#define InsertIndexTuples(rri, slot, estate)    ExecInsertIndexTuples((rri), (slot), (estate), false, false, NULL, NIL)
+#else
+#define InsertIndexTuples(rri, slot, estate)    ExecInsertIndexTuples((slot), (estate), false, NULL, NIL)
+#endif
+
+typedef struct ImportState
+{
+    Relation            rel;
+    EState              *estate;
+    ResultRelInfo       *rri;
+    BulkInsertState     bistate;
+    CommandId           cid;
+    int                 options;
+    ExprState           **defaults;
+    TupleTableSlot      **slots;
+    int                 batch_size;
+    int                 checkpoint;
+    int                 count;
+    uint64              imported;
+    bool                progress;
+} ImportState;
+
+typedef struct ImportCheckpoint
+{
+    Oid                 loid;
+    Oid                 relid;
+    char                *schema;
+    int64               offset;
+    int64               imported;
+    int64               failed;
+} ImportCheckpoint;
+
+/*
+ * Parallel import splits the large object to chunks starting at BEGIN IONS
+ * lines. Dynamic background workers take chunks one by one and insert them
+ * in their own transactions, so the import is not atomic.
+ */
+typedef struct ImportChunk
+{
+    int64               begin;
+    int64               end;
+} ImportChunk;
+
+typedef struct ImportWorkerResult
+{
+    bool                done;
+    bool                failed;
+    int                 sqlerrcode;
+    int64               offset;
+    uint64              imported;
+    char                message[IMPORT_MESSAGE_SIZE];
+} ImportWorkerResult;
+
+typedef struct ImportShared
+{
+    Oid                 database;
+    Oid                 user;
+    Oid                 loid;
+    Oid                 relid;
+    pg_atomic_uint32    next_chunk;
+    pg_atomic_uint32    next_worker;
+    pg_atomic_uint32    failed;
+    int                 nchunks;
+    int                 nworkers;
+    Size                results_offset;
+    Size                options_offset;
+    ImportChunk         chunks[FLEXIBLE_ARRAY_MEMBER];
+} ImportShared;
+
+#define ImportResults(shared)   ((ImportWorkerResult*) ((char*) (shared) + (shared)->results_offset))
+#define ImportOptions(shared)   ((Jsonb*) ((char*) (shared) + (shared)->options_offset))
+
+PGDLLEXPORT void import_mgf_worker(Datum arg);
+
+static dummyret import_options(ImportState *state, struct Parser *parser, Jsonb *options)
+{
+    JsonbIterator *it = NULL;
+    JsonbIteratorToken token;
+    JsonbValue v;
+    bool freeze = false;
+
+    if(!JB_ROOT_IS_OBJECT(options))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("import options must be a JSON object")));
+
+    it = JsonbIteratorInit(&options->root);
+    while((token = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+    {
+        char *key = NULL;
+
+        if(token != WJB_KEY)
+            continue;
+
+        key = pnstrdup(v.val.string.val, v.val.string.len);
+        token = JsonbIteratorNext(&it, &v, true);
+
+        if(!strcmp(key, "batch_size") && v.type == jbvNumeric)
+            state->batch_size = DatumGetInt32(DirectFunctionCall1(numeric_int4, NumericGetDatum(v.val.numeric)));
+        else if(!strcmp(key, "checkpoint") && v.type == jbvNumeric)
+            state->checkpoint = DatumGetInt32(DirectFunctionCall1(numeric_int4, NumericGetDatum(v.val.numeric)));
+        else if(!strcmp(key, "filter") && v.type == jbvBinary)
+            parser_set_filter(parser, spectrum_filter_parse(v.val.binary.data));
+        else if(!strcmp(key, "freeze") && v.type == jbvBool)
+            freeze = v.val.boolean;
+        else if(!strcmp(key, "columns") && v.type == jbvBinary)
+        { // MGF key to column name mapping
+            JsonbIterator *cit = JsonbIteratorInit(v.val.binary.data);
+            JsonbValue k;
+
+            while((token = JsonbIteratorNext(&cit, &k, true)) != WJB_DONE)
+            {
+                char *name = NULL;
+                AttrNumber attnum = InvalidAttrNumber;
+
+                if(token != WJB_KEY)
+                    continue;
+
+                token = JsonbIteratorNext(&cit, &v, true);
+                if(v.type != jbvString)
+                    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+                        , errmsg("column mapping of \"%s\" must be a column name", pnstrdup(k.val.string.val, k.val.string.len))));
+
+                name = pnstrdup(v.val.string.val, v.val.string.len);
+                attnum = get_attnum(RelationGetRelid(state->rel), name);
+
+                if(attnum <= 0)
+                    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN)
+                        , errmsg("column \"%s\" of relation \"%s\" does not exist", name, RelationGetRelationName(state->rel))));
+
+                parser_map_column(parser, pnstrdup(k.val.string.val, k.val.string.len), attnum - 1);
+            }
+        }
+        else
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+                , errmsg("invalid import option \"%s\"", key)));
+    }
+
+    if(state->batch_size <= 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("batch_size must be positive")));
+
+    if(state->checkpoint <= 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("checkpoint must be positive")));
+
+    if(freeze)
+    { // the same conditions as COPY FREEZE
+        if(!ThereAreNoPriorRegisteredSnapshots() || !ThereAreNoReadyPortals())
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TRANSACTION_STATE)
+                , errmsg("cannot perform import freeze because of prior transaction activity")));
+
+        if(state->rel->rd_createSubid != GetCurrentSubTransactionId()
+            && state->rel->rd_newRelfilenodeSubid != GetCurrentSubTransactionId())
+            ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE)
+                , errmsg("cannot perform import freeze because the table was not created or truncated in the current subtransaction")));
+
+        state->options |= TABLE_INSERT_FROZEN;
+    }
+}
+
+static dummyret import_open(ImportState *state, Oid relid)
+{
+    AclResult aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_INSERT);
+    RangeTblEntry *rte = makeNode(RangeTblEntry);
+    TupleDesc tupdesc = NULL;
+    TriggerDesc *trigdesc = NULL;
+
+    if(aclresult != ACLCHECK_OK)
+        aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(relid));
+
+    state->rel = table_open(relid, RowExclusiveLock);
+    tupdesc = RelationGetDescr(state->rel);
+    trigdesc = state->rel->trigdesc;
+
+    if(state->rel->rd_rel->relkind != RELKIND_RELATION)
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE)
+            , errmsg("\"%s\" is not a table", RelationGetRelationName(state->rel))));
+
+    if(trigdesc && (trigdesc->trig_insert_before_row || trigdesc->trig_insert_after_row
+        || trigdesc->trig_insert_instead_row || trigdesc->trig_insert_new_table))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("import into table \"%s\" with row triggers is not supported", RelationGetRelationName(state->rel))));
+
+    if(tupdesc->constr && tupdesc->constr->has_generated_stored)
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("import into table \"%s\" with generated columns is not supported", RelationGetRelationName(state->rel))));
+
+    rte->rtekind = RTE_RELATION;
+    rte->relid = relid;
+    rte->relkind = state->rel->rd_rel->relkind;
+    rte->rellockmode = RowExclusiveLock;
+    rte->requiredPerms = ACL_INSERT;
+
+    state->estate = CreateExecutorState();
+    state->estate->es_output_cid = state->cid = GetCurrentCommandId(true);
+    ExecInitRangeTable(state->estate, list_make1(rte));
+
+    state->rri = makeNode(ResultRelInfo);
+    InitResultRelInfo(state->rri, state->rel, 1, NULL, 0);
+    CheckValidResultRel(state->rri, CMD_INSERT);
+    ExecOpenIndices(state->rri, false);
+#if PG_VERSION_NUM < 140000
+    state->estate->es_result_relations = state->rri;
+    state->estate->es_num_result_relations = 1;
+    state->estate->es_result_relation_info = state->rri;
+#endif
+
+    state->defaults = palloc0(ColumnCount(tupdesc) * sizeof(ExprState*));
+    for(Index idx = 0; idx < ColumnCount(tupdesc); idx++)
+    {
+        Node *expr = NULL;
+
+        if(ColumnIsDropped(tupdesc, idx))
+            continue;
+
+        expr = build_column_default(state->rel, idx + 1);
+        if(expr)
+            state->defaults[idx] = ExecInitExpr(expression_planner((Expr*) expr), NULL);
+    }
+
+    if(state->rel->rd_createSubid != InvalidSubTransactionId
+        || state->rel->rd_newRelfilenodeSubid != InvalidSubTransactionId)
+    { // nobody else can see the table yet
+        state->options |= TABLE_INSERT_SKIP_FSM;
+#ifdef TABLE_INSERT_SKIP_WAL
+        if(!XLogIsNeeded())
+            state->options |= TABLE_INSERT_SKIP_WAL;
+#endif
+    }
+
+    state->bistate = GetBulkInsertState();
+    state->batch_size = IMPORT_BATCH_SIZE;
+    state->checkpoint = IMPORT_CHECKPOINT_SIZE;
+    state->count = 0;
+    state->imported = 0;
+}
+
+static dummyret import_flush(ImportState *state)
+{
+    if(state->count == 0)
+        return;
+
+    table_multi_insert(state->rel, state->slots, state->count, state->cid, state->options, state->bistate);
+
+    if(state->rri->ri_NumIndices > 0)
+    {
+        for(int i = 0; i < state->count; i++)
+        {
+            List *recheck = InsertIndexTuples(state->rri, state->slots[i], state->estate);
+
+            list_free(recheck);
+        }
+    }
+
+    elog(DEBUG1, "import: flushed %d records", state->count);
+    state->imported += state->count;
+    state->count = 0;
+    progress_update(PROGRESS_PGMS_ROWS_INSERTED, state->imported);
+    ResetPerTupleExprContext(state->estate);
+}
+
+static dummyret import_record(ImportState *state, struct Parser *parser)
+{
+    TupleDesc tupdesc = RelationGetDescr(state->rel);
+    ExprContext *econtext = GetPerTupleExprContext(state->estate);
+    TupleTableSlot *slot = state->slots[state->count];
+
+    if(!slot)
+        slot = state->slots[state->count] = table_slot_create(state->rel, NULL);
+
+    ExecClearTuple(slot);
+    parser_get_values(parser, slot->tts_values, slot->tts_isnull);
+
+    for(Index idx = 0; idx < ColumnCount(tupdesc); idx++)
+    {
+        if(slot->tts_isnull[idx] && state->defaults[idx])
+            slot->tts_values[idx] = ExecEvalExpr(state->defaults[idx], econtext, &slot->tts_isnull[idx]);
+    }
+
+    ExecStoreVirtualTuple(slot);
+    // record values are released by the next parser_next()
+    ExecMaterializeSlot(slot);
+
+    if(tupdesc->constr)
+        ExecConstraints(state->rri, slot, state->estate);
+
+    state->count++;
+}
+
+static dummyret import_close(ImportState *state)
+{
+    for(int i = 0; i < state->batch_size; i++)
+        if(state->slots[i])
+            ExecDropSingleTupleTableSlot(state->slots[i]);
+
+    FreeBulkInsertState(state->bistate);
+    table_finish_bulk_insert(state->rel, state->options);
+    ExecCloseIndices(state->rri);
+    FreeExecutorState(state->estate);
+    table_close(state->rel, NoLock);
+
+    if(state->progress)
+        progress_end();
+}
+
+static void import_error_callback(void *arg)
+{
+    struct Parser *parser = (struct Parser*) arg;
+
+    errcontext("MGF record at offset " INT64_FORMAT, parser_record_offset(parser));
+}
+
+/*
+ * Parser recognizes the spectrum column by spectrumOid. Unlike TypenameGetTypid
+ * in the loaders, the type is taken from the columns of the target table, so
+ * it does not depend on search_path.
+ */
+static void import_lookup_spectrum_type(TupleDesc tupdesc)
+{
+    if(OidIsValid(spectrumOid))
+        return;
+
+    for(Index idx = 0; idx < ColumnCount(tupdesc); idx++)
+    {
+        if(!ColumnIsDropped(tupdesc, idx) && is_spectrum_type(ColumnType(tupdesc, idx)))
+        {
+            spectrumOid = ColumnType(tupdesc, idx);
+            return;
+        }
+    }
+}
+
+static struct Parser* import_begin(ImportState *state, Reader *reader, Oid relid, Jsonb *options)
+{
+    TupleDesc tupdesc = NULL;
+    struct Parser *parser = NULL;
+
+    MemSet(state, 0, sizeof(ImportState));
+    import_open(state, relid);
+    tupdesc = RelationGetDescr(state->rel);
+    state->progress = progress_start(PROGRESS_PGMS_COMMAND_IMPORT, relid);
+
+    import_lookup_spectrum_type(tupdesc);
+
+    parser = parser_init_reader(reader, TupleDescGetAttInMetadata(tupdesc));
+    import_options(state, parser, options);
+    state->slots = palloc0(state->batch_size * sizeof(TupleTableSlot*));
+
+    AfterTriggerBeginQuery();
+    ExecBSInsertTriggers(state->estate, state->rri);
+
+    parser_globals(parser);
+    return parser;
+}
+
+static dummyret import_run(ImportState *state, struct Parser *parser)
+{
+    while(parser_next(parser))
+    {
+        CHECK_FOR_INTERRUPTS();
+        import_record(state, parser);
+
+        if(state->count == state->batch_size)
+            import_flush(state);
+    }
+}
+
+static dummyret import_end(ImportState *state, struct Parser *parser)
+{
+    import_flush(state);
+
+    ExecASInsertTriggers(state->estate, state->rri, NULL);
+    AfterTriggerEndQuery(state->estate);
+
+    parser_close(parser);
+    import_close(state);
+}
+
+PG_FUNCTION_INFO_V1(import_mgf);
+Datum import_mgf(PG_FUNCTION_ARGS)
+{
+    ImportState state;
+    struct Parser *parser = import_begin(&state, reader_open_lo(PG_GETARG_OID(0)), PG_GETARG_OID(1), PG_GETARG_JSONB_P(2));
+    ErrorContextCallback callback;
+
+    callback.callback = import_error_callback;
+    callback.arg = (void*) parser;
+    callback.previous = error_context_stack;
+    error_context_stack = &callback;
+
+    import_run(&state, parser);
+
+    error_context_stack = callback.previous;
+    import_end(&state, parser);
+
+    PG_RETURN_INT64((int64) state.imported);
+}
+
+static bool import_checkpoint_load(ImportCheckpoint *checkpoint)
+{
+    Oid argtypes[] = {OIDOID, REGCLASSOID};
+    Datum values[] = {ObjectIdGetDatum(checkpoint->loid), ObjectIdGetDatum(checkpoint->relid)};
+    bool isnull = false;
+    bool finished = false;
+
+    if(SPI_execute_with_args(psprintf("SELECT \"offset\", imported, failed, finished FROM %s.mgf_import_checkpoint "
+            "WHERE loid = $1 AND target = $2", quote_identifier(checkpoint->schema)), 2, argtypes, values, NULL, true, 1) != SPI_OK_SELECT)
+        elog(ERROR, "import: could not read checkpoint");
+
+    if(SPI_processed == 0)
+        return true;
+
+    checkpoint->offset = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+    checkpoint->imported = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+    checkpoint->failed = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+    finished = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4, &isnull));
+
+    if(finished)
+        ereport(NOTICE, (errmsg("import of large object %u into \"%s\" is already finished", checkpoint->loid, get_rel_name(checkpoint->relid))
+            , errhint("Delete its row from mgf_import_checkpoint to import it again.")));
+    else
+        elog(DEBUG1, "import: resuming at offset " INT64_FORMAT, checkpoint->offset);
+
+    return !finished;
+}
+
+static dummyret import_checkpoint_save(ImportCheckpoint *checkpoint, bool finished)
+{
+    Oid argtypes[] = {OIDOID, REGCLASSOID, INT8OID, INT8OID, INT8OID, BOOLOID};
+    Datum values[] = {ObjectIdGetDatum(checkpoint->loid), ObjectIdGetDatum(checkpoint->relid), Int64GetDatum(checkpoint->offset)
+        , Int64GetDatum(checkpoint->imported), Int64GetDatum(checkpoint->failed), BoolGetDatum(finished)};
+
+    if(SPI_execute_with_args(psprintf("INSERT INTO %s.mgf_import_checkpoint AS c (loid, target, \"offset\", imported, failed, finished) "
+            "VALUES ($1, $2, $3, $4, $5, $6) ON CONFLICT (loid, target) DO UPDATE SET \"offset\" = $3, imported = $4, failed = $5, "
+            "finished = $6, updated = now()", quote_identifier(checkpoint->schema)), 6, argtypes, values, NULL, false, 0) != SPI_OK_INSERT)
+        elog(ERROR, "import: could not save checkpoint");
+}
+
+static dummyret import_checkpoint_error(ImportCheckpoint *checkpoint, int64 offset, ErrorData *edata)
+{
+    Oid argtypes[] = {OIDOID, REGCLASSOID, INT8OID, TEXTOID, TEXTOID};
+    Datum values[] = {ObjectIdGetDatum(checkpoint->loid), ObjectIdGetDatum(checkpoint->relid), Int64GetDatum(offset)
+        , CStringGetTextDatum(unpack_sql_state(edata->sqlerrcode)), CStringGetTextDatum(edata->message ? edata->message : "")};
+
+    elog(DEBUG1, "import: skipping record at offset " INT64_FORMAT ": %s", offset, edata->message);
+
+    if(SPI_execute_with_args(psprintf("INSERT INTO %s.mgf_import_error (loid, target, \"offset\", sqlstate, reason) "
+            "VALUES ($1, $2, $3, $4, $5)", quote_identifier(checkpoint->schema)), 5, argtypes, values, NULL, false, 0) != SPI_OK_INSERT)
+        elog(ERROR, "import: could not log failed record");
+
+    checkpoint->failed++;
+}
+
+/*
+ * Imports up to checkpoint records, each in own subtransaction. Failed record
+ * is logged and parsing continues at the next BEGIN IONS line. Returns true
+ * when there are no more records, otherwise offset of the next one is set.
+ */
+static bool import_checkpoint_batch(ImportState *state, struct Parser *parser, Reader *reader, ImportCheckpoint *checkpoint)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ResourceOwner oldowner = CurrentResourceOwner;
+    // start of the next record when known, otherwise the last parsed record precedes it
+    volatile int64 next = checkpoint->offset;
+    volatile bool found = true;
+
+    for(int processed = 0; found && processed < state->checkpoint; processed++)
+    {
+        CHECK_FOR_INTERRUPTS();
+
+        BeginInternalSubTransaction(NULL);
+        MemoryContextSwitchTo(oldcontext);
+
+        PG_TRY();
+        {
+            if((found = parser_next(parser)))
+            {
+                import_record(state, parser);
+                next = -1;
+            }
+
+            ReleaseCurrentSubTransaction();
+            MemoryContextSwitchTo(oldcontext);
+            CurrentResourceOwner = oldowner;
+        }
+        PG_CATCH();
+        {
+            int64 offset = Max(next, parser_record_offset(parser));
+            ErrorData *edata = NULL;
+
+            MemoryContextSwitchTo(oldcontext);
+            edata = CopyErrorData();
+            FlushErrorState();
+
+            RollbackAndReleaseCurrentSubTransaction();
+            MemoryContextSwitchTo(oldcontext);
+            CurrentResourceOwner = oldowner;
+
+            import_checkpoint_error(checkpoint, offset, edata);
+            FreeErrorData(edata);
+
+            // skip the rest of the failed record
+            next = parser_find_record(reader, offset + 1);
+            if((found = next >= 0))
+                parser_seek(parser, next, -1);
+        }
+        PG_END_TRY();
+
+        if(state->count == state->batch_size)
+            import_flush(state);
+    }
+
+    if(found && next < 0)
+        next = parser_find_record(reader, parser_record_offset(parser) + 1);
+
+    if(next >= 0)
+        checkpoint->offset = next;
+
+    return next < 0;
+}
+
+PG_FUNCTION_INFO_V1(import_mgf_checkpoint);
+Datum import_mgf_checkpoint(PG_FUNCTION_ARGS)
+{
+    // CALL outside of transaction block may commit
+    bool atomic = !(fcinfo->context && IsA(fcinfo->context, CallContext) && !((CallContext*) fcinfo->context)->atomic);
+    Jsonb *options = PG_GETARG_JSONB_P_COPY(2);
+    MemoryContext context = AllocSetContextCreate(CurrentMemoryContext, "import checkpoint", ALLOCSET_DEFAULT_SIZES);
+    ImportCheckpoint checkpoint;
+    bool finished = false;
+
+    MemSet(&checkpoint, 0, sizeof(ImportCheckpoint));
+    checkpoint.loid = PG_GETARG_OID(0);
+    checkpoint.relid = PG_GETARG_OID(1);
+    checkpoint.schema = get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid));
+    checkpoint.offset = -1;
+
+    SPI_connect_ext(atomic ? 0 : SPI_OPT_NONATOMIC);
+
+    if(!import_checkpoint_load(&checkpoint))
+        finished = true;
+
+    while(!finished)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(context);
+        ImportState state;
+        struct Parser *parser = NULL;
+        Reader *reader = NULL;
+        ErrorContextCallback callback;
+
+        PushActiveSnapshot(GetTransactionSnapshot());
+        reader = reader_open_lo(checkpoint.loid);
+        if(reader->seek == NULL)
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+                , errmsg("compressed MGF input can not be imported with checkpoints")
+                , errhint("Use import_mgf to import compressed input.")));
+
+        parser = import_begin(&state, reader, checkpoint.relid, options);
+
+        // the first batch continues after global parameters
+        if(checkpoint.offset >= 0)
+            parser_seek(parser, checkpoint.offset, -1);
+
+        callback.callback = import_error_callback;
+        callback.arg = (void*) parser;
+        callback.previous = error_context_stack;
+        error_context_stack = &callback;
+
+        finished = import_checkpoint_batch(&state, parser, reader, &checkpoint);
+
+        error_context_stack = callback.previous;
+        import_end(&state, parser);
+        PopActiveSnapshot();
+
+        checkpoint.imported += state.imported;
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(context);
+
+        import_checkpoint_save(&checkpoint, finished);
+        elog(DEBUG1, "import: checkpoint at offset " INT64_FORMAT ", " INT64_FORMAT " records imported", checkpoint.offset, checkpoint.imported);
+
+        if(!atomic)
+        {
+            SPI_commit();
+#if PG_VERSION_NUM < 150000
+            SPI_start_transaction();
+#endif
+        }
+    }
+
+    SPI_finish();
+    PG_RETURN_VOID();
+}
+
+static int import_split(Oid loid, int nchunks, ImportChunk *chunks)
+{
+    Reader *reader = reader_open_lo(loid);
+    int64 size = 0;
+    int64 first = 0;
+    int64 begin = 0;
+    int count = 0;
+
+    if(reader->seek == NULL)
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("compressed MGF input can not be imported in parallel")
+            , errhint("Use import_mgf to import compressed input sequentially.")));
+
+    size = reader_size(reader);
+    first = parser_find_record(reader, 0);
+    begin = first;
+
+    for(int k = 1; first >= 0 && k <= nchunks; k++)
+    {
+        int64 nominal = first + (size - first) * k / nchunks;
+        int64 end = k == nchunks ? size : parser_find_record(reader, Max(nominal, begin + 1));
+
+        if(end < 0)
+            end = size;
+
+        if(end > begin)
+        {
+            chunks[count].begin = begin;
+            chunks[count].end = end;
+            elog(DEBUG1, "import: chunk %d " INT64_FORMAT " - " INT64_FORMAT, count, begin, end);
+            count++;
+        }
+
+        if(end == size)
+            break;
+
+        begin = end;
+    }
+
+    reader_close(reader);
+    return count;
+}
+
+PGDLLEXPORT void import_mgf_worker(Datum arg)
+{
+    dsm_segment *segment = NULL;
+    ImportShared *shared = NULL;
+    ImportWorkerResult *result = NULL;
+    MemoryContext oldcontext = NULL;
+    struct Parser *volatile parser = NULL;
+    ImportState state;
+    uint32 chunk = 0;
+
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    segment = dsm_attach(DatumGetUInt32(arg));
+    if(segment == NULL)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE)
+            , errmsg("could not map dynamic shared memory segment")));
+
+    shared = (ImportShared*) dsm_segment_address(segment);
+    result = &ImportResults(shared)[pg_atomic_fetch_add_u32(&shared->next_worker, 1)];
+    BackgroundWorkerInitializeConnectionByOid(shared->database, shared->user, 0);
+
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    oldcontext = CurrentMemoryContext;
+
+    PG_TRY();
+    {
+        parser = import_begin(&state, reader_open_lo(shared->loid), shared->relid, ImportOptions(shared));
+
+        while((chunk = pg_atomic_fetch_add_u32(&shared->next_chunk, 1)) < (uint32) shared->nchunks
+            && !pg_atomic_read_u32(&shared->failed))
+        {
+            parser_seek(parser, shared->chunks[chunk].begin, shared->chunks[chunk].end);
+            import_run(&state, parser);
+        }
+
+        import_end(&state, parser);
+    }
+    PG_CATCH();
+    {
+        ErrorData *edata = NULL;
+
+        MemoryContextSwitchTo(oldcontext);
+        edata = CopyErrorData();
+        result->failed = true;
+        result->sqlerrcode = edata->sqlerrcode;
+        result->offset = parser ? parser_record_offset(parser) : -1;
+        strlcpy(result->message, edata->message, IMPORT_MESSAGE_SIZE);
+        pg_atomic_write_u32(&shared->failed, 1);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+
+    result->imported = state.imported;
+    result->done = true;
+    elog(DEBUG1, "import worker: " UINT64_FORMAT " records imported", state.imported);
+    dsm_detach(segment);
+}
+
+PG_FUNCTION_INFO_V1(import_mgf_parallel);
+Datum import_mgf_parallel(PG_FUNCTION_ARGS)
+{
+    Oid loid = PG_GETARG_OID(0);
+    Oid relid = PG_GETARG_OID(1);
+    Jsonb *options = PG_GETARG_JSONB_P(2);
+    int32 nworkers = PG_GETARG_INT32(3);
+    AclResult aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_INSERT);
+    BackgroundWorkerHandle **handles = NULL;
+    ImportChunk *chunks = NULL;
+    dsm_segment *segment = NULL;
+    ImportShared *shared = NULL;
+    ImportWorkerResult *failed = NULL;
+    Size results_offset = 0;
+    Size options_offset = 0;
+    int nchunks = 0;
+    int launched = 0;
+    uint64 imported = 0;
+
+    if(nworkers <= 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("number of workers must be positive")));
+
+    if(aclresult != ACLCHECK_OK)
+        aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(relid));
+
+    chunks = palloc(nworkers * IMPORT_CHUNKS_PER_WORKER * sizeof(ImportChunk));
+    nchunks = import_split(loid, nworkers * IMPORT_CHUNKS_PER_WORKER, chunks);
+    if(nchunks == 0)
+        PG_RETURN_INT64(0);
+
+    nworkers = Min(nworkers, nchunks);
+    results_offset = MAXALIGN(offsetof(ImportShared, chunks) + nchunks * sizeof(ImportChunk));
+    options_offset = MAXALIGN(results_offset + nworkers * sizeof(ImportWorkerResult));
+
+    segment = dsm_create(options_offset + VARSIZE(options), 0);
+    shared = (ImportShared*) dsm_segment_address(segment);
+    shared->database = MyDatabaseId;
+    shared->user = GetUserId();
+    shared->loid = loid;
+    shared->relid = relid;
+    pg_atomic_init_u32(&shared->next_chunk, 0);
+    pg_atomic_init_u32(&shared->next_worker, 0);
+    pg_atomic_init_u32(&shared->failed, 0);
+    shared->nchunks = nchunks;
+    shared->nworkers = nworkers;
+    shared->results_offset = results_offset;
+    shared->options_offset = options_offset;
+    memcpy(shared->chunks, chunks, nchunks * sizeof(ImportChunk));
+    memset(ImportResults(shared), 0, nworkers * sizeof(ImportWorkerResult));
+    memcpy(ImportOptions(shared), options, VARSIZE(options));
+
+    handles = palloc0(nworkers * sizeof(BackgroundWorkerHandle*));
+    for(int i = 0; i < nworkers; i++)
+    {
+        BackgroundWorker worker;
+
+        memset(&worker, 0, sizeof(worker));
+        worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+        worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+        worker.bgw_restart_time = BGW_NEVER_RESTART;
+        worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(segment));
+        worker.bgw_notify_pid = MyProcPid;
+        snprintf(worker.bgw_library_name, BGW_MAXLEN, "pgms");
+        snprintf(worker.bgw_function_name, BGW_MAXLEN, "import_mgf_worker");
+        snprintf(worker.bgw_name, BGW_MAXLEN, "pgms import worker %d", i);
+        snprintf(worker.bgw_type, BGW_MAXLEN, "pgms import");
+
+        if(!RegisterDynamicBackgroundWorker(&worker, &handles[launched]))
+            break;
+
+        launched++;
+    }
+
+    if(launched == 0)
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_RESOURCES)
+            , errmsg("could not register background worker for import")
+            , errhint("Consider increasing configuration parameter \"max_worker_processes\".")));
+
+    elog(DEBUG1, "import: %d chunks for %d workers", nchunks, launched);
+
+    PG_TRY();
+    {
+        for(int i = 0; i < launched; i++)
+            WaitForBackgroundWorkerShutdown(handles[i]);
+    }
+    PG_CATCH();
+    {
+        for(int i = 0; i < launched; i++)
+            TerminateBackgroundWorker(handles[i]);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    // only workers which attached own a result, the others left chunks to them
+    for(uint32 i = 0; i < pg_atomic_read_u32(&shared->next_worker); i++)
+    {
+        ImportWorkerResult *result = &ImportResults(shared)[i];
+
+        if(result->failed)
+            failed = failed && failed->failed ? failed : result;
+        else if(result->done)
+            imported += result->imported;
+        else if(!failed)
+            failed = result;
+    }
+
+    if(failed && failed->failed)
+        ereport(ERROR, (errcode(failed->sqlerrcode)
+            , errmsg("parallel MGF import failed at record offset " INT64_FORMAT ": %s", failed->offset, failed->message)
+            , errdetail(UINT64_FORMAT " records were imported and committed by other workers.", imported)));
+    else if(failed || pg_atomic_read_u32(&shared->next_chunk) < (uint32) nchunks)
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR)
+            , errmsg("parallel MGF import worker exited unexpectedly")
+            , errdetail(UINT64_FORMAT " records were imported and committed by other workers.", imported)));
+
+    dsm_detach(segment);
+    PG_RETURN_INT64((int64) imported);
+}
@@ -15,12 +15,16 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "filter.h"
 #include "pgms.h"
+#include "progress.h"
+#include "reader.h"
 #include "spectrum.h"
 
 #include <funcapi.h>
 #include <plpgsql.h>
 #include <utils/builtins.h>
+#include <utils/float.h>
 #include <catalog/pg_type.h>
 #include <catalog/namespace.h>
 #if PG_VERSION_NUM >= 130000
@@ -33,6 +37,9 @@
 
 #include <utils/syscache.h>
 
+#define JSON_PEAKS_INITIAL_SIZE 256
+#define JSON_STREAM_BUFFER_SIZE (64 * 1024)
+
 typedef struct
 {
     JsonbIterator   *it;
@@ -40,6 +47,13 @@ typedef struct
     bool*           isnull;
     JsonbIteratorToken state;
     size_t          cnt;
+    SpectrumFilter  *filter;
+    float4          precursor;
+    float4          *mzs;
+    float4          *intensities;
+    size_t          mzs_cnt;
+    size_t          intensities_cnt;
+    size_t          peaks_size;
 } json_ctx_t;
 
 void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx);
@@ -52,6 +66,10 @@ static void json_ctx_free(json_ctx_t* ctx)
         pfree(ctx->values);
     if(ctx->isnull)
         pfree(ctx->isnull);
+    if(ctx->mzs)
+        pfree(ctx->mzs);
+    if(ctx->intensities)
+        pfree(ctx->intensities);
     pfree(ctx);
 }
 
@@ -63,6 +81,11 @@ static json_ctx_t* json_ctx_create(Jsonb* jb, TupleDesc td)
     json_ctx->values = palloc(td->natts * sizeof(Datum));
     json_ctx->isnull = palloc(td->natts * sizeof(bool));
 
+    // peak buffers live in the multi call context and are reused by all records
+    json_ctx->peaks_size = JSON_PEAKS_INITIAL_SIZE;
+    json_ctx->mzs = palloc(json_ctx->peaks_size * sizeof(float4));
+    json_ctx->intensities = palloc(json_ctx->peaks_size * sizeof(float4));
+
     if(JB_ROOT_IS_OBJECT(jb))
         json_ctx->cnt = 1;
     else if(JB_ROOT_IS_ARRAY(jb))
@@ -73,64 +96,112 @@ static json_ctx_t* json_ctx_create(Jsonb* jb, TupleDesc td)
     return json_ctx;
 }
 
-static dummyret parser_set_column_array(json_ctx_t* ctx, AttInMetadata *attinmeta, Index columnIndex, List *l, size_t dim)
+static float4 json_numeric_float4(Numeric num)
 {
-#define ArrayInnerTraversal(list, n, res)                   \
-    do {                                                    \
-        for(Index i = 0; i < (n); i++)                      \
-        {                                                   \
-            StringInfo record = (StringInfo) lfirst(        \
-                list_nth_cell((list), i)                    \
-            );                                              \
-            Pointer pbegin = StringInfoToCString(record);   \
-            Pointer pend = pbegin + record->len -1;         \
-                                                            \
-            NormalizeNumericSignSuffix(pbegin, pend);       \
-            appendStringInfoString((result), pbegin);       \
-            appendStringInfoCharMacro((result)              \
-                , i == (n) - 1 ? ' ' : ',');                \
-            pfree(record->data);                            \
-        }                                                   \
-    } while(false)
-
-    StringInfo result = makeStringInfo();
-
-    if(columnIndex < ColumnCount(attinmeta->tupdesc) && !ColumnIsDropped(attinmeta->tupdesc, columnIndex))
+    float4 value = 0.0f;
+
+    if(!spectrum_numeric_float4(num, &value))
+        value = DatumGetFloat4(DirectFunctionCall1(numeric_float4, NumericGetDatum(num)));
+
+    return value;
+}
+
+static dummyret json_append_peak(json_ctx_t* ctx, const JsonbValue *val, bool is_mz)
+{
+    size_t *count = is_mz ? &ctx->mzs_cnt : &ctx->intensities_cnt;
+
+    if(val->type != jbvNumeric)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+            , errmsg("spectrum peak values must be json numbers")));
+
+    if(*count == ctx->peaks_size)
     {
-        ListCell *cell = NULL;
-        size_t count = list_length(l);
+        ctx->peaks_size *= 2;
+        ctx->mzs = repalloc(ctx->mzs, ctx->peaks_size * sizeof(float4));
+        ctx->intensities = repalloc(ctx->intensities, ctx->peaks_size * sizeof(float4));
+    }
 
-        elog(DEBUG1, "%s of %d: sizeof %ld in %ld dimension"
-            , NameStr(*ColumnName(attinmeta->tupdesc, columnIndex))
-            , ColumnType(attinmeta->tupdesc, columnIndex)
-            , count
-            , dim);
+    (is_mz ? ctx->mzs : ctx->intensities)[(*count)++] = json_numeric_float4(val->val.numeric);
+}
 
-        appendStringInfoCharMacro(result, '{');
+// spectrum is built when the whole object is read, precursor may follow it
+static dummyret json_set_spectrum(json_ctx_t* ctx, Index columnIndex)
+{
+    size_t count = ctx->mzs_cnt;
 
-        foreach(cell, l)
-        {
-            List* ll = lfirst(cell);
+    if(ctx->mzs_cnt != ctx->intensities_cnt)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+            , errmsg("spectrum peaks must be pairs of m/z and intensity")));
+
+    if(ctx->filter)
+        count = spectrum_filter_apply(ctx->filter, ctx->mzs, ctx->intensities, count, ctx->precursor);
+
+    ctx->values[columnIndex] = spectrum_build(ctx->mzs, ctx->intensities, count);
+    ctx->isnull[columnIndex] = false;
+}
+
+/*
+ * Scalar column value, numbers are converted directly when the column type
+ * allows it, everything else goes through the column input function.
+ */
+static dummyret json_set_value(json_ctx_t* ctx, AttInMetadata *attinmeta, Index columnIndex, const JsonbValue *val, StringInfo data)
+{
+    Oid type = ColumnType(attinmeta->tupdesc, columnIndex);
+
+    if(val->type == jbvNull)
+        return;
 
-            appendStringInfoCharMacro(result, '{');
-            elog(DEBUG1, "count %d", list_length(ll));
-            ArrayInnerTraversal(ll, list_length(ll), result);
-            appendStringInfoCharMacro(result, '}');
-            appendStringInfoCharMacro(result, cell == list_tail(l) ? ' ' : ',');
+    if(val->type == jbvNumeric)
+    {
+        Datum num = NumericGetDatum(val->val.numeric);
+        bool converted = true;
+
+        switch(type)
+        {
+            case FLOAT4OID:
+                ctx->values[columnIndex] = Float4GetDatum(json_numeric_float4(val->val.numeric));
+                break;
+            case FLOAT8OID:
+                ctx->values[columnIndex] = DirectFunctionCall1(numeric_float8, num);
+                break;
+            case INT4OID:
+                ctx->values[columnIndex] = DirectFunctionCall1(numeric_int4, num);
+                break;
+            case INT8OID:
+                ctx->values[columnIndex] = DirectFunctionCall1(numeric_int8, num);
+                break;
+            case NUMERICOID:
+                converted = attinmeta->atttypmods[columnIndex] < 0;
+                if(converted)
+                    ctx->values[columnIndex] = PointerGetDatum(PG_DETOAST_DATUM_COPY(num));
+                break;
+            default:
+                converted = false;
+                break;
         }
 
-        appendStringInfoCharMacro(result, '}');
+        if(converted)
+        {
+            ctx->isnull[columnIndex] = false;
+            return;
+        }
 
-        elog(DEBUG1, "Formed to: %s", StringInfoToCString(result));
-        ctx->values[columnIndex] = InputFunctionCall(&attinmeta->attinfuncs[columnIndex]
-            , StringInfoToCString(result)
-            , attinmeta->attioparams[columnIndex]
-            , attinmeta->atttypmods[columnIndex]);
+        appendStringInfoString(data, DatumGetCString(DirectFunctionCall1(numeric_out, num)));
+    }
+    else if(val->type == jbvString && type == TEXTOID)
+    {
+        ctx->values[columnIndex] = PointerGetDatum(cstring_to_text_with_len(val->val.string.val, val->val.string.len));
         ctx->isnull[columnIndex] = false;
-        pfree(result->data);
-        pfree(result);
+        return;
     }
-#undef ArrayInnerTraversal
+    else if(val->type == jbvBool)
+        appendStringInfoString(data, val->val.boolean ? "true" : "false");
+    else
+        appendBinaryStringInfo(data, val->val.string.val, val->val.string.len);
+
+    ctx->values[columnIndex] = InputFunctionCall(&attinmeta->attinfuncs[columnIndex], data->data, attinmeta->attioparams[columnIndex], attinmeta->atttypmods[columnIndex]);
+    ctx->isnull[columnIndex] = false;
+    elog(DEBUG1, "WJB_VALUE %s", data->data);
 }
 
 void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx)
@@ -139,9 +210,13 @@ void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx)
     TupleDesc tupdesc = attinmeta->tupdesc;
     Index idx = tupdesc->natts;
     size_t elem_cnt = 0;
-    List *mzs = NIL;
-    List *peaks = NIL;
     int ions_cnt = 0;
+    Index spectrum_idx = tupdesc->natts;
+    bool is_precursor = false;
+
+    json_ctx->precursor = get_float4_nan();
+    json_ctx->mzs_cnt = 0;
+    json_ctx->intensities_cnt = 0;
 
     do
     {
@@ -158,39 +233,23 @@ void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx)
                     && strcmp(data->data, NameStr(TupleDescAttr(tupdesc, idx)->attname))
                     )
                     idx++;
+                is_precursor = json_ctx->filter && !strcmp(data->data, json_ctx->filter->precursor);
                 break;
             case WJB_ELEM:
-                if(tupdesc->attrs[idx].atttypid == spectrumOid)
+                if(idx != tupdesc->natts && tupdesc->attrs[idx].atttypid == spectrumOid)
                 {
-                    StringInfo record = makeStringInfo();
-                    char *tmp = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(val.val.numeric)));
-
-                    elog(DEBUG1, "WJB_ELEM %s", tmp);
-
-                    appendStringInfoString(record, tmp);
-                    if(elem_cnt++ % 2 == 0)
-                    {
-                        mzs = lappend(mzs, record);
-                    }
-                    else
-                    {
-                        peaks = lappend(peaks, record);
+                    json_append_peak(json_ctx, &val, elem_cnt++ % 2 == 0);
+                    if(elem_cnt % 2 == 0)
                         ions_cnt--;
-                    }
                 }
                 break;
             case WJB_VALUE:
+                if(is_precursor && val.type == jbvNumeric)
+                    json_ctx->precursor = json_numeric_float4(val.val.numeric);
+                is_precursor = false;
+
                 if(idx != tupdesc->natts)
-                {
-                    if(val.type == jbvNumeric)
-                        appendStringInfoString(data, DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(val.val.numeric))));
-                    else
-                        appendBinaryStringInfo(data, val.val.string.val, val.val.string.len);
-
-                    json_ctx->values[idx] = InputFunctionCall(&attinmeta->attinfuncs[idx], data->data, attinmeta->attioparams[idx], attinmeta->atttypmods[idx]);
-                    json_ctx->isnull[idx] = false;
-                    elog(DEBUG1, "WJB_VALUE %s", data->data);
-                }
+                    json_set_value(json_ctx, attinmeta, idx, &val, data);
                 idx = tupdesc->natts;
                 break;
             case WJB_BEGIN_ARRAY:
@@ -211,17 +270,8 @@ void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx)
                 {
                     elog(DEBUG1, "WJB_END_ARRAY");
 
-                    if(mzs && peaks)
-                    {
-                        List *spectrums = NIL;
-
-                        spectrums = lappend(spectrums, mzs);
-                        spectrums = lappend(spectrums, peaks);
-                        parser_set_column_array(json_ctx, attinmeta, idx, spectrums, SPECTRUM_ARRAY_DIM);
-                        list_free_deep(mzs);
-                        list_free_deep(peaks);
-                        list_free(spectrums);
-                    }
+                    if(json_ctx->mzs_cnt && json_ctx->intensities_cnt)
+                        spectrum_idx = idx;
                     idx = tupdesc->natts;
                 }
                 break;
@@ -238,6 +288,9 @@ void json_ctx_next(AttInMetadata *attinmeta, json_ctx_t *json_ctx)
         resetStringInfo(data);
     } while (json_ctx->state != WJB_DONE && json_ctx->cnt);
 
+    if(spectrum_idx != tupdesc->natts)
+        json_set_spectrum(json_ctx, spectrum_idx);
+
     pfree(data->data);
     pfree(data);
 }
@@ -265,6 +318,8 @@ Datum load_from_json(PG_FUNCTION_ARGS)
 
         funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
         funcctx->user_fctx = (void*) json_ctx_create(PG_GETARG_JSONB_P(0), tuple_desc);
+        if(PG_NARGS() > 1)
+            ((json_ctx_t*) funcctx->user_fctx)->filter = spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root);
         elog(DEBUG1, "records: %ld", ((json_ctx_t*)funcctx->user_fctx)->cnt);
         MemoryContextSwitchTo(oldcontext);
     }
@@ -298,3 +353,274 @@ Datum load_from_json(PG_FUNCTION_ARGS)
     json_ctx_free(json_ctx);
     SRF_RETURN_DONE(funcctx);
 }
+
+/*
+ * Streaming reader of JSON spectrum libraries, the top level array is split
+ * into its objects without parsing the whole document, so only one object is
+ * held in memory. Each object is converted to jsonb and mapped to columns by
+ * json_ctx_next() as load_from_json() does.
+ */
+typedef struct
+{
+    Reader          *reader;
+    char            *buffer;
+    size_t          len;
+    size_t          pos;
+    int64           offset;
+    bool            started;
+    bool            single;
+    bool            finished;
+    bool            progress;
+    int64           records;
+    StringInfoData  object;
+    json_ctx_t      *json_ctx;
+} json_stream_t;
+
+typedef Reader *(*json_stream_open_t)(FunctionCallInfo fcinfo);
+
+static inline int json_stream_getc(json_stream_t *stream)
+{
+    if(stream->pos == stream->len)
+    {
+        stream->offset += stream->len;
+        stream->pos = 0;
+        stream->len = reader_read(stream->reader, stream->buffer, JSON_STREAM_BUFFER_SIZE);
+
+        if(stream->len == 0)
+            return EOF;
+    }
+
+    return (uint8) stream->buffer[stream->pos++];
+}
+
+static int json_stream_skip_space(json_stream_t *stream)
+{
+    int c = EOF;
+
+    do
+        c = json_stream_getc(stream);
+    while(c == ' ' || c == '\t' || c == '\n' || c == '\r');
+
+    return c;
+}
+
+static dummyret json_stream_error(json_stream_t *stream, const char *message)
+{
+    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+        , errmsg("invalid JSON spectrum library: %s", message)
+        , errdetail("Error at byte offset " INT64_FORMAT ".", stream->offset + (int64) stream->pos)));
+}
+
+/*
+ * Copies the next top level object into stream->object, false is returned at
+ * the end of the array. A document of a single object is accepted too.
+ */
+static bool json_stream_next(json_stream_t *stream)
+{
+    int c = EOF;
+    int depth = 0;
+    bool string = false;
+    bool escape = false;
+
+    if(stream->finished)
+        return false;
+
+    c = json_stream_skip_space(stream);
+
+    if(!stream->started)
+    {
+        stream->started = true;
+
+        if(c == '[')
+            c = json_stream_skip_space(stream);
+        else
+            stream->single = c != EOF;
+
+        if(c == ']' || c == EOF)
+        {
+            stream->finished = true;
+            return false;
+        }
+    }
+    else if(c == ']' || (stream->single && c == EOF))
+    {
+        stream->finished = true;
+        return false;
+    }
+    else if(c == ',' && !stream->single)
+        c = json_stream_skip_space(stream);
+    else
+        json_stream_error(stream, c == EOF ? "unexpected end of input" : "expected \",\" or \"]\"");
+
+    if(c != '{')
+        json_stream_error(stream, "array elements must be objects");
+
+    resetStringInfo(&stream->object);
+
+    for(; c != EOF; c = json_stream_getc(stream))
+    {
+        appendStringInfoCharMacro(&stream->object, (char) c);
+
+        if(string)
+        {
+            if(escape)
+                escape = false;
+            else if(c == '\\')
+                escape = true;
+            else if(c == '"')
+                string = false;
+        }
+        else if(c == '"')
+            string = true;
+        else if(c == '{' || c == '[')
+            depth++;
+        else if((c == '}' || c == ']') && --depth == 0)
+            break;
+    }
+
+    if(c == EOF)
+        json_stream_error(stream, "unexpected end of input");
+
+    return true;
+}
+
+static json_stream_t *json_stream_open(Reader *reader, TupleDesc td)
+{
+    json_stream_t *stream = (json_stream_t *) palloc0(sizeof(json_stream_t));
+
+    stream->reader = reader;
+    stream->buffer = palloc(JSON_STREAM_BUFFER_SIZE);
+    initStringInfo(&stream->object);
+
+    // the iterator is set for each object, the context keeps the peak buffers
+    stream->json_ctx = (json_ctx_t *) palloc0(sizeof(json_ctx_t));
+    stream->json_ctx->values = palloc(td->natts * sizeof(Datum));
+    stream->json_ctx->isnull = palloc(td->natts * sizeof(bool));
+    stream->json_ctx->peaks_size = JSON_PEAKS_INITIAL_SIZE;
+    stream->json_ctx->mzs = palloc(stream->json_ctx->peaks_size * sizeof(float4));
+    stream->json_ctx->intensities = palloc(stream->json_ctx->peaks_size * sizeof(float4));
+
+    stream->progress = progress_start(PROGRESS_PGMS_COMMAND_IMPORT, InvalidOid);
+    if(stream->progress && reader->size)
+        progress_update(PROGRESS_PGMS_BYTES_TOTAL, reader_size(reader));
+
+    return stream;
+}
+
+static void json_stream_close(json_stream_t *stream)
+{
+    if(stream->progress)
+        progress_end();
+    reader_close(stream->reader);
+    json_ctx_free(stream->json_ctx);
+    pfree(stream->object.data);
+    pfree(stream->buffer);
+    pfree(stream);
+}
+
+static bool json_stream_record(json_stream_t *stream, AttInMetadata *attinmeta)
+{
+    json_ctx_t *json_ctx = stream->json_ctx;
+    Jsonb *jb = NULL;
+
+    if(!json_stream_next(stream))
+        return false;
+
+    jb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(stream->object.data)));
+
+    for(Index i = 0; i < attinmeta->tupdesc->natts; i++)
+    {
+        json_ctx->values[i] = (Datum) NULL;
+        json_ctx->isnull[i] = true;
+    }
+
+    json_ctx->it = JsonbIteratorInit(&jb->root);
+    json_ctx->state = WJB_DONE;
+    json_ctx->cnt = 1;
+    json_ctx_next(attinmeta, json_ctx);
+
+    if(stream->progress)
+    {
+        progress_update(PROGRESS_PGMS_RECORDS_PARSED, ++stream->records);
+        progress_update(PROGRESS_PGMS_BYTES_PROCESSED, stream->offset + stream->pos);
+    }
+
+    return true;
+}
+
+static Datum json_stream_srf(FunctionCallInfo fcinfo, json_stream_open_t open)
+{
+    FuncCallContext *funcctx = NULL;
+    json_stream_t *stream = NULL;
+    bool next = false;
+
+    if(SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext = NULL;
+        TupleDesc tuple_desc = NULL;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if(get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+                , errmsg("unsupported return type")));
+
+        if(!OidIsValid(spectrumOid))
+            spectrumOid = TypenameGetTypid("spectrum");
+
+        funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
+        stream = json_stream_open(open(fcinfo), tuple_desc);
+        if(stream->progress)
+            progress_end_at_shutdown(fcinfo);
+        if(PG_NARGS() > 1)
+            stream->json_ctx->filter = spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root);
+        funcctx->user_fctx = (void*) stream;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    stream = (json_stream_t*) funcctx->user_fctx;
+
+    PG_TRY();
+    {
+        next = json_stream_record(stream, funcctx->attinmeta);
+    }
+    PG_CATCH();
+    {
+        json_stream_close(stream);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    if(next)
+    {
+        HeapTuple tuple = heap_form_tuple(funcctx->attinmeta->tupdesc, stream->json_ctx->values, stream->json_ctx->isnull);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    json_stream_close(stream);
+    SRF_RETURN_DONE(funcctx);
+}
+
+static Reader *json_stream_open_lo(FunctionCallInfo fcinfo)
+{
+    return reader_open_lo(PG_GETARG_OID(0));
+}
+
+static Reader *json_stream_open_file(FunctionCallInfo fcinfo)
+{
+    return reader_open_file(text_to_cstring(PG_GETARG_TEXT_PP(0)));
+}
+
+PG_FUNCTION_INFO_V1(load_json_lo);
+Datum load_json_lo(PG_FUNCTION_ARGS)
+{
+    return json_stream_srf(fcinfo, json_stream_open_lo);
+}
+
+PG_FUNCTION_INFO_V1(load_json_file);
+Datum load_json_file(PG_FUNCTION_ARGS)
+{
+    return json_stream_srf(fcinfo, json_stream_open_file);
+}
@@ -0,0 +1,894 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared memory library cache
+ *
+ * library_load() copies the spectra of a library table into one pinned
+ * dynamic shared memory segment (the arena, see library_cache.h) and
+ * registers it in a small slot table in the main shared memory, which is
+ * only available when pgms is in shared_preload_libraries. Searches attach
+ * the arena once per session and read peaks in place.
+ *
+ * A slot is dropped when
+ *  - library_cache_invalidate() trigger fires on the table (and once more
+ *    when the writing transaction commits),
+ *  - the relfilenode of the table differs from the loaded one (TRUNCATE,
+ *    VACUUM FULL, CLUSTER),
+ *  - library_unload() is called.
+ * Backends keep the old segment mapped until their relcache callback or next
+ * lookup notices the change, so dropping a slot never invalidates arena
+ * pointers in use.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <miscadmin.h>
+
+#include <access/relation.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <executor/tuptable.h>
+#include <parser/parse_func.h>
+#include <postmaster/bgworker.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/guc.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/regproc.h>
+#include <utils/snapmgr.h>
+#include <utils/syscache.h>
+#include <utils/varlena.h>
+
+#include "cosine.h"
+#include "library_cache.h"
+#include "library_search.h"
+#include "spectrum.h"
+
+#define LIBRARY_CACHE_NAME      "pgms library cache"
+#define LIBRARY_CACHE_SLOTS     16
+#define LIBRARY_CACHE_RECENT    64
+#define LIBRARY_ARENA_MAGIC     0x504D5341
+
+typedef struct LibraryCacheSlot
+{
+    Oid             dbid;
+    Oid             relid;
+    AttrNumber      attnum;
+    AttrNumber      precursor_attnum;
+    Oid             relfilenode;
+    dsm_handle      handle;
+    bool            valid;
+    uint64          generation;
+    uint64          count;
+    Size            size;
+} LibraryCacheSlot;
+
+typedef struct LibraryCacheInvalidation
+{
+    Oid             dbid;
+    Oid             relid;
+    uint64          generation;
+} LibraryCacheInvalidation;
+
+typedef struct LibraryCacheControl
+{
+    LWLock          *lock;
+    uint64          generation;
+    LibraryCacheSlot slots[LIBRARY_CACHE_SLOTS];
+    uint64          nrecent;
+    LibraryCacheInvalidation recent[LIBRARY_CACHE_RECENT];
+} LibraryCacheControl;
+
+// session attachment of a slot's arena
+typedef struct LibraryCacheLocal
+{
+    Oid             relid;
+    dsm_segment     *segment;
+    uint64          generation;
+    bool            stale;
+} LibraryCacheLocal;
+
+static LibraryCacheControl *control = NULL;
+static LibraryCacheLocal local[LIBRARY_CACHE_SLOTS];
+static List *pending_relids = NIL;
+static List *loaded_relids = NIL;
+static bool xact_callback_registered = false;
+
+static char *library_prewarm = NULL;
+static char *library_prewarm_database = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+PGDLLEXPORT void library_cache_prewarm_main(Datum arg);
+
+static void library_cache_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if(prev_shmem_request_hook)
+        prev_shmem_request_hook();
+#endif
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(LibraryCacheControl)));
+    RequestNamedLWLockTranche(LIBRARY_CACHE_NAME, 1);
+}
+
+static void library_cache_shmem_startup(void)
+{
+    bool found = false;
+
+    if(prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    control = ShmemInitStruct(LIBRARY_CACHE_NAME, sizeof(LibraryCacheControl), &found);
+
+    if(!found)
+    {
+        memset(control, 0, sizeof(LibraryCacheControl));
+        control->lock = &(GetNamedLWLockTranche(LIBRARY_CACHE_NAME))->lock;
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+static void library_cache_relcache_callback(Datum arg, Oid relid)
+{
+    // segments are detached on next lookup, arena pointers may be in use now
+    for(int i = 0; i < LIBRARY_CACHE_SLOTS; i++)
+        if(local[i].segment && (!OidIsValid(relid) || local[i].relid == relid))
+            local[i].stale = true;
+}
+
+static void library_cache_release_stale(void)
+{
+    for(int i = 0; i < LIBRARY_CACHE_SLOTS; i++)
+    {
+        if(local[i].segment && local[i].stale)
+        {
+            dsm_detach(local[i].segment);
+            local[i].segment = NULL;
+            local[i].stale = false;
+        }
+    }
+}
+
+static bool library_cache_invalidate_relation(Oid relid)
+{
+    bool found = false;
+
+    if(control == NULL)
+        return false;
+
+    LWLockAcquire(control->lock, LW_EXCLUSIVE);
+
+    // loads running concurrently check the recent invalidations
+    control->recent[control->nrecent % LIBRARY_CACHE_RECENT].dbid = MyDatabaseId;
+    control->recent[control->nrecent % LIBRARY_CACHE_RECENT].relid = relid;
+    control->recent[control->nrecent % LIBRARY_CACHE_RECENT].generation = ++control->generation;
+    control->nrecent++;
+
+    for(int i = 0; i < LIBRARY_CACHE_SLOTS; i++)
+    {
+        LibraryCacheSlot *slot = &control->slots[i];
+
+        if(slot->valid && slot->dbid == MyDatabaseId && slot->relid == relid)
+        {
+            dsm_unpin_segment(slot->handle);
+            slot->valid = false;
+            slot->generation = ++control->generation;
+            found = true;
+            elog(DEBUG1, "library cache: slot %d of relation %u invalidated", i, relid);
+        }
+    }
+
+    LWLockRelease(control->lock);
+
+    return found;
+}
+
+static void library_cache_xact_callback(XactEvent event, void *arg)
+{
+    ListCell *lc = NULL;
+
+    if(event == XACT_EVENT_COMMIT)
+    {
+        // arena may have been loaded concurrently from a snapshot without the changes
+        foreach(lc, pending_relids)
+            library_cache_invalidate_relation(lfirst_oid(lc));
+    }
+
+    if(event == XACT_EVENT_ABORT)
+    {
+        // arena may contain rows of the aborted transaction
+        foreach(lc, loaded_relids)
+            library_cache_invalidate_relation(lfirst_oid(lc));
+    }
+
+    if(event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT
+        || event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT)
+    {
+        pending_relids = NIL;
+        loaded_relids = NIL;
+    }
+}
+
+static void library_cache_track(List **list, Oid relid)
+{
+    MemoryContext oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+    if(!xact_callback_registered)
+    {
+        RegisterXactCallback(library_cache_xact_callback, NULL);
+        xact_callback_registered = true;
+    }
+
+    *list = list_append_unique_oid(*list, relid);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+void library_cache_init(void)
+{
+    DefineCustomStringVariable("pgms.library_prewarm",
+        "Libraries loaded into the shared memory cache at server start.",
+        "Comma separated list of relation:spectrum_column[:precursor_column] entries.",
+        &library_prewarm,
+        "",
+        PGC_POSTMASTER,
+        0,
+        NULL,
+        NULL,
+        NULL);
+
+    DefineCustomStringVariable("pgms.library_prewarm_database",
+        "Database of libraries loaded at server start.",
+        NULL,
+        &library_prewarm_database,
+        "postgres",
+        PGC_POSTMASTER,
+        0,
+        NULL,
+        NULL,
+        NULL);
+
+    CacheRegisterRelcacheCallback(library_cache_relcache_callback, (Datum) 0);
+
+    if(!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = library_cache_shmem_request;
+#else
+    library_cache_shmem_request();
+#endif
+
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = library_cache_shmem_startup;
+
+    if(library_prewarm && library_prewarm[0])
+    {
+        BackgroundWorker worker;
+
+        memset(&worker, 0, sizeof(worker));
+        worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+        worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+        worker.bgw_restart_time = BGW_NEVER_RESTART;
+        snprintf(worker.bgw_library_name, BGW_MAXLEN, "pgms");
+        snprintf(worker.bgw_function_name, BGW_MAXLEN, "library_cache_prewarm_main");
+        snprintf(worker.bgw_name, BGW_MAXLEN, "pgms library prewarm");
+        snprintf(worker.bgw_type, BGW_MAXLEN, "pgms library prewarm");
+        RegisterBackgroundWorker(&worker);
+    }
+}
+
+static int library_order_cmp(const void *a, const void *b, void *arg)
+{
+    const float4 *precursors = (const float4*) arg;
+    float4 pa = precursors[*(const uint64*) a];
+    float4 pb = precursors[*(const uint64*) b];
+
+    return float4_cmp_internal(pa, pb);
+}
+
+static dsm_segment *library_cache_build(Relation rel, AttrNumber attnum, AttrNumber precursor_attnum, uint64 *count)
+{
+    MemoryContext context = AllocSetContextCreate(CurrentMemoryContext, "pgms library load", ALLOCSET_DEFAULT_SIZES);
+    MemoryContext tuple_context = AllocSetContextCreate(context, "pgms library load tuple", ALLOCSET_DEFAULT_SIZES);
+    MemoryContext oldcontext = MemoryContextSwitchTo(context);
+    Oid precursor_type = precursor_attnum != InvalidAttrNumber
+        ? TupleDescAttr(RelationGetDescr(rel), precursor_attnum - 1)->atttypid : InvalidOid;
+    calc_score_func_t calc_score = determine_calc_score(0.0f, 1.0f);
+    TupleTableSlot *slot = table_slot_create(rel, NULL);
+    TableScanDesc scan = table_beginscan(rel, GetActiveSnapshot(), 0, NULL);
+    uint64 capacity = 1024;
+    uint64 peak_capacity = 65536;
+    uint64 n = 0;
+    uint64 npeaks = 0;
+    uint64 *offsets = palloc_extended((capacity + 1) * sizeof(uint64), MCXT_ALLOC_HUGE);
+    float8 *norms = palloc_extended(capacity * sizeof(float8), MCXT_ALLOC_HUGE);
+    float4 *precursors = palloc_extended(capacity * sizeof(float4), MCXT_ALLOC_HUGE);
+    ItemPointerData *tids = palloc_extended(capacity * sizeof(ItemPointerData), MCXT_ALLOC_HUGE);
+    float4 *mz = palloc_extended(peak_capacity * sizeof(float4), MCXT_ALLOC_HUGE);
+    float4 *intensity = palloc_extended(peak_capacity * sizeof(float4), MCXT_ALLOC_HUGE);
+    uint64 *order = NULL;
+    LibraryArena header;
+    dsm_segment *segment = NULL;
+    char *base = NULL;
+
+    offsets[0] = 0;
+
+    while(table_scan_getnextslot(scan, ForwardScanDirection, slot))
+    {
+        bool isnull = false;
+        Datum value = slot_getattr(slot, attnum, &isnull);
+        float4 precursor = NAN;
+        size_t len = 0;
+        float4 *data = NULL;
+        float8 norm = 0.0;
+
+        CHECK_FOR_INTERRUPTS();
+
+        if(isnull)
+            continue;
+
+        if(precursor_attnum != InvalidAttrNumber)
+        {
+            Datum p = slot_getattr(slot, precursor_attnum, &isnull);
+
+            if(!isnull)
+                precursor = precursor_type == FLOAT4OID ? DatumGetFloat4(p) : (float4) DatumGetFloat8(p);
+        }
+
+        MemoryContextSwitchTo(tuple_context);
+        value = PointerGetDatum(PG_DETOAST_DATUM(value));
+        len = spectrum_length(value);
+        data = spectrum_data(value);
+        MemoryContextSwitchTo(context);
+
+        if(n == capacity)
+        {
+            capacity *= 2;
+            offsets = repalloc_huge(offsets, (capacity + 1) * sizeof(uint64));
+            norms = repalloc_huge(norms, capacity * sizeof(float8));
+            precursors = repalloc_huge(precursors, capacity * sizeof(float4));
+            tids = repalloc_huge(tids, capacity * sizeof(ItemPointerData));
+        }
+
+        while(npeaks + len > peak_capacity)
+        {
+            peak_capacity *= 2;
+            mz = repalloc_huge(mz, peak_capacity * sizeof(float4));
+            intensity = repalloc_huge(intensity, peak_capacity * sizeof(float4));
+        }
+
+        memcpy(mz + npeaks, data, len * sizeof(float4));
+        memcpy(intensity + npeaks, data + len, len * sizeof(float4));
+
+        // the same weights as cosine_upper_bound_peaks() sums with default powers
+        for(size_t i = 0; i < len; i++)
+            norm += calc_score(data[len + i], data[len + i], data[i], data[i], 1.0f, 0.0f);
+
+        npeaks += len;
+        norms[n] = norm;
+        precursors[n] = precursor;
+        tids[n] = slot->tts_tid;
+        offsets[++n] = npeaks;
+
+        MemoryContextReset(tuple_context);
+    }
+
+    table_endscan(scan);
+    ExecDropSingleTupleTableSlot(slot);
+
+    order = palloc_extended(Max(n, 1) * sizeof(uint64), MCXT_ALLOC_HUGE);
+    for(uint64 i = 0; i < n; i++)
+        order[i] = i;
+
+    if(n > 1)
+        qsort_arg(order, n, sizeof(uint64), library_order_cmp, precursors);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LIBRARY_ARENA_MAGIC;
+    header.relid = RelationGetRelid(rel);
+    header.attnum = attnum;
+    header.precursor_attnum = precursor_attnum;
+    header.count = n;
+    header.npeaks = npeaks;
+    header.offsets_offset = MAXALIGN(sizeof(LibraryArena));
+    header.norms_offset = header.offsets_offset + MAXALIGN((n + 1) * sizeof(uint64));
+    header.precursors_offset = header.norms_offset + MAXALIGN(n * sizeof(float8));
+    header.order_offset = header.precursors_offset + MAXALIGN(n * sizeof(float4));
+    header.tids_offset = header.order_offset + MAXALIGN(n * sizeof(uint64));
+    header.mz_offset = header.tids_offset + MAXALIGN(n * sizeof(ItemPointerData));
+    header.intensity_offset = header.mz_offset + MAXALIGN(npeaks * sizeof(float4));
+
+    segment = dsm_create(header.intensity_offset + MAXALIGN(npeaks * sizeof(float4)), 0);
+    base = dsm_segment_address(segment);
+
+    memcpy(base, &header, sizeof(header));
+    memcpy(base + header.offsets_offset, offsets, (n + 1) * sizeof(uint64));
+    memcpy(base + header.norms_offset, norms, n * sizeof(float8));
+    memcpy(base + header.precursors_offset, precursors, n * sizeof(float4));
+    memcpy(base + header.order_offset, order, n * sizeof(uint64));
+    memcpy(base + header.tids_offset, tids, n * sizeof(ItemPointerData));
+    memcpy(base + header.mz_offset, mz, npeaks * sizeof(float4));
+    memcpy(base + header.intensity_offset, intensity, npeaks * sizeof(float4));
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextDelete(context);
+
+    elog(DEBUG1, "library cache: " UINT64_FORMAT " spectra, " UINT64_FORMAT " peaks loaded", n, npeaks);
+
+    *count = n;
+    return segment;
+}
+
+/*
+ * The relcache callback sees only rewrites of the table, row changes drop the
+ * loaded library through the library_cache_invalidate() trigger, so it is
+ * created together with the first load. Materialized views cannot have
+ * triggers, they are rewritten by REFRESH unless it is CONCURRENTLY.
+ */
+static void library_cache_install_trigger(Relation rel, AttrNumber attnum)
+{
+    Oid type = get_atttype(RelationGetRelid(rel), attnum);
+    HeapTuple tuple = NULL;
+    char *nspname = NULL;
+    Oid funcid = InvalidOid;
+
+    if(rel->rd_rel->relkind != RELKIND_RELATION)
+        return;
+
+    // the trigger function lives in the schema of the spectrum type
+    tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(type));
+    if(!HeapTupleIsValid(tuple))
+        elog(ERROR, "cache lookup failed for type %u", type);
+
+    nspname = get_namespace_name(((Form_pg_type) GETSTRUCT(tuple))->typnamespace);
+    ReleaseSysCache(tuple);
+
+    funcid = LookupFuncName(list_make2(makeString(nspname), makeString("library_cache_invalidate")), 0, NULL, false);
+
+    for(int i = 0; rel->trigdesc && i < rel->trigdesc->numtriggers; i++)
+        if(rel->trigdesc->triggers[i].tgfoid == funcid)
+            return;
+
+    SPI_connect();
+
+    if(SPI_execute(psprintf("CREATE TRIGGER library_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON %s "
+            "FOR EACH STATEMENT EXECUTE FUNCTION %s.library_cache_invalidate()",
+            quote_qualified_identifier(get_namespace_name(RelationGetNamespace(rel)), RelationGetRelationName(rel)),
+            quote_identifier(nspname)), false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "library cache: could not create trigger on %s", RelationGetRelationName(rel));
+
+    SPI_finish();
+}
+
+static uint64 library_cache_load(Relation rel, AttrNumber attnum, AttrNumber precursor_attnum)
+{
+    Oid relid = RelationGetRelid(rel);
+    uint64 count = 0;
+    uint64 start = 0;
+    dsm_segment *segment = NULL;
+    int free_slot = -1;
+    bool changed = false;
+
+    if(control == NULL)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("pgms library cache requires pgms in shared_preload_libraries")));
+
+    library_cache_install_trigger(rel, attnum);
+
+    LWLockAcquire(control->lock, LW_SHARED);
+    start = control->generation;
+    LWLockRelease(control->lock);
+
+    segment = library_cache_build(rel, attnum, precursor_attnum, &count);
+
+    LWLockAcquire(control->lock, LW_EXCLUSIVE);
+
+    // the table changed while it was read, lost history counts as a change
+    if(control->nrecent > LIBRARY_CACHE_RECENT)
+        changed = control->recent[control->nrecent % LIBRARY_CACHE_RECENT].generation > start;
+
+    for(uint64 i = 0; i < Min(control->nrecent, LIBRARY_CACHE_RECENT); i++)
+        if(control->recent[i].generation > start && control->recent[i].dbid == MyDatabaseId
+            && control->recent[i].relid == relid)
+            changed = true;
+
+    if(changed)
+    {
+        LWLockRelease(control->lock);
+        ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+            errmsg("library \"%s\" was modified while it was loaded", RelationGetRelationName(rel)),
+            errhint("Retry library_load().")));
+    }
+
+    for(int i = 0; i < LIBRARY_CACHE_SLOTS; i++)
+    {
+        LibraryCacheSlot *slot = &control->slots[i];
+
+        if(slot->valid && slot->dbid == MyDatabaseId && slot->relid == relid && slot->attnum == attnum)
+        {
+            dsm_unpin_segment(slot->handle);
+            slot->valid = false;
+            slot->generation = ++control->generation;
+        }
+
+        if(!slot->valid && free_slot < 0)
+            free_slot = i;
+    }
+
+    if(free_slot < 0)
+    {
+        LWLockRelease(control->lock);
+        ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+            errmsg("pgms library cache is full"),
+            errhint("Unload some library by library_unload().")));
+    }
+
+    dsm_pin_segment(segment);
+    control->slots[free_slot].dbid = MyDatabaseId;
+    control->slots[free_slot].relid = relid;
+    control->slots[free_slot].attnum = attnum;
+    control->slots[free_slot].precursor_attnum = precursor_attnum;
+    control->slots[free_slot].relfilenode = rel->rd_node.relNode;
+    control->slots[free_slot].handle = dsm_segment_handle(segment);
+    control->slots[free_slot].count = count;
+    control->slots[free_slot].size = dsm_segment_map_length(segment);
+    control->slots[free_slot].generation = ++control->generation;
+    control->slots[free_slot].valid = true;
+
+    // the loading session keeps its mapping
+    if(local[free_slot].segment)
+        dsm_detach(local[free_slot].segment);
+
+    dsm_pin_mapping(segment);
+    local[free_slot].relid = relid;
+    local[free_slot].segment = segment;
+    local[free_slot].generation = control->slots[free_slot].generation;
+    local[free_slot].stale = false;
+
+    LWLockRelease(control->lock);
+
+    library_cache_track(&loaded_relids, relid);
+
+    return count;
+}
+
+const LibraryArena *library_cache_lookup(Relation rel, AttrNumber attnum, dsm_handle *handle)
+{
+    const LibraryArena *arena = NULL;
+    bool moved = false;
+
+    if(control == NULL)
+        return NULL;
+
+    library_cache_release_stale();
+
+    LWLockAcquire(control->lock, LW_SHARED);
+
+    for(int i = 0; i < LIBRARY_CACHE_SLOTS; i++)
+    {
+        LibraryCacheSlot *slot = &control->slots[i];
+
+        if(!slot->valid || slot->dbid != MyDatabaseId || slot->relid != RelationGetRelid(rel) || slot->attnum != attnum)
+            continue;
+
+        if(slot->relfilenode != rel->rd_node.relNode)
+        {
+            moved = true;
+            break;
+        }
+
+        if(local[i].segment && local[i].generation != slot->generation)
+        {
+            dsm_detach(local[i].segment);
+            local[i].segment = NULL;
+        }
+
+        if(!local[i].segment)
+        {
+            dsm_segment *segment = dsm_attach(slot->handle);
+
+            if(segment == NULL)
+                break;
+
+            dsm_pin_mapping(segment);
+            local[i].relid = slot->relid;
+            local[i].segment = segment;
+            local[i].generation = slot->generation;
+            local[i].stale = false;
+        }
+
+        *handle = slot->handle;
+        arena = (const LibraryArena*) dsm_segment_address(local[i].segment);
+        break;
+    }
+
+    LWLockRelease(control->lock);
+
+    if(moved)
+    {
+        elog(DEBUG1, "library cache: relation %u was rewritten", RelationGetRelid(rel));
+        library_cache_invalidate_relation(RelationGetRelid(rel));
+    }
+
+    Assert(arena == NULL || arena->magic == LIBRARY_ARENA_MAGIC);
+
+    return arena;
+}
+
+const LibraryArena *library_cache_attach(dsm_handle handle)
+{
+    dsm_segment *segment = dsm_attach(handle);
+
+    if(segment == NULL)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("could not attach pgms library arena")));
+
+    return (const LibraryArena*) dsm_segment_address(segment);
+}
+
+static bool library_cache_score(const LibraryArena *arena, uint64 index, const float4 *query_mzs,
+    const float4 *query_peaks, size_t query_len, float8 query_norm, const MzBuckets *query_buckets,
+    float4 tolerance, float4 threshold, SearchResult *result)
+{
+    const uint64 *offsets = ArenaOffsets(arena);
+    const float4 *mzs = ArenaMz(arena) + offsets[index];
+    const float4 *peaks = ArenaIntensity(arena) + offsets[index];
+    size_t len = offsets[index + 1] - offsets[index];
+    float4 cutoff = search_result_cutoff(result, threshold);
+    float4 score = 0.0f;
+
+    if(float4_gt(cutoff, 0.0f)
+        && float4_lt(cosine_upper_bound_peaks(mzs, peaks, len, ArenaNorms(arena)[index],
+            query_mzs, query_peaks, query_len, query_norm, query_buckets, tolerance, 0.0f, 1.0f), cutoff))
+        return false;
+
+    score = cosine_greedy_calc(mzs, peaks, len, query_mzs, query_peaks, query_len, query_buckets, tolerance, 0.0f, 1.0f);
+
+    if(float4_ge(score, threshold) && float4_gt(score, 0.0f))
+        search_result_add(result, (ItemPointer) &ArenaTids(arena)[index], score);
+
+    return true;
+}
+
+static float8 library_cache_query_norm(const float4 *query_mzs, const float4 *query_peaks, size_t query_len)
+{
+    calc_score_func_t calc_score = determine_calc_score(0.0f, 1.0f);
+    float8 norm = 0.0;
+
+    for(size_t i = 0; i < query_len; i++)
+        norm += calc_score(query_peaks[i], query_peaks[i], query_mzs[i], query_mzs[i], 1.0f, 0.0f);
+
+    return norm;
+}
+
+uint64 library_cache_scan(const LibraryArena *arena, uint64 start, uint64 count, Datum query,
+    const MzBuckets *query_buckets, float4 tolerance, float4 threshold, SearchResult *result)
+{
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    float4 *query_peaks = query_mzs + query_len;
+    float8 query_norm = library_cache_query_norm(query_mzs, query_peaks, query_len);
+    uint64 scored = 0;
+
+    for(uint64 index = start; index < start + count && index < arena->count; index++)
+    {
+        CHECK_FOR_INTERRUPTS();
+
+        if(library_cache_score(arena, index, query_mzs, query_peaks, query_len, query_norm, query_buckets,
+                tolerance, threshold, result))
+            scored++;
+    }
+
+    return scored;
+}
+
+PG_FUNCTION_INFO_V1(library_load);
+Datum library_load(PG_FUNCTION_ARGS)
+{
+    Relation rel = NULL;
+    AttrNumber attnum = InvalidAttrNumber;
+    AttrNumber precursor_attnum = InvalidAttrNumber;
+    uint64 count = 0;
+
+    if(PG_ARGISNULL(0) || PG_ARGISNULL(1))
+        PG_RETURN_NULL();
+
+    rel = search_library_open(PG_GETARG_OID(0), PG_GETARG_NAME(1), &attnum);
+
+    if(!PG_ARGISNULL(2))
+        precursor_attnum = search_precursor_attnum(rel, PG_GETARG_NAME(2));
+
+    count = library_cache_load(rel, attnum, precursor_attnum);
+    table_close(rel, AccessShareLock);
+
+    PG_RETURN_INT64((int64) count);
+}
+
+PG_FUNCTION_INFO_V1(library_unload);
+Datum library_unload(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(library_cache_invalidate_relation(PG_GETARG_OID(0)));
+}
+
+PG_FUNCTION_INFO_V1(library_cache_invalidate);
+Datum library_cache_invalidate(PG_FUNCTION_ARGS)
+{
+    TriggerData *trigdata = (TriggerData*) fcinfo->context;
+    Oid relid = InvalidOid;
+
+    if(!CALLED_AS_TRIGGER(fcinfo))
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+            errmsg("library_cache_invalidate: not called by trigger manager")));
+
+    relid = RelationGetRelid(trigdata->tg_relation);
+    library_cache_invalidate_relation(relid);
+
+    // other sessions drop their mapping when the change is committed
+    CacheInvalidateRelcacheByRelid(relid);
+    library_cache_track(&pending_relids, relid);
+
+    if(TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) && TRIGGER_FIRED_BEFORE(trigdata->tg_event))
+        return PointerGetDatum(TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) ? trigdata->tg_newtuple : trigdata->tg_trigtuple);
+
+    return PointerGetDatum(NULL);
+}
+
+PG_FUNCTION_INFO_V1(library_search_precursor);
+Datum library_search_precursor(PG_FUNCTION_ARGS)
+{
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    float4 precursor = PG_GETARG_FLOAT4(1);
+    float4 precursor_tolerance = PG_GETARG_FLOAT4(2);
+    Oid relid = PG_GETARG_OID(3);
+    Name column = PG_GETARG_NAME(4);
+    float4 tolerance = PG_GETARG_FLOAT4(5);
+    float4 threshold = PG_GETARG_FLOAT4(6);
+    int32 top_k = PG_GETARG_INT32(7);
+    AttrNumber attnum = InvalidAttrNumber;
+    Relation rel = search_library_open(relid, column, &attnum);
+    dsm_handle handle = DSM_HANDLE_INVALID;
+    const LibraryArena *arena = library_cache_lookup(rel, attnum, &handle);
+    const uint64 *order = NULL;
+    const float4 *precursors = NULL;
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    float4 *query_peaks = query_mzs + query_len;
+    float8 query_norm = library_cache_query_norm(query_mzs, query_peaks, query_len);
+    MzBuckets *query_buckets = NULL;
+    uint64 low = 0;
+    uint64 high = 0;
+    SearchResult result;
+
+    if(top_k < 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("top_k must not be negative")));
+
+    if(arena == NULL || arena->precursor_attnum == InvalidAttrNumber)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("library \"%s\" is not loaded with precursor column", RelationGetRelationName(rel)),
+            errhint("Load the library by library_load(library, column, precursor_column).")));
+
+    order = ArenaOrder(arena);
+    precursors = ArenaPrecursors(arena);
+    high = arena->count;
+
+    // lower bound of the precursor window in the sorted order
+    while(low < high)
+    {
+        uint64 middle = low + (high - low) / 2;
+
+        if(float4_lt(precursors[order[middle]], precursor - precursor_tolerance))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    search_result_init(&result, top_k);
+    query_buckets = mz_buckets_build(query_mzs, query_peaks, query_len, tolerance, 0.0f, 1.0f);
+
+    for(uint64 i = low; i < arena->count && float4_le(precursors[order[i]], precursor + precursor_tolerance); i++)
+    {
+        CHECK_FOR_INTERRUPTS();
+        library_cache_score(arena, order[i], query_mzs, query_peaks, query_len, query_norm, query_buckets,
+            tolerance, threshold, &result);
+    }
+
+    mz_buckets_free(query_buckets);
+    table_close(rel, AccessShareLock);
+
+    return search_result_materialize(fcinfo, &result);
+}
+
+PGDLLEXPORT void library_cache_prewarm_main(Datum arg)
+{
+    char *list = NULL;
+    List *entries = NIL;
+    ListCell *lc = NULL;
+
+    BackgroundWorkerUnblockSignals();
+    BackgroundWorkerInitializeConnection(library_prewarm_database, NULL, 0);
+
+    list = pstrdup(library_prewarm);
+    if(!SplitIdentifierString(list, ',', &entries))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("invalid list syntax in parameter \"pgms.library_prewarm\"")));
+
+    foreach(lc, entries)
+    {
+        char *relname = pstrdup((char*) lfirst(lc));
+        char *column = strchr(relname, ':');
+        char *precursor = NULL;
+        RangeVar *rv = NULL;
+        Relation rel = NULL;
+        AttrNumber attnum = InvalidAttrNumber;
+        AttrNumber precursor_attnum = InvalidAttrNumber;
+        NameData name;
+
+        if(column == NULL)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                errmsg("missing spectrum column of \"%s\" in parameter \"pgms.library_prewarm\"", relname)));
+
+        *column++ = '\0';
+        precursor = strchr(column, ':');
+        if(precursor)
+            *precursor++ = '\0';
+
+        SetCurrentStatementStartTimestamp();
+        StartTransactionCommand();
+        PushActiveSnapshot(GetTransactionSnapshot());
+
+        rv = makeRangeVarFromNameList(stringToQualifiedNameList(relname));
+        namestrcpy(&name, column);
+        rel = search_library_open(RangeVarGetRelid(rv, AccessShareLock, false), &name, &attnum);
+
+        if(precursor)
+        {
+            namestrcpy(&name, precursor);
+            precursor_attnum = search_precursor_attnum(rel, &name);
+        }
+
+        elog(LOG, "pgms library prewarm: " UINT64_FORMAT " spectra of \"%s\" loaded",
+            library_cache_load(rel, attnum, precursor_attnum), RelationGetRelationName(rel));
+
+        table_close(rel, AccessShareLock);
+        PopActiveSnapshot();
+        CommitTransactionCommand();
+    }
+
+    proc_exit(0);
+}
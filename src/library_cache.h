@@ -0,0 +1,68 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_CACHE_H_
+#define LIBRARY_CACHE_H_
+
+#include <storage/dsm.h>
+#include <storage/itemptr.h>
+#include <utils/relcache.h>
+
+#include "cosine.h"
+#include "library_search.h"
+
+/*
+ * Library arena is one dynamic shared memory segment holding the spectra of a
+ * library table as structure of arrays. Peaks of the i-th spectrum are
+ * mz[offsets[i]] .. mz[offsets[i + 1] - 1] (intensity alike), order holds
+ * the spectrum indexes sorted by precursor (NaN precursors last).
+ */
+typedef struct LibraryArena
+{
+    uint32          magic;
+    Oid             relid;
+    AttrNumber      attnum;
+    AttrNumber      precursor_attnum;
+    uint64          count;
+    uint64          npeaks;
+    Size            offsets_offset;
+    Size            norms_offset;
+    Size            precursors_offset;
+    Size            order_offset;
+    Size            tids_offset;
+    Size            mz_offset;
+    Size            intensity_offset;
+} LibraryArena;
+
+#define ArenaArray(arena, type, field)  ((const type *) ((const char *) (arena) + (arena)->field))
+#define ArenaOffsets(arena)             ArenaArray((arena), uint64, offsets_offset)
+#define ArenaNorms(arena)               ArenaArray((arena), float8, norms_offset)
+#define ArenaPrecursors(arena)          ArenaArray((arena), float4, precursors_offset)
+#define ArenaOrder(arena)               ArenaArray((arena), uint64, order_offset)
+#define ArenaTids(arena)                ArenaArray((arena), ItemPointerData, tids_offset)
+#define ArenaMz(arena)                  ArenaArray((arena), float4, mz_offset)
+#define ArenaIntensity(arena)           ArenaArray((arena), float4, intensity_offset)
+
+void library_cache_init(void);
+
+const LibraryArena *library_cache_lookup(Relation rel, AttrNumber attnum, dsm_handle *handle);
+const LibraryArena *library_cache_attach(dsm_handle handle);
+
+uint64 library_cache_scan(const LibraryArena *arena, uint64 start, uint64 count, Datum query,
+    const MzBuckets *query_buckets, float4 tolerance, float4 threshold, SearchResult *result);
+
+#endif /* LIBRARY_CACHE_H_ */
@@ -0,0 +1,482 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Packed spectral library
+ *
+ * library_pack() copies the spectra of a library table into a separate chunk
+ * table. Spectra are sorted by precursor and every row of the chunk table
+ * holds up to chunk_size spectra as columnar arrays (ctids, precursors, peak
+ * offsets, m/z and intensities) together with the min/max precursor and
+ * m/z of the chunk. Metadata stays in the library table, the chunks refer
+ * to its rows by ctid.
+ *
+ * Every chunk records the library table and its relfilenode. A trigger on the
+ * library marks the chunks stale on any change, a rewrite of the library
+ * changes its relfilenode. Stale chunk tables are refused by the search, the
+ * ctids may point to other rows.
+ *
+ * library_search_packed() reads only chunks whose zone maps overlap the
+ * precursor window and the m/z range of the query. Peak arrays are stored
+ * uncompressed out of line, so each chunk is streamed sequentially from
+ * TOAST and scored in place.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <miscadmin.h>
+
+#include <access/table.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/regproc.h>
+#include <utils/rel.h>
+
+#include "cosine.h"
+#include "library_search.h"
+#include "progress.h"
+#include "spectrum.h"
+
+#define PACK_COLUMNS    13
+
+static ArrayType *pack_float4_array(const float4 *values, int count)
+{
+    Datum *datums = palloc(Max(count, 1) * sizeof(Datum));
+
+    for(int i = 0; i < count; i++)
+        datums[i] = Float4GetDatum(values[i]);
+
+    return construct_array(datums, count, FLOAT4OID, sizeof(float4), FLOAT4PASSBYVAL, 'i');
+}
+
+static char *pack_relation_name(Relation rel)
+{
+    return quote_qualified_identifier(get_namespace_name(RelationGetNamespace(rel)), RelationGetRelationName(rel));
+}
+
+static void pack_chunk(SPIPlanPtr insert, SPITupleTable *tuptable, uint64 rows, int32 chunk, Oid source, Oid source_node)
+{
+    TupleDesc tupdesc = tuptable->tupdesc;
+    Datum *tids = palloc(rows * sizeof(Datum));
+    float4 *precursors = palloc(rows * sizeof(float4));
+    Datum *offsets = palloc((rows + 1) * sizeof(Datum));
+    float4 *mz = NULL;
+    float4 *intensity = NULL;
+    size_t npeaks = 0;
+    size_t capacity = 1024;
+    float4 min_mz = get_float4_infinity();
+    float4 max_mz = -get_float4_infinity();
+    Datum values[PACK_COLUMNS];
+    char nulls[PACK_COLUMNS];
+    int ret = 0;
+
+    mz = palloc(capacity * sizeof(float4));
+    intensity = palloc(capacity * sizeof(float4));
+    offsets[0] = Int32GetDatum(0);
+
+    for(uint64 i = 0; i < rows; i++)
+    {
+        HeapTuple tuple = tuptable->vals[i];
+        bool isnull = false;
+        Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(SPI_getbinval(tuple, tupdesc, 3, &isnull)));
+        size_t len = spectrum_length(spectrum);
+        float4 *data = spectrum_data(spectrum);
+
+        tids[i] = SPI_getbinval(tuple, tupdesc, 1, &isnull);
+        precursors[i] = DatumGetFloat4(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+
+        while(npeaks + len > capacity)
+        {
+            capacity *= 2;
+            mz = repalloc_huge(mz, capacity * sizeof(float4));
+            intensity = repalloc_huge(intensity, capacity * sizeof(float4));
+        }
+
+        memcpy(mz + npeaks, data, len * sizeof(float4));
+        memcpy(intensity + npeaks, data + len, len * sizeof(float4));
+
+        for(size_t j = 0; j < len; j++)
+        {
+            if(float4_lt(data[j], min_mz))
+                min_mz = data[j];
+
+            if(float4_gt(data[j], max_mz))
+                max_mz = data[j];
+        }
+
+        npeaks += len;
+        offsets[i + 1] = Int32GetDatum((int32) npeaks);
+    }
+
+    if(npeaks > INT_MAX)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("too many peaks in chunk %d", chunk),
+            errhint("Use smaller chunk size.")));
+
+    if(npeaks == 0)
+        min_mz = max_mz = 0.0f;
+
+    memset(nulls, ' ', sizeof(nulls));
+    values[0] = Int32GetDatum(chunk);
+    values[1] = Int32GetDatum((int32) rows);
+    values[2] = Float4GetDatum(precursors[0]);
+    values[3] = Float4GetDatum(precursors[rows - 1]);
+    values[4] = Float4GetDatum(min_mz);
+    values[5] = Float4GetDatum(max_mz);
+    values[6] = PointerGetDatum(construct_array(tids, rows, TIDOID, sizeof(ItemPointerData), false, 's'));
+    values[7] = PointerGetDatum(pack_float4_array(precursors, rows));
+    values[8] = PointerGetDatum(construct_array(offsets, rows + 1, INT4OID, sizeof(int32), true, 'i'));
+    values[9] = PointerGetDatum(pack_float4_array(mz, npeaks));
+    values[10] = PointerGetDatum(pack_float4_array(intensity, npeaks));
+    values[11] = ObjectIdGetDatum(source);
+    values[12] = ObjectIdGetDatum(source_node);
+
+    ret = SPI_execute_plan(insert, values, nulls, false, 0);
+    if(ret != SPI_OK_INSERT)
+        elog(ERROR, "library pack: insert of chunk %d failed: %s", chunk, SPI_result_code_string(ret));
+
+    elog(DEBUG1, "library pack: chunk %d with " UINT64_FORMAT " spectra and %zu peaks", chunk, rows, npeaks);
+}
+
+/*
+ * Chunks are stale when the trigger marked them on a change of the library,
+ * or when the library was rewritten by VACUUM FULL or CLUSTER, which do not
+ * fire triggers. The library stays locked against rewrites until the end of
+ * the transaction.
+ */
+static void pack_check_source(const char *packed_name)
+{
+    Oid source = InvalidOid;
+    Oid source_node = InvalidOid;
+    bool stale = false;
+    bool isnull = false;
+    Relation rel = NULL;
+
+    if(SPI_execute(psprintf("SELECT source, source_node, stale FROM %s LIMIT 1", packed_name), true, 1) != SPI_OK_SELECT)
+        elog(ERROR, "library search packed: could not read table %s", packed_name);
+
+    if(SPI_processed == 0)
+        return;
+
+    source = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+    source_node = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+    stale = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+    SPI_freetuptable(SPI_tuptable);
+
+    rel = try_table_open(source, AccessShareLock);
+
+    if(stale || rel == NULL || rel->rd_node.relNode != source_node)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("packed library %s is stale", packed_name),
+            errdetail(rel == NULL ? "Library was dropped." : stale ? "Library was changed after it was packed."
+                : "Library was rewritten after it was packed."),
+            errhint("Pack the library again by library_pack().")));
+
+    table_close(rel, NoLock);
+}
+
+PG_FUNCTION_INFO_V1(library_pack);
+Datum library_pack(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    Name spectrum_column = PG_GETARG_NAME(1);
+    Name precursor_column = PG_GETARG_NAME(2);
+    text *target = PG_GETARG_TEXT_PP(3);
+    int32 chunk_size = PG_GETARG_INT32(4);
+    RangeVar *rv = makeRangeVarFromNameList(stringToQualifiedNameList(text_to_cstring(target)));
+    char *target_name = quote_qualified_identifier(rv->schemaname, rv->relname);
+    MemoryContext context = NULL;
+    AttrNumber attnum = InvalidAttrNumber;
+    Relation rel = NULL;
+    char *source_name = NULL;
+    Oid source_node = InvalidOid;
+    Oid packed_relid = InvalidOid;
+    Oid argtypes[PACK_COLUMNS] = {INT4OID, INT4OID, FLOAT4OID, FLOAT4OID, FLOAT4OID, FLOAT4OID,
+        TIDARRAYOID, FLOAT4ARRAYOID, INT4ARRAYOID, FLOAT4ARRAYOID, FLOAT4ARRAYOID, OIDOID, OIDOID};
+    SPIPlanPtr select = NULL;
+    SPIPlanPtr insert = NULL;
+    Portal portal = NULL;
+    int32 chunk = 0;
+    uint64 packed = 0;
+
+    if(chunk_size <= 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("chunk size must be positive")));
+
+    rel = search_library_open(relid, spectrum_column, &attnum);
+    search_precursor_attnum(rel, precursor_column);
+    source_name = pack_relation_name(rel);
+
+    if(rel->rd_rel->relkind != RELKIND_RELATION)
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+            errmsg("\"%s\" is not a table", RelationGetRelationName(rel)),
+            errdetail("Packed library is kept up to date by a trigger on the library table.")));
+
+    SPI_connect();
+
+    if(SPI_execute(psprintf("CREATE TABLE %s (chunk integer PRIMARY KEY, count integer NOT NULL, "
+            "min_precursor float4 NOT NULL, max_precursor float4 NOT NULL, min_mz float4 NOT NULL, max_mz float4 NOT NULL, "
+            "tids tid[] NOT NULL, precursors float4[] NOT NULL, offsets integer[] NOT NULL, "
+            "mz float4[] NOT NULL, intensity float4[] NOT NULL, "
+            "source regclass NOT NULL, source_node oid NOT NULL, stale boolean NOT NULL DEFAULT false)", target_name), false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "library pack: could not create table %s", target_name);
+
+    // float arrays hardly compress, uncompressed values are read sequentially
+    if(SPI_execute(psprintf("ALTER TABLE %s ALTER COLUMN mz SET STORAGE EXTERNAL, "
+            "ALTER COLUMN intensity SET STORAGE EXTERNAL", target_name), false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "library pack: could not set storage of table %s", target_name);
+
+    if(SPI_execute(psprintf("CREATE INDEX ON %s (min_precursor, max_precursor)", target_name), false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "library pack: could not create index of table %s", target_name);
+
+    // ctids of the library are valid until it is changed or rewritten
+    packed_relid = RangeVarGetRelid(rv, NoLock, false);
+    source_node = rel->rd_node.relNode;
+
+    if(SPI_execute(psprintf("CREATE TRIGGER %s AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON %s "
+            "FOR EACH STATEMENT EXECUTE FUNCTION %s.library_pack_invalidate('%u')",
+            quote_identifier(psprintf("library_pack_%u", packed_relid)), source_name,
+            quote_identifier(get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid))), packed_relid), false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "library pack: could not create trigger on %s", source_name);
+
+    insert = SPI_prepare(psprintf("INSERT INTO %s VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13)", target_name),
+        PACK_COLUMNS, argtypes);
+    select = SPI_prepare(psprintf("SELECT ctid, %s::float4, %s FROM %s WHERE %s IS NOT NULL AND %s IS NOT NULL ORDER BY 2",
+        quote_identifier(NameStr(*precursor_column)), quote_identifier(NameStr(*spectrum_column)), source_name,
+        quote_identifier(NameStr(*precursor_column)), quote_identifier(NameStr(*spectrum_column))), 0, NULL);
+
+    if(insert == NULL || select == NULL)
+        elog(ERROR, "library pack: %s", SPI_result_code_string(SPI_result));
+
+    portal = SPI_cursor_open(NULL, select, NULL, NULL, true);
+    context = AllocSetContextCreate(CurrentMemoryContext, "pgms library pack", ALLOCSET_DEFAULT_SIZES);
+
+    while(true)
+    {
+        MemoryContext oldcontext = NULL;
+
+        CHECK_FOR_INTERRUPTS();
+
+        SPI_cursor_fetch(portal, true, chunk_size);
+        if(SPI_processed == 0)
+            break;
+
+        oldcontext = MemoryContextSwitchTo(context);
+        pack_chunk(insert, SPI_tuptable, SPI_processed, chunk++, relid, source_node);
+        packed += SPI_processed;
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(context);
+
+        SPI_freetuptable(SPI_tuptable);
+    }
+
+    SPI_cursor_close(portal);
+    MemoryContextDelete(context);
+    SPI_finish();
+    table_close(rel, AccessShareLock);
+
+    PG_RETURN_INT64((int64) packed);
+}
+
+PG_FUNCTION_INFO_V1(library_pack_invalidate);
+Datum library_pack_invalidate(PG_FUNCTION_ARGS)
+{
+    TriggerData *trigdata = (TriggerData*) fcinfo->context;
+    Oid packed = InvalidOid;
+    char *packed_name = NULL;
+
+    if(!CALLED_AS_TRIGGER(fcinfo))
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+            errmsg("library_pack_invalidate: not called by trigger manager")));
+
+    if(trigdata->tg_trigger->tgnargs != 1)
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+            errmsg("library_pack_invalidate: chunk table argument expected")));
+
+    packed = atooid(trigdata->tg_trigger->tgargs[0]);
+    packed_name = get_rel_name(packed);
+
+    // dropped chunk table leaves the trigger behind
+    if(packed_name == NULL)
+        return PointerGetDatum(NULL);
+
+    SPI_connect();
+
+    if(SPI_execute(psprintf("UPDATE %s SET stale = true WHERE source = '%u'::regclass AND NOT stale",
+            quote_qualified_identifier(get_namespace_name(get_rel_namespace(packed)), packed_name),
+            RelationGetRelid(trigdata->tg_relation)), false, 0) != SPI_OK_UPDATE)
+        elog(ERROR, "library pack: could not mark table %s stale", packed_name);
+
+    SPI_finish();
+
+    return PointerGetDatum(NULL);
+}
+
+PG_FUNCTION_INFO_V1(library_search_packed);
+Datum library_search_packed(PG_FUNCTION_ARGS)
+{
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Oid relid = PG_GETARG_OID(1);
+    float4 precursor = PG_GETARG_FLOAT4(2);
+    float4 precursor_tolerance = PG_GETARG_FLOAT4(3);
+    float4 tolerance = PG_GETARG_FLOAT4(4);
+    float4 threshold = PG_GETARG_FLOAT4(5);
+    int32 top_k = PG_GETARG_INT32(6);
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    float4 *query_peaks = query_mzs + query_len;
+    Oid argtypes[4] = {FLOAT4OID, FLOAT4OID, FLOAT4OID, FLOAT4OID};
+    Datum values[4];
+    MemoryContext context = NULL;
+    SPIPlanPtr plan = NULL;
+    Portal portal = NULL;
+    Relation rel = NULL;
+    char *packed_name = NULL;
+    uint64 chunks = 0;
+    uint64 scanned = 0;
+    uint64 scored = 0;
+    uint64 pruned = 0;
+    bool progressing = false;
+    MzBuckets *query_buckets = NULL;
+    SearchResult result;
+
+    if(top_k < 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("top_k must not be negative")));
+
+    // result is allocated outside of SPI memory
+    search_result_init(&result, top_k);
+
+    if(query_len == 0)
+        return search_result_materialize(fcinfo, &result);
+
+    rel = table_open(relid, AccessShareLock);
+    packed_name = pack_relation_name(rel);
+    table_close(rel, AccessShareLock);
+
+    values[0] = Float4GetDatum(precursor - precursor_tolerance);
+    values[1] = Float4GetDatum(precursor + precursor_tolerance);
+    values[2] = Float4GetDatum(query_mzs[0] - tolerance);
+    values[3] = Float4GetDatum(query_mzs[query_len - 1] + tolerance);
+
+    // query buckets live outside of SPI memory for the whole scan
+    query_buckets = mz_buckets_build(query_mzs, query_peaks, query_len, tolerance, 0.0f, 1.0f);
+
+    progressing = progress_start(PROGRESS_PGMS_COMMAND_SEARCH, relid);
+    SPI_connect();
+
+    plan = SPI_prepare(psprintf("SELECT count, precursors, tids, offsets, mz, intensity FROM %s "
+        "WHERE max_precursor >= $1 AND min_precursor <= $2 AND max_mz >= $3 AND min_mz <= $4 ORDER BY chunk",
+        packed_name), 4, argtypes);
+
+    if(plan == NULL)
+        elog(ERROR, "library search packed: %s", SPI_result_code_string(SPI_result));
+
+    pack_check_source(packed_name);
+
+    portal = SPI_cursor_open(NULL, plan, values, NULL, true);
+    context = AllocSetContextCreate(CurrentMemoryContext, "pgms library search packed", ALLOCSET_DEFAULT_SIZES);
+
+    while(true)
+    {
+        MemoryContext oldcontext = NULL;
+        HeapTuple tuple = NULL;
+        TupleDesc tupdesc = NULL;
+        bool isnull = false;
+        int32 count = 0;
+        float4 *precursors = NULL;
+        ItemPointer tids = NULL;
+        int32 *offsets = NULL;
+        float4 *mz = NULL;
+        float4 *intensity = NULL;
+
+        CHECK_FOR_INTERRUPTS();
+
+        SPI_cursor_fetch(portal, true, 1);
+        if(SPI_processed == 0)
+            break;
+
+        tuple = SPI_tuptable->vals[0];
+        tupdesc = SPI_tuptable->tupdesc;
+        oldcontext = MemoryContextSwitchTo(context);
+
+        count = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+        precursors = (float4*) ARR_DATA_PTR(DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 2, &isnull)));
+        tids = (ItemPointer) ARR_DATA_PTR(DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 3, &isnull)));
+        offsets = (int32*) ARR_DATA_PTR(DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 4, &isnull)));
+        mz = (float4*) ARR_DATA_PTR(DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 5, &isnull)));
+        intensity = (float4*) ARR_DATA_PTR(DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 6, &isnull)));
+        chunks++;
+
+        for(int32 i = 0; i < count; i++)
+        {
+            size_t len = offsets[i + 1] - offsets[i];
+            float4 cutoff = search_result_cutoff(&result, threshold);
+            float4 score = 0.0f;
+
+            // spectra are sorted by precursor within the chunk as well
+            if(float4_lt(precursors[i], precursor - precursor_tolerance))
+                continue;
+
+            if(float4_gt(precursors[i], precursor + precursor_tolerance))
+                break;
+
+            if(float4_gt(cutoff, 0.0f)
+                && float4_lt(cosine_upper_bound_peaks(mz + offsets[i], intensity + offsets[i], len, -1.0,
+                    query_mzs, query_peaks, query_len, -1.0, query_buckets, tolerance, 0.0f, 1.0f), cutoff))
+            {
+                pruned++;
+                continue;
+            }
+
+            score = cosine_greedy_calc(mz + offsets[i], intensity + offsets[i], len,
+                query_mzs, query_peaks, query_len, query_buckets, tolerance, 0.0f, 1.0f);
+            scored++;
+
+            if(float4_ge(score, threshold) && float4_gt(score, 0.0f))
+                search_result_add(&result, &tids[i], score);
+        }
+
+        scanned += count;
+        progress_update(PROGRESS_PGMS_ROWS_SCANNED, (int64) scanned);
+        progress_update(PROGRESS_PGMS_ROWS_SCORED, (int64) scored);
+
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(context);
+        SPI_freetuptable(SPI_tuptable);
+    }
+
+    elog(DEBUG1, "library search packed: " UINT64_FORMAT " chunks read, " UINT64_FORMAT " spectra pruned", chunks, pruned);
+
+    SPI_cursor_close(portal);
+    MemoryContextDelete(context);
+    SPI_finish();
+    mz_buckets_free(query_buckets);
+
+    if(progressing)
+        progress_end();
+
+    return search_result_materialize(fcinfo, &result);
+}
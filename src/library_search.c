@@ -0,0 +1,683 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parallel library search
+ *
+ * library_search() scores a single query spectrum against every spectrum of
+ * a library table. The heap blocks (or spectra of the library arena, when the
+ * library is loaded into shared memory) are split into one range per
+ * participant (parallel workers and the leader) kept in dynamic shared memory. Every
+ * participant takes chunks from the front of its own range and, once it is
+ * exhausted, steals the back half of the largest remaining range of another
+ * participant. Each participant keeps its own top-K heap (or list of
+ * threshold hits), workers send it to the leader through a shm_mq and the
+ * leader merges them.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+
+#include <access/heapam.h>
+#include <access/htup_details.h>
+#include <access/parallel.h>
+#include <access/relation.h>
+#include <access/table.h>
+#include <catalog/pg_am.h>
+#include <catalog/pg_type.h>
+#include <port/atomics.h>
+#include <storage/bufmgr.h>
+#include <storage/proc.h>
+#include <storage/shm_mq.h>
+#include <storage/shm_toc.h>
+#include <storage/spin.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/snapmgr.h>
+#include <utils/tuplestore.h>
+
+#include "cosine.h"
+#include "library_cache.h"
+#include "library_search.h"
+#include "progress.h"
+#include "spectrum.h"
+
+#define LIBRARY_SEARCH_KEY_SHARED   UINT64CONST(0xB1B1000000000001)
+#define LIBRARY_SEARCH_KEY_QUERY    UINT64CONST(0xB1B1000000000002)
+#define LIBRARY_SEARCH_KEY_QUEUE    UINT64CONST(0xB1B1000000000003)
+
+#define LIBRARY_SEARCH_QUEUE_SIZE   65536
+#define LIBRARY_SEARCH_BATCH        1024
+#define LIBRARY_SEARCH_MAX_CHUNK    64
+#define LIBRARY_SEARCH_ARENA_CHUNK  4096
+
+#if PG_VERSION_NUM >= 150000
+    #define ShmMqSend(mqh, nbytes, data)    shm_mq_send((mqh), (nbytes), (data), false, true)
+#else
+    #define ShmMqSend(mqh, nbytes, data)    shm_mq_send((mqh), (nbytes), (data), false)
+#endif
+
+// range of heap blocks or arena spectra
+typedef struct SearchRange
+{
+    slock_t         mutex;
+    uint64          next;
+    uint64          end;
+} SearchRange;
+
+typedef struct SearchShared
+{
+    Oid             relid;
+    AttrNumber      attnum;
+    dsm_handle      arena;
+    float4          tolerance;
+    float4          threshold;
+    int             top_k;
+    uint64          chunk;
+    pg_atomic_uint64 scanned;
+    pg_atomic_uint64 scored;
+    int             nparticipants;
+    SearchRange     ranges[FLEXIBLE_ARRAY_MEMBER];
+} SearchShared;
+
+static Size search_shared_size(int nparticipants)
+{
+    return add_size(offsetof(SearchShared, ranges), mul_size(nparticipants, sizeof(SearchRange)));
+}
+
+static void search_shared_init(SearchShared *shared, Relation rel, AttrNumber attnum, const LibraryArena *arena,
+    dsm_handle handle, float4 tolerance, float4 threshold, int top_k, int nparticipants)
+{
+    uint64 nunits = arena ? arena->count : RelationGetNumberOfBlocks(rel);
+    uint64 max_chunk = arena ? LIBRARY_SEARCH_ARENA_CHUNK : LIBRARY_SEARCH_MAX_CHUNK;
+    uint64 start = 0;
+
+    shared->relid = RelationGetRelid(rel);
+    shared->attnum = attnum;
+    shared->arena = arena ? handle : DSM_HANDLE_INVALID;
+    shared->tolerance = tolerance;
+    shared->threshold = threshold;
+    shared->top_k = top_k;
+    shared->nparticipants = nparticipants;
+    shared->chunk = Max(1, Min(max_chunk, nunits / (nparticipants * 16)));
+    pg_atomic_init_u64(&shared->scanned, 0);
+    pg_atomic_init_u64(&shared->scored, 0);
+
+    for(int i = 0; i < nparticipants; i++)
+    {
+        uint64 end = (nunits * (i + 1)) / nparticipants;
+
+        SpinLockInit(&shared->ranges[i].mutex);
+        shared->ranges[i].next = start;
+        shared->ranges[i].end = end;
+        start = end;
+    }
+
+    elog(DEBUG1, "library search: " UINT64_FORMAT " %s, %d participants, chunk " UINT64_FORMAT,
+        nunits, arena ? "spectra" : "blocks", nparticipants, shared->chunk);
+}
+
+// counters of all participants, the leader reports them
+static void search_progress(SearchShared *shared, uint64 scanned, uint64 scored)
+{
+    scanned = pg_atomic_add_fetch_u64(&shared->scanned, scanned);
+    scored = pg_atomic_add_fetch_u64(&shared->scored, scored);
+
+    if(!IsParallelWorker())
+    {
+        progress_update(PROGRESS_PGMS_ROWS_SCANNED, (int64) scanned);
+        progress_update(PROGRESS_PGMS_ROWS_SCORED, (int64) scored);
+    }
+}
+
+static bool search_take_chunk(SearchShared *shared, int participant, uint64 *start, uint64 *count)
+{
+    SearchRange *own = &shared->ranges[participant];
+
+    while(true)
+    {
+        int victim = -1;
+        uint64 most = 0;
+        uint64 steal = 0;
+        uint64 stolen = 0;
+
+        SpinLockAcquire(&own->mutex);
+        if(own->next < own->end)
+        {
+            *start = own->next;
+            *count = Min(shared->chunk, own->end - own->next);
+            own->next += *count;
+            SpinLockRelease(&own->mutex);
+            return true;
+        }
+        SpinLockRelease(&own->mutex);
+
+        // own range is exhausted, steal from the participant with most work left
+        for(int i = 0; i < shared->nparticipants; i++)
+        {
+            SearchRange *range = &shared->ranges[i];
+            uint64 remaining = 0;
+
+            if(i == participant)
+                continue;
+
+            SpinLockAcquire(&range->mutex);
+            remaining = range->end - range->next;
+            SpinLockRelease(&range->mutex);
+
+            if(remaining > most)
+            {
+                most = remaining;
+                victim = i;
+            }
+        }
+
+        if(victim < 0)
+            return false;
+
+        SpinLockAcquire(&shared->ranges[victim].mutex);
+        most = shared->ranges[victim].end - shared->ranges[victim].next;
+        steal = most > shared->chunk ? most / 2 : most;
+        shared->ranges[victim].end -= steal;
+        stolen = shared->ranges[victim].end;
+        SpinLockRelease(&shared->ranges[victim].mutex);
+
+        if(steal > 0)
+        {
+            SpinLockAcquire(&own->mutex);
+            own->next = stolen;
+            own->end = stolen + steal;
+            SpinLockRelease(&own->mutex);
+            elog(DEBUG1, "library search: participant %d stole " UINT64_FORMAT " from %d", participant, steal, victim);
+        }
+    }
+}
+
+void search_result_init(SearchResult *result, int top_k)
+{
+    result->top_k = top_k;
+    result->count = 0;
+    result->capacity = top_k > 0 ? top_k : LIBRARY_SEARCH_BATCH;
+    result->hits = palloc(result->capacity * sizeof(SearchHit));
+}
+
+static void search_heap_down(SearchHit *hits, int count, int index)
+{
+    while(true)
+    {
+        int lowest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        SearchHit hit;
+
+        if(left < count && hits[left].score < hits[lowest].score)
+            lowest = left;
+
+        if(right < count && hits[right].score < hits[lowest].score)
+            lowest = right;
+
+        if(lowest == index)
+            break;
+
+        hit = hits[index];
+        hits[index] = hits[lowest];
+        hits[lowest] = hit;
+        index = lowest;
+    }
+}
+
+void search_result_add(SearchResult *result, ItemPointer tid, float4 score)
+{
+    if(result->top_k > 0)
+    {
+        // min-heap on score, the root is the worst hit kept
+        if(result->count < result->top_k)
+        {
+            int index = result->count++;
+
+            result->hits[index].tid = *tid;
+            result->hits[index].score = score;
+
+            while(index > 0 && result->hits[(index - 1) / 2].score > result->hits[index].score)
+            {
+                SearchHit hit = result->hits[index];
+                result->hits[index] = result->hits[(index - 1) / 2];
+                result->hits[(index - 1) / 2] = hit;
+                index = (index - 1) / 2;
+            }
+        }
+        else if(score > result->hits[0].score)
+        {
+            result->hits[0].tid = *tid;
+            result->hits[0].score = score;
+            search_heap_down(result->hits, result->count, 0);
+        }
+
+        return;
+    }
+
+    if(result->count == result->capacity)
+    {
+        result->capacity *= 2;
+        result->hits = repalloc_huge(result->hits, result->capacity * sizeof(SearchHit));
+    }
+
+    result->hits[result->count].tid = *tid;
+    result->hits[result->count].score = score;
+    result->count++;
+}
+
+float4 search_result_cutoff(SearchResult *result, float4 threshold)
+{
+    if(result->top_k > 0 && result->count == result->top_k && result->hits[0].score > threshold)
+        return result->hits[0].score;
+
+    return threshold;
+}
+
+static int search_hit_cmp(const void *a, const void *b)
+{
+    const SearchHit *ha = (const SearchHit*) a;
+    const SearchHit *hb = (const SearchHit*) b;
+
+    if(ha->score != hb->score)
+        return ha->score > hb->score ? -1 : 1;
+
+    return ItemPointerCompare((ItemPointer) &ha->tid, (ItemPointer) &hb->tid);
+}
+
+void search_result_sort(SearchResult *result)
+{
+    if(result->count > 1)
+        qsort(result->hits, result->count, sizeof(SearchHit), search_hit_cmp);
+}
+
+static void library_search_scan_heap(SearchShared *shared, int participant, Datum query,
+    const MzBuckets *query_buckets, SearchResult *result)
+{
+    Relation rel = table_open(shared->relid, AccessShareLock);
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    Snapshot snapshot = GetActiveSnapshot();
+    BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+    MemoryContext context = AllocSetContextCreate(CurrentMemoryContext, "pgms library search", ALLOCSET_DEFAULT_SIZES);
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    float4 *query_peaks = query_mzs + query_len;
+    OffsetNumber visible[MaxHeapTuplesPerPage];
+    uint64 start = 0;
+    uint64 count = 0;
+    uint64 scored = 0;
+    uint64 pruned = 0;
+    uint64 reported = 0;
+
+    while(search_take_chunk(shared, participant, &start, &count))
+    {
+        for(BlockNumber block = start; block < start + count; block++)
+        {
+            Buffer buffer = InvalidBuffer;
+            Page page = NULL;
+            OffsetNumber lines = 0;
+            int nvisible = 0;
+            bool all_visible = false;
+
+            CHECK_FOR_INTERRUPTS();
+
+            buffer = ReadBufferExtended(rel, MAIN_FORKNUM, block, RBM_NORMAL, strategy);
+            LockBuffer(buffer, BUFFER_LOCK_SHARE);
+
+            page = BufferGetPage(buffer);
+            lines = PageGetMaxOffsetNumber(page);
+            all_visible = PageIsAllVisible(page) && !snapshot->takenDuringRecovery;
+
+            for(OffsetNumber offset = FirstOffsetNumber; offset <= lines; offset++)
+            {
+                ItemId item = PageGetItemId(page, offset);
+                HeapTupleData tuple;
+
+                if(!ItemIdIsNormal(item))
+                    continue;
+
+                tuple.t_data = (HeapTupleHeader) PageGetItem(page, item);
+                tuple.t_len = ItemIdGetLength(item);
+                tuple.t_tableOid = shared->relid;
+                ItemPointerSet(&tuple.t_self, block, offset);
+
+                if(all_visible || HeapTupleSatisfiesVisibility(&tuple, snapshot, buffer))
+                    visible[nvisible++] = offset;
+            }
+
+            // tuples stay valid while the buffer is pinned
+            LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+            for(int i = 0; i < nvisible; i++)
+            {
+                ItemId item = PageGetItemId(page, visible[i]);
+                MemoryContext oldcontext = NULL;
+                HeapTupleData tuple;
+                Datum value;
+                bool isnull = false;
+                size_t len = 0;
+                float4 *mzs = NULL;
+                float4 score = 0.0f;
+                float4 cutoff = search_result_cutoff(result, shared->threshold);
+
+                tuple.t_data = (HeapTupleHeader) PageGetItem(page, item);
+                tuple.t_len = ItemIdGetLength(item);
+                tuple.t_tableOid = shared->relid;
+                ItemPointerSet(&tuple.t_self, block, visible[i]);
+
+                value = heap_getattr(&tuple, shared->attnum, tupdesc, &isnull);
+                if(isnull)
+                    continue;
+
+                oldcontext = MemoryContextSwitchTo(context);
+                value = PointerGetDatum(PG_DETOAST_DATUM(value));
+
+                len = spectrum_length(value);
+                mzs = spectrum_data(value);
+
+                if(float4_gt(cutoff, 0.0f)
+                    && float4_lt(cosine_upper_bound_peaks(mzs, mzs + len, len, -1.0, query_mzs, query_peaks, query_len,
+                        -1.0, query_buckets, shared->tolerance, 0.0f, 1.0f), cutoff))
+                {
+                    pruned++;
+                }
+                else
+                {
+                    score = cosine_greedy_calc(mzs, mzs + len, len, query_mzs, query_peaks, query_len,
+                        query_buckets, shared->tolerance, 0.0f, 1.0f);
+                    scored++;
+                }
+
+                MemoryContextSwitchTo(oldcontext);
+                MemoryContextReset(context);
+
+                if(float4_ge(score, shared->threshold) && float4_gt(score, 0.0f))
+                    search_result_add(result, &tuple.t_self, score);
+            }
+
+            ReleaseBuffer(buffer);
+            search_progress(shared, nvisible, scored - reported);
+            reported = scored;
+        }
+    }
+
+    elog(DEBUG1, "library search: participant %d scored " UINT64_FORMAT ", pruned " UINT64_FORMAT, participant, scored, pruned);
+
+    FreeAccessStrategy(strategy);
+    MemoryContextDelete(context);
+    table_close(rel, AccessShareLock);
+}
+
+static void library_search_scan(SearchShared *shared, int participant, Datum query, const LibraryArena *arena,
+    SearchResult *result)
+{
+    size_t query_len = spectrum_length(query);
+    float4 *query_mzs = spectrum_data(query);
+    MzBuckets *query_buckets = mz_buckets_build(query_mzs, query_mzs + query_len, query_len, shared->tolerance, 0.0f, 1.0f);
+    uint64 start = 0;
+    uint64 count = 0;
+
+    if(!arena)
+        library_search_scan_heap(shared, participant, query, query_buckets, result);
+
+    while(arena && search_take_chunk(shared, participant, &start, &count))
+    {
+        uint64 scored = library_cache_scan(arena, start, count, query, query_buckets, shared->tolerance,
+            shared->threshold, result);
+
+        search_progress(shared, count, scored);
+    }
+
+    mz_buckets_free(query_buckets);
+}
+
+PGDLLEXPORT void library_search_worker(dsm_segment *seg, shm_toc *toc)
+{
+    SearchShared *shared = (SearchShared*) shm_toc_lookup(toc, LIBRARY_SEARCH_KEY_SHARED, false);
+    Datum query = PointerGetDatum(shm_toc_lookup(toc, LIBRARY_SEARCH_KEY_QUERY, false));
+    char *queues = (char*) shm_toc_lookup(toc, LIBRARY_SEARCH_KEY_QUEUE, false);
+    shm_mq *mq = (shm_mq*) (queues + ParallelWorkerNumber * LIBRARY_SEARCH_QUEUE_SIZE);
+    shm_mq_handle *mqh = NULL;
+    const LibraryArena *arena = NULL;
+    SearchResult result;
+
+    shm_mq_set_sender(mq, MyProc);
+    mqh = shm_mq_attach(mq, seg, NULL);
+
+    // the leader keeps the arena attached until all workers finish
+    if(shared->arena != DSM_HANDLE_INVALID)
+        arena = library_cache_attach(shared->arena);
+
+    search_result_init(&result, shared->top_k);
+    library_search_scan(shared, ParallelWorkerNumber, query, arena, &result);
+
+    for(int i = 0; i < result.count; i += LIBRARY_SEARCH_BATCH)
+    {
+        int batch = Min(LIBRARY_SEARCH_BATCH, result.count - i);
+
+        if(ShmMqSend(mqh, batch * sizeof(SearchHit), &result.hits[i]) != SHM_MQ_SUCCESS)
+            break;
+    }
+
+    shm_mq_detach(mqh);
+}
+
+static void library_search_parallel(Relation rel, AttrNumber attnum, const LibraryArena *arena, dsm_handle handle,
+    Datum query, float4 tolerance, float4 threshold, int top_k, int nworkers, SearchResult *result)
+{
+    ParallelContext *pcxt = NULL;
+    SearchShared *shared = NULL;
+    char *query_copy = NULL;
+    char *queues = NULL;
+    shm_mq_handle **mqh = NULL;
+    Size query_size = VARSIZE_ANY(DatumGetPointer(query));
+
+    EnterParallelMode();
+    pcxt = CreateParallelContext("pgms", "library_search_worker", nworkers);
+
+    shm_toc_estimate_chunk(&pcxt->estimator, search_shared_size(nworkers + 1));
+    shm_toc_estimate_chunk(&pcxt->estimator, query_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, mul_size(LIBRARY_SEARCH_QUEUE_SIZE, nworkers));
+    shm_toc_estimate_keys(&pcxt->estimator, 3);
+
+    InitializeParallelDSM(pcxt);
+
+    // the leader takes the last range
+    shared = (SearchShared*) shm_toc_allocate(pcxt->toc, search_shared_size(nworkers + 1));
+    search_shared_init(shared, rel, attnum, arena, handle, tolerance, threshold, top_k, nworkers + 1);
+    shm_toc_insert(pcxt->toc, LIBRARY_SEARCH_KEY_SHARED, shared);
+
+    query_copy = (char*) shm_toc_allocate(pcxt->toc, query_size);
+    memcpy(query_copy, DatumGetPointer(query), query_size);
+    shm_toc_insert(pcxt->toc, LIBRARY_SEARCH_KEY_QUERY, query_copy);
+
+    queues = (char*) shm_toc_allocate(pcxt->toc, mul_size(LIBRARY_SEARCH_QUEUE_SIZE, nworkers));
+    for(int i = 0; i < nworkers; i++)
+    {
+        shm_mq *mq = shm_mq_create(queues + i * LIBRARY_SEARCH_QUEUE_SIZE, LIBRARY_SEARCH_QUEUE_SIZE);
+        shm_mq_set_receiver(mq, MyProc);
+    }
+    shm_toc_insert(pcxt->toc, LIBRARY_SEARCH_KEY_QUEUE, queues);
+
+    LaunchParallelWorkers(pcxt);
+    elog(DEBUG1, "library search: %d of %d workers launched", pcxt->nworkers_launched, nworkers);
+
+    mqh = palloc0(Max(1, pcxt->nworkers_launched) * sizeof(shm_mq_handle*));
+    for(int i = 0; i < pcxt->nworkers_launched; i++)
+        mqh[i] = shm_mq_attach((shm_mq*) (queues + i * LIBRARY_SEARCH_QUEUE_SIZE), pcxt->seg, pcxt->worker[i].bgwhandle);
+
+    // ranges of workers which were not launched are stolen by the others
+    library_search_scan(shared, nworkers, query, arena, result);
+
+    for(int i = 0; i < pcxt->nworkers_launched; i++)
+    {
+        while(true)
+        {
+            Size nbytes = 0;
+            void *data = NULL;
+            SearchHit *hits = NULL;
+
+            if(shm_mq_receive(mqh[i], &nbytes, &data, false) != SHM_MQ_SUCCESS)
+                break;
+
+            hits = (SearchHit*) data;
+            for(Size j = 0; j < nbytes / sizeof(SearchHit); j++)
+                search_result_add(result, &hits[j].tid, hits[j].score);
+        }
+    }
+
+    // rethrows errors of workers
+    WaitForParallelWorkersToFinish(pcxt);
+
+    for(int i = 0; i < pcxt->nworkers_launched; i++)
+        shm_mq_detach(mqh[i]);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+}
+
+Relation search_library_open(Oid relid, Name column, AttrNumber *attnum)
+{
+    AclResult aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+    Relation rel = NULL;
+
+    if(aclresult != ACLCHECK_OK)
+        aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(relid));
+
+    rel = table_open(relid, AccessShareLock);
+
+    if(rel->rd_rel->relkind != RELKIND_RELATION && rel->rd_rel->relkind != RELKIND_MATVIEW)
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+            errmsg("\"%s\" is not a table or materialized view", RelationGetRelationName(rel))));
+
+    if(rel->rd_rel->relam != HEAP_TABLE_AM_OID)
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("only heap tables can be searched")));
+
+    *attnum = get_attnum(relid, NameStr(*column));
+    if(*attnum == InvalidAttrNumber || !is_spectrum_type(get_atttype(relid, *attnum)))
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+            errmsg("column \"%s\" of type spectrum does not exist", NameStr(*column))));
+
+    return rel;
+}
+
+AttrNumber search_precursor_attnum(Relation rel, Name column)
+{
+    AttrNumber attnum = get_attnum(RelationGetRelid(rel), NameStr(*column));
+    Oid type = attnum != InvalidAttrNumber ? get_atttype(RelationGetRelid(rel), attnum) : InvalidOid;
+
+    if(type != FLOAT4OID && type != FLOAT8OID)
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+            errmsg("column \"%s\" of type real or double precision does not exist", NameStr(*column))));
+
+    return attnum;
+}
+
+Datum search_result_materialize(FunctionCallInfo fcinfo, SearchResult *result)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo*) fcinfo->resultinfo;
+    TupleDesc tupdesc = NULL;
+    Tuplestorestate *tupstore = NULL;
+    MemoryContext oldcontext = NULL;
+
+    if(rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("set-valued function called in context that cannot accept a set")));
+
+    if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    search_result_sort(result);
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+
+    for(int i = 0; i < result->count; i++)
+    {
+        Datum values[2];
+        bool nulls[2] = {false, false};
+
+        values[0] = PointerGetDatum(&result->hits[i].tid);
+        values[1] = Float4GetDatum(result->hits[i].score);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(library_search);
+Datum library_search(PG_FUNCTION_ARGS)
+{
+    Datum query = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    Oid relid = PG_GETARG_OID(1);
+    Name column = PG_GETARG_NAME(2);
+    float4 tolerance = PG_GETARG_FLOAT4(3);
+    float4 threshold = PG_GETARG_FLOAT4(4);
+    int32 top_k = PG_GETARG_INT32(5);
+    int32 nworkers = PG_GETARG_INT32(6);
+    Relation rel = NULL;
+    AttrNumber attnum = InvalidAttrNumber;
+    const LibraryArena *arena = NULL;
+    dsm_handle handle = DSM_HANDLE_INVALID;
+    bool progressing = false;
+    SearchResult result;
+
+    if(nworkers < 0 || top_k < 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("top_k and number of workers must not be negative")));
+
+    rel = search_library_open(relid, column, &attnum);
+
+    // spectra of loaded library are read from the shared memory arena
+    arena = library_cache_lookup(rel, attnum, &handle);
+    search_result_init(&result, top_k);
+
+    progressing = progress_start(PROGRESS_PGMS_COMMAND_SEARCH, relid);
+    progress_update(PROGRESS_PGMS_ROWS_TOTAL, arena ? (int64) arena->count : (int64) Max(rel->rd_rel->reltuples, 0));
+
+    // nested parallel mode is not allowed, temporary tables are not visible to workers
+    if(nworkers > 0 && !IsInParallelMode() && (arena || !RelationUsesLocalBuffers(rel)))
+        library_search_parallel(rel, attnum, arena, handle, query, tolerance, threshold, top_k, nworkers, &result);
+    else
+    {
+        SearchShared *shared = palloc(search_shared_size(1));
+
+        search_shared_init(shared, rel, attnum, arena, handle, tolerance, threshold, top_k, 1);
+        library_search_scan(shared, 0, query, arena, &result);
+    }
+
+    table_close(rel, AccessShareLock);
+
+    if(progressing)
+        progress_end();
+
+    return search_result_materialize(fcinfo, &result);
+}
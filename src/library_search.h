@@ -0,0 +1,49 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_SEARCH_H_
+#define LIBRARY_SEARCH_H_
+
+#include <fmgr.h>
+#include <storage/itemptr.h>
+#include <utils/relcache.h>
+
+typedef struct SearchHit
+{
+    ItemPointerData tid;
+    float4          score;
+} SearchHit;
+
+// top-K min-heap of hits, or list of all hits when top_k is 0
+typedef struct SearchResult
+{
+    SearchHit       *hits;
+    int             count;
+    int             capacity;
+    int             top_k;
+} SearchResult;
+
+void search_result_init(SearchResult *result, int top_k);
+void search_result_add(SearchResult *result, ItemPointer tid, float4 score);
+float4 search_result_cutoff(SearchResult *result, float4 threshold);
+void search_result_sort(SearchResult *result);
+Datum search_result_materialize(FunctionCallInfo fcinfo, SearchResult *result);
+
+Relation search_library_open(Oid relid, Name column, AttrNumber *attnum);
+AttrNumber search_precursor_attnum(Relation rel, Name column);
+
+#endif /* LIBRARY_SEARCH_H_ */
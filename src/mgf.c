@@ -15,19 +15,23 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "filter.h"
 #include "mgf.h"
 #include "pgms.h"
+#include "progress.h"
+#include "reader.h"
 #include "spectrum.h"
 
 #include <utils/builtins.h>
+#include <utils/float.h>
 #include <catalog/pg_type.h>
 #include <catalog/namespace.h>
-#include <storage/large_object.h>
 #include <funcapi.h>
 #include <plpgsql.h>
 #include <nodes/pg_list.h>
 #include <access/htup_details.h>
-#include <libpq/libpq-fs.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
 
 #include <utils/syscache.h>
 
@@ -35,6 +39,15 @@
 #define END_IONS_STR            "END IONS"
 #define COMMENT_STR             "#;!/"
 #define BUFFER_SIZE             (1 << 20) //1MB
+#define PEAKS_INITIAL_SIZE      256
+
+#define LineEquals(line, len, str)  ((len) == sizeof(str) - 1 && !memcmp((line), (str), sizeof(str) - 1))
+
+#if PG_VERSION_NUM >= 140000
+#define HASH_STRINGS_FLAG       HASH_STRINGS
+#else
+#define HASH_STRINGS_FLAG       0
+#endif
 
 typedef enum 
 {
@@ -47,38 +60,82 @@ ParserState;
 
 typedef struct Parser
 {
-    LargeObjectDesc     *file;
+    Reader              *reader;
+    int64               offset;
+    int64               limit;
+    int64               line_offset;
+    int64               record_offset;
     Index               pos;
     size_t              size;
     Pointer             data;
     Datum               *values;
     bool                *isnull;
+    Datum               *global_values;
+    bool                *global_isnull;
     AttInMetadata       *meta;
+    HTAB                *columns;
+    Index               spectrum_column;
+    StringInfo          line;
     ParserState         status;
+    MemoryContext       record_context;
+    float4              *mzs;
+    float4              *peaks;
+    size_t              peaks_count;
+    int64               records;
+    bool                progress;
+    SpectrumFilter      *filter;
+    float4              precursor;
+    float4              global_precursor;
+    size_t              peaks_size;
 } ParserData;
 
-static bool is_comment(StringInfo str)
+typedef struct ColumnEntry
 {
-    Index idx = 0;
-    size_t comments_lenght = sizeof(COMMENT_STR) - 1;
-    Pointer pbegin = StringInfoToCString(str);
-    Pointer pend = StringInfoToCString(str) + str->len;
+    char                name[NAMEDATALEN];
+    Index               column;
+} ColumnEntry;
 
-    TrailLeftSpaces(pbegin, pend);
-    while(idx < comments_lenght && *pbegin != COMMENT_STR[idx])
-        idx++;
+static inline bool is_comment(Pointer line)
+{
+    return *line != '\0' && strchr(COMMENT_STR, *line) != NULL;
+}
 
-    return idx != comments_lenght;
+static Index find_column_by_name(struct Parser* parser, const char* name)
+{
+    ColumnEntry *entry = NULL;
+
+    if(strlen(name) < NAMEDATALEN)
+        entry = (ColumnEntry*) hash_search(parser->columns, name, HASH_FIND, NULL);
+
+    return entry ? entry->column : ColumnCount(parser->meta->tupdesc);
 }
 
-static Index find_column_by_name(TupleDesc tuple, const char* name)
+static HTAB* build_column_map(TupleDesc tuple)
 {
-    Index idx = 0;
+    HASHCTL ctl;
+    HTAB *columns = NULL;
 
-    while(idx < ColumnCount(tuple) && namestrcmp(ColumnName(tuple, idx), name))
-        idx++;
+    MemSet(&ctl, 0, sizeof(ctl));
+    ctl.keysize = NAMEDATALEN;
+    ctl.entrysize = sizeof(ColumnEntry);
+    ctl.hcxt = CurrentMemoryContext;
+    columns = hash_create("pgms mgf columns", Max(ColumnCount(tuple), 1), &ctl, HASH_ELEM | HASH_STRINGS_FLAG | HASH_CONTEXT);
 
-    return idx;
+    for(Index idx = 0; idx < ColumnCount(tuple); idx++)
+    {
+        bool found = false;
+        ColumnEntry *entry = NULL;
+
+        if(ColumnIsDropped(tuple, idx))
+            continue;
+
+        entry = (ColumnEntry*) hash_search(columns, NameStr(*ColumnName(tuple, idx)), HASH_ENTER, &found);
+
+        if(!found)
+            entry->column = idx;
+    }
+
+    return columns;
 }
 
 static Index find_column_by_oid(TupleDesc tuple, Oid oid)
@@ -113,48 +170,81 @@ static List* split(Pointer data, const char* delimiter)
     return result;
 }
 
-static int read_line(struct Parser* parser, StringInfo buffer)
+/*
+ * Returns next line with surrounding whitespaces trimmed or NULL at the end
+ * of input. The line points into the read buffer, only line spanning buffer
+ * refill is assembled in parser->line. It is terminated and may be modified
+ * by caller until next read.
+ */
+static Pointer read_line(struct Parser* parser, size_t *len)
 {
-    size_t cnt = 0;
-    bool white_only = true;
+    Pointer begin = NULL;
+    Pointer end = NULL;
 
-    do
+    resetStringInfo(parser->line);
+    parser->line_offset = parser->offset + parser->pos;
+
+    while(true)
     {
-        char c = '\0';
+        Pointer newline = NULL;
 
-        if(parser->pos == parser->size && PointerIsValid(parser->file))
+        if(parser->pos == parser->size && PointerIsValid(parser->reader))
         {
+            int64 remaining = parser->limit - parser->offset - parser->size;
+
+            parser->offset += parser->size;
             parser->pos = 0;
-            parser->size = inv_read(parser->file, parser->data, BUFFER_SIZE);
+            parser->size = parser->limit < 0 || remaining > BUFFER_SIZE
+                ? reader_read(parser->reader, parser->data, BUFFER_SIZE)
+                : reader_read(parser->reader, parser->data, Max(remaining, 0));
             elog(DEBUG1, "read %ld bytes", parser->size);
         }
 
         if(parser->pos == parser->size)
         {
-            if(white_only)
-                return EOF;
-            else 
-                break;
+            if(parser->line->len == 0)
+                return NULL;
+
+            begin = parser->line->data;
+            end = begin + parser->line->len;
+            break;
         }
 
-        c = parser->data[parser->pos++];
+        begin = parser->data + parser->pos;
+        newline = memchr(begin, '\n', parser->size - parser->pos);
 
-        if(isgraph(c))
-            white_only = false;
-        else if (c == '\0')
-            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
-                , errmsg("Unsupported character: '\\0'")));
+        if(!PointerIsValid(newline))
+        { // the rest of line is in next buffer
+            appendBinaryStringInfo(parser->line, begin, parser->size - parser->pos);
+            parser->pos = parser->size;
+            continue;
+        }
 
-        if(c == '\n')
-            break;
+        parser->pos += newline - begin + 1;
 
-        appendStringInfoCharMacro(buffer, c);
+        if(parser->line->len)
+        {
+            appendBinaryStringInfo(parser->line, begin, newline - begin);
+            begin = parser->line->data;
+            end = begin + parser->line->len;
+        }
+        else
+            end = newline;
 
-        cnt++;
+        break;
     }
-    while(true);
 
-    return white_only ? 0 : cnt;
+    if(memchr(begin, '\0', end - begin))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("Unsupported character: '\\0'")));
+
+    TrailLeftSpaces(begin, end);
+    while(end != begin && isspace((uint8) end[-1]))
+        end--;
+
+    *end = '\0';
+    *len = end - begin;
+    return begin;
 }
 
 static struct Parser* parser_init(AttInMetadata *meta, size_t size)
@@ -162,30 +252,56 @@ static struct Parser* parser_init(AttInMetadata *meta, size_t size)
     struct Parser* parser = (struct Parser*) palloc(sizeof(ParserData));
 
     parser->pos = 0;
-    parser->file = NULL;
+    parser->reader = NULL;
+    parser->offset = 0;
+    parser->limit = -1;
+    parser->line_offset = 0;
+    parser->record_offset = 0;
     parser->size = size;
     parser->data = palloc(parser->size);
     parser->values = palloc(ColumnCount(meta->tupdesc) * sizeof(Datum));
     parser->isnull = palloc(ColumnCount(meta->tupdesc) * sizeof(bool));
+    parser->global_values = palloc(ColumnCount(meta->tupdesc) * sizeof(Datum));
+    parser->global_isnull = palloc(ColumnCount(meta->tupdesc) * sizeof(bool));
     parser->meta = meta;
+    parser->columns = build_column_map(meta->tupdesc);
+    parser->spectrum_column = find_column_by_oid(meta->tupdesc, spectrumOid);
+    parser->line = makeStringInfo();
     parser->status = BEGIN;
+    parser->record_context = AllocSetContextCreate(CurrentMemoryContext, "pgms mgf record", ALLOCSET_DEFAULT_SIZES);
+    parser->peaks_count = 0;
+    parser->records = 0;
+    parser->progress = false;
+    parser->filter = NULL;
+    parser->precursor = get_float4_nan();
+    parser->global_precursor = get_float4_nan();
+    parser->peaks_size = PEAKS_INITIAL_SIZE;
+    parser->mzs = palloc(parser->peaks_size * sizeof(float4));
+    parser->peaks = palloc(parser->peaks_size * sizeof(float4));
 
     for(Index i = 0; i < ColumnCount(meta->tupdesc); i++)
     {
         parser->values[i] = (Datum) 0;
         parser->isnull[i] = true;
+        parser->global_values[i] = (Datum) 0;
+        parser->global_isnull[i] = true;
     }
 
     return parser;
 }
 
-struct Parser* parser_init_lob(struct LargeObjectDesc* in, struct AttInMetadata *meta)
+struct Parser* parser_init_reader(struct Reader* in, struct AttInMetadata *meta)
 {
     struct Parser* parser = parser_init(meta, BUFFER_SIZE);
 
-    parser->file = in;
+    parser->reader = in;
     parser->size = 0;
 
+    // import reports into its own progress, compressed input has no size
+    parser->progress = progress_start(PROGRESS_PGMS_COMMAND_IMPORT, InvalidOid);
+    if(in->size)
+        progress_update(PROGRESS_PGMS_BYTES_TOTAL, reader_size(in));
+
     return parser;
 }
 
@@ -202,14 +318,22 @@ dummyret parser_close(struct Parser* parser)
 {
     pfree(parser->data);
 
-    if(parser->file)
-    {
-        close_lo_relation(true);
-        inv_close(parser->file);
-    }
+    if(parser->reader)
+        reader_close(parser->reader);
+
+    if(parser->progress)
+        progress_end();
 
+    MemoryContextDelete(parser->record_context);
+    hash_destroy(parser->columns);
+    pfree(parser->line->data);
+    pfree(parser->line);
     pfree(parser->values);
     pfree(parser->isnull);
+    pfree(parser->global_values);
+    pfree(parser->global_isnull);
+    pfree(parser->mzs);
+    pfree(parser->peaks);
     pfree(parser);
 }
 
@@ -238,7 +362,7 @@ static dummyret parser_set_column_value(struct Parser* parser, Index columnIndex
     }
 }
 
-static dummyret parser_set_column_array(struct Parser* parser, Index columnIndex, List *l, size_t dim)
+static dummyret parser_set_column_array(struct Parser* parser, Index columnIndex, List *l)
 {
 #define ArrayInnerTraversal(list, n, res)                   \
     do {                                                    \
@@ -263,29 +387,13 @@ static dummyret parser_set_column_array(struct Parser* parser, Index columnIndex
     if(columnIndex < ColumnCount(parser->meta->tupdesc) && !ColumnIsDropped(parser->meta->tupdesc, columnIndex))
     {
         size_t count = list_length(l);
-        elog(DEBUG1, "%s of %d: sizeof %ld in %ld dimension"
+        elog(DEBUG1, "%s of %d: sizeof %ld"
             , NameStr(*ColumnName(parser->meta->tupdesc, columnIndex))
             , ColumnType(parser->meta->tupdesc, columnIndex)
-            , count
-            , dim);
+            , count);
 
         appendStringInfoCharMacro(result, '{');
-        if(dim > 1)
-        {
-            ListCell *cell = NULL;
-
-            foreach(cell, l)
-            {
-                List* ll = lfirst(cell);
-
-                appendStringInfoCharMacro(result, '{');
-                ArrayInnerTraversal(ll, list_length(ll), result);
-                appendStringInfoCharMacro(result, '}');
-                appendStringInfoCharMacro(result, cell == list_tail(l) ? ' ' : ',');
-            }
-        }
-        else
-            ArrayInnerTraversal(l, list_length(l), result);
+        ArrayInnerTraversal(l, list_length(l), result);
 
         appendStringInfoCharMacro(result, '}');
 
@@ -309,13 +417,24 @@ static dummyret parser_set_parameter(struct Parser* parser, const char* name, co
     Index idx = 0;
     StringInfo value = makeStringInfo();
 
+    if(parser->filter && !strcmp(name, parser->filter->precursor))
+    { // precursor m/z is the first value, intensity may follow
+        const char *end = s;
+
+        while(*end && !isspace((uint8) *end))
+            end++;
+
+        if(!spectrum_parse_float4(s, end, &parser->precursor))
+            parser->precursor = get_float4_nan();
+    }
+
     appendStringInfoString(value, s);
-    idx = find_column_by_name(parser->meta->tupdesc, name);
+    idx = find_column_by_name(parser, name);
 
     if(IsColumnNumericArray(parser->meta->tupdesc, idx))
     {
         List *l = split(StringInfoToCString(value), " ");
-        parser_set_column_array(parser, idx, l, 1);
+        parser_set_column_array(parser, idx, l);
         list_free_deep(l);
     }
     else
@@ -324,129 +443,265 @@ static dummyret parser_set_parameter(struct Parser* parser, const char* name, co
     pfree(value);
 }
 
-dummyret parser_globals(struct Parser* parser)
+static float4 parser_parse_peak_value(Pointer token, Pointer end)
 {
-    StringInfo line = makeStringInfo();
+    float4 value = 0.0f;
+
+    if(!spectrum_parse_float4(token, end, &value))
+    { // exotic notations are left to float4 input function
+        Pointer psign = end - 1;
+
+        NormalizeNumericSignSuffix(token, psign);
+        value = DatumGetFloat4(DirectFunctionCall1(float4in, CStringGetDatum(token)));
+    }
+
+    return value;
+}
+
+static dummyret parser_add_peak(struct Parser* parser, Pointer line, size_t len)
+{
+    Pointer tokens[SPECTRUM_ARRAY_DIM + 1];
+    Pointer ends[SPECTRUM_ARRAY_DIM + 1];
+    Pointer p = line;
+    Pointer pend = line + len;
+    size_t count = 0;
+
+    while(count <= SPECTRUM_ARRAY_DIM)
+    {
+        TrailLeftSpaces(p, pend);
+        if(p == pend)
+            break;
+
+        tokens[count] = p;
+        while(p != pend && !isspace((uint8) *p))
+            p++;
+        ends[count++] = p;
+    }
+
+    if(count != SPECTRUM_ARRAY_DIM)
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("Unknown format mass spectrum format: %s", line)));
+
+    if(parser->peaks_count == parser->peaks_size)
+    {
+        parser->peaks_size *= 2;
+        parser->mzs = repalloc_huge(parser->mzs, parser->peaks_size * sizeof(float4));
+        parser->peaks = repalloc_huge(parser->peaks, parser->peaks_size * sizeof(float4));
+    }
 
+    // tokens are terminated in place, the line is not used after
+    *ends[0] = '\0';
+    *ends[1] = '\0';
+    parser->mzs[parser->peaks_count] = parser_parse_peak_value(tokens[0], ends[0]);
+    parser->peaks[parser->peaks_count] = parser_parse_peak_value(tokens[1], ends[1]);
+    parser->peaks_count++;
+}
+
+dummyret parser_globals(struct Parser* parser)
+{
     Assert(parser);
 
     while(true)
     {
-        int result = read_line(parser, line);
-        bool bcomment = false;
-        Pointer  eq = NULL;
+        size_t len = 0;
+        Pointer line = read_line(parser, &len);
+        Pointer eq = NULL;
 
-        if(result == EOF)
+        if(!PointerIsValid(line))
             break;
-        else if(result == 0)
+        else if(len == 0 || is_comment(line))
             continue;
 
-        bcomment = is_comment(line);
-
-        if(!bcomment && parser->status == BEGIN && !strcmp (BEGIN_IONS_STR,StringInfoToCString(line)))
+        if(parser->status == BEGIN && LineEquals(line, len, BEGIN_IONS_STR))
         {
+            parser->record_offset = parser->line_offset;
             parser->status = BEGIN_IONS;
             break;
         }
-        else if(!bcomment && parser->status == BEGIN && PointerIsValid(eq = strchr(StringInfoToCString(line), '=')))
+        else if(parser->status == BEGIN && PointerIsValid(eq = memchr(line, '=', len)))
         {
             *eq++ = '\0';
-            parser_set_parameter(parser, StringInfoToCString(line), eq);
+            parser_set_parameter(parser, line, eq);
         }
-        resetStringInfo(line);
     }
 
-    pfree(line->data);
-    pfree(line);
+    memcpy(parser->global_values, parser->values, ColumnCount(parser->meta->tupdesc) * sizeof(Datum));
+    memcpy(parser->global_isnull, parser->isnull, ColumnCount(parser->meta->tupdesc) * sizeof(bool));
+    parser->global_precursor = parser->precursor;
 }
 
 bool parser_next(struct Parser* parser)
 {
-    StringInfo line = makeStringInfo();
-    List *mzs = NULL;
-    List *peaks = NULL;
+    MemoryContext oldcontext = NULL;
+    Index idx = parser->spectrum_column;
 
     elog(DEBUG1, "parser_next");
+
+    // values of the previous record were already formed to tuple
+    MemoryContextReset(parser->record_context);
+    oldcontext = MemoryContextSwitchTo(parser->record_context);
+    memcpy(parser->values, parser->global_values, ColumnCount(parser->meta->tupdesc) * sizeof(Datum));
+    memcpy(parser->isnull, parser->global_isnull, ColumnCount(parser->meta->tupdesc) * sizeof(bool));
+    parser->peaks_count = 0;
+    parser->precursor = parser->global_precursor;
+
     do
     {
-        int result = 0;
-        Pointer  eq = NULL;
-
-        result = read_line(parser, line);
+        size_t len = 0;
+        Pointer line = read_line(parser, &len);
+        Pointer eq = NULL;
 
-        if(result == EOF)
+        if(!PointerIsValid(line))
         {
             parser->status = END;
             break;
         }
-        else if(result == 0)
-        {
-            resetStringInfo(line);
+        else if(len == 0)
             continue;
-        }
 
         if(is_comment(line))
         {
             ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
                 , errmsg("Missplaced comment")));
         }
-        else if(parser->status == BEGIN && !strcmp (BEGIN_IONS_STR,StringInfoToCString(line)))
+        else if(parser->status == BEGIN && LineEquals(line, len, BEGIN_IONS_STR))
         {
             elog(DEBUG1, BEGIN_IONS_STR);
+            parser->record_offset = parser->line_offset;
             parser->status = BEGIN_IONS;
         }
-        else if(parser->status == BEGIN_IONS && !strcmp (END_IONS_STR,StringInfoToCString(line)))
+        else if(parser->status == BEGIN_IONS && LineEquals(line, len, END_IONS_STR))
         {
-            Index idx = 0;
-            List *spectrums = NULL;
+            if(parser->filter)
+                parser->peaks_count = spectrum_filter_apply(parser->filter, parser->mzs, parser->peaks, parser->peaks_count, parser->precursor);
 
-            if(mzs && peaks)
+            if(parser->peaks_count && idx < ColumnCount(parser->meta->tupdesc) && !ColumnIsDropped(parser->meta->tupdesc, idx))
             {
-                spectrums = lappend(spectrums, mzs);
-                spectrums = lappend(spectrums, peaks);
-
-                idx = find_column_by_oid(parser->meta->tupdesc, spectrumOid);
-                parser_set_column_array(parser, idx, spectrums, SPECTRUM_ARRAY_DIM);
-                list_free_deep(spectrums);
+                parser->values[idx] = spectrum_build(parser->mzs, parser->peaks, parser->peaks_count);
+                parser->isnull[idx] = false;
             }
             parser->status = END_IONS;
         }
-        else if(parser->status == BEGIN_IONS && PointerIsValid(eq = strchr(StringInfoToCString(line), '=')))
+        else if(parser->status == BEGIN_IONS && PointerIsValid(eq = memchr(line, '=', len)))
         {
             *eq++ = '\0';
-            parser_set_parameter(parser, StringInfoToCString(line), eq);
+            parser_set_parameter(parser, line, eq);
         }
         else if(parser->status == BEGIN_IONS)
+            parser_add_peak(parser, line, len);
+        else
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+                , errmsg("Unknown format line: %s", line)));
+    }
+    while(parser->status < END_IONS);
+
+    if(parser->status == END_IONS)
+    {
+        progress_update(PROGRESS_PGMS_RECORDS_PARSED, ++parser->records);
+        progress_update(PROGRESS_PGMS_BYTES_PROCESSED, parser->offset + parser->pos);
+    }
+
+    parser->status = parser->status != END ? BEGIN : END;
+    MemoryContextSwitchTo(oldcontext);
+    return parser->status != END;
+}
+
+dummyret parser_set_filter(struct Parser* parser, struct SpectrumFilter* filter)
+{
+    parser->filter = filter;
+}
+
+dummyret parser_seek(struct Parser* parser, int64 begin, int64 end)
+{
+    Assert(PointerIsValid(parser->reader) && parser->reader->seek);
+
+    reader_seek(parser->reader, begin);
+    parser->offset = begin;
+    parser->limit = end;
+    parser->pos = 0;
+    parser->size = 0;
+    parser->status = BEGIN;
+}
+
+/*
+ * Returns offset of the first BEGIN IONS line starting at or after offset or
+ * -1 when there is none. Used to split large object on record boundaries.
+ */
+int64 parser_find_record(struct Reader* reader, int64 offset)
+{
+    const size_t len = sizeof(BEGIN_IONS_STR) - 1;
+    Pointer buffer = palloc(BUFFER_SIZE);
+    int64 pos = offset > 0 ? offset - 1 : 0;
+    int64 result = -1;
+
+    while(result < 0)
+    {
+        Pointer p = buffer;
+        Pointer pend = NULL;
+        int n = 0;
+
+        reader_seek(reader, pos);
+        n = reader_read(reader, buffer, BUFFER_SIZE);
+        pend = buffer + n;
+
+        if(n == 0)
+            break;
+
+        if(offset == 0 && (size_t) n >= len && !memcmp(buffer, BEGIN_IONS_STR, len)
+            && ((size_t) n == len || isspace((uint8) buffer[len])))
         {
-            StringInfo value = makeStringInfo();
-            List *l = NIL;
+            result = 0;
+            break;
+        }
 
-            appendStringInfoString(value, StringInfoToCString(line));
-            l = split(StringInfoToCString(value), " ");
+        // BEGIN IONS has to be followed by line end or whitespace
+        p = memchr(p, '\n', n);
+        while(PointerIsValid(p) && pend - p > (ssize_t) len)
+        {
+            Pointer follow = p + 1 + len;
 
-            if(list_length(l) == SPECTRUM_ARRAY_DIM)
+            if(!memcmp(p + 1, BEGIN_IONS_STR, len)
+                && ((follow == pend && n < BUFFER_SIZE) || (follow != pend && isspace((uint8) *follow))))
             {
-                mzs = lappend(mzs, list_nth(l, 0));
-                peaks = lappend(peaks, list_nth(l, 1));
+                result = pos + (p + 1 - buffer);
+                break;
             }
-            else 
-                ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
-                    , errmsg("Unknown format mass spectrum format: %s", StringInfoToCString(line))));
 
-            pfree(value->data);
-            pfree(value);
+            p = memchr(p + 1, '\n', pend - p - 1);
         }
-        else
-            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
-                , errmsg("Unknown format line: %s", StringInfoToCString(line))));
 
-        resetStringInfo(line);
+        if(n < BUFFER_SIZE)
+            break;
+
+        // lines crossing the buffer end are read again
+        pos += n - (len + 1);
     }
-    while(parser->status < END_IONS);
 
-    parser->status = parser->status != END ? BEGIN : END;
-    pfree(line);
-    return parser->status != END;
+    pfree(buffer);
+    return result;
+}
+
+int64 parser_record_offset(struct Parser* parser)
+{
+    return parser->record_offset;
+}
+
+dummyret parser_map_column(struct Parser* parser, const char* key, Index column)
+{
+    ColumnEntry *entry = NULL;
+
+    if(strlen(key) >= NAMEDATALEN)
+        ereport(ERROR, (errcode(ERRCODE_NAME_TOO_LONG)
+            , errmsg("MGF key \"%s\" is too long", key)));
+
+    entry = (ColumnEntry*) hash_search(parser->columns, key, HASH_ENTER, NULL);
+    entry->column = column;
+}
+
+dummyret parser_get_values(struct Parser* parser, Datum *values, bool *isnull)
+{
+    memcpy(values, parser->values, ColumnCount(parser->meta->tupdesc) * sizeof(Datum));
+    memcpy(isnull, parser->isnull, ColumnCount(parser->meta->tupdesc) * sizeof(bool));
 }
 
 Datum parser_get_tuple(struct Parser* parser)
@@ -479,10 +734,11 @@ Datum load_mgf_lo(PG_FUNCTION_ARGS)
             spectrumOid = TypenameGetTypid("spectrum");
 
         funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
-        parser = parser_init_lob(
-            inv_open(PG_GETARG_OID(0), INV_READ, funcctx->multi_call_memory_ctx)
-            , funcctx->attinmeta
-        );
+        parser = parser_init_reader(reader_open_lo(PG_GETARG_OID(0)), funcctx->attinmeta);
+        if(parser->progress)
+            progress_end_at_shutdown(fcinfo);
+        if(PG_NARGS() > 1)
+            parser_set_filter(parser, spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root));
         parser_globals(parser);
         funcctx->user_fctx = (void*)parser;
         MemoryContextSwitchTo(oldcontext);
@@ -510,6 +766,60 @@ Datum load_mgf_lo(PG_FUNCTION_ARGS)
     SRF_RETURN_DONE(funcctx);
 }
 
+PG_FUNCTION_INFO_V1(load_mgf_file);
+Datum load_mgf_file(PG_FUNCTION_ARGS)
+{
+    bool next;
+    FuncCallContext *funcctx = NULL;
+    struct Parser* parser = NULL;
+
+    if(SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext = NULL;
+        TupleDesc tuple_desc = NULL;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if(get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+                , errmsg("unsupported return type")));
+
+        if(!OidIsValid(spectrumOid))
+            spectrumOid = TypenameGetTypid("spectrum");
+
+        funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
+        parser = parser_init_reader(reader_open_file(text_to_cstring(PG_GETARG_TEXT_PP(0))), funcctx->attinmeta);
+        if(parser->progress)
+            progress_end_at_shutdown(fcinfo);
+        if(PG_NARGS() > 1)
+            parser_set_filter(parser, spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root));
+        parser_globals(parser);
+        funcctx->user_fctx = (void*)parser;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    parser = (struct Parser*) funcctx->user_fctx;
+
+    PG_TRY();
+    {
+        next = parser_next(parser);
+    }
+    PG_CATCH();
+    {
+        parser_close(parser);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    if(next)
+        SRF_RETURN_NEXT(funcctx, parser_get_tuple(parser));
+
+    parser_close(parser);
+    SRF_RETURN_DONE(funcctx);
+}
+
 PG_FUNCTION_INFO_V1(load_mgf_varchar);
 Datum load_mgf_varchar(PG_FUNCTION_ARGS)
 {
@@ -534,6 +844,8 @@ Datum load_mgf_varchar(PG_FUNCTION_ARGS)
 
         funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
         parser = parser_init_varchar(PG_GETARG_VARCHAR_P(0), funcctx->attinmeta);
+        if(PG_NARGS() > 1)
+            parser_set_filter(parser, spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root));
         parser_globals(parser);
         funcctx->user_fctx = (void*)parser;
         MemoryContextSwitchTo(oldcontext);
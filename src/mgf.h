@@ -4,14 +4,21 @@
 #include <postgres.h>
 
 struct Parser;
-struct LargeObjectDesc;
+struct Reader;
+struct SpectrumFilter;
 struct AttInMetadata;
 
-struct Parser* parser_init_lob(struct LargeObjectDesc*, struct AttInMetadata*);
+struct Parser* parser_init_reader(struct Reader*, struct AttInMetadata*);
 struct Parser* parser_init_varchar(VarChar*, struct AttInMetadata*);
 void parser_close(struct Parser*);
 bool parser_next(struct Parser*);
 void parser_globals(struct Parser*);
+void parser_set_filter(struct Parser*, struct SpectrumFilter*);
+void parser_seek(struct Parser*, int64, int64);
+int64 parser_record_offset(struct Parser*);
+int64 parser_find_record(struct Reader*, int64);
+void parser_map_column(struct Parser*, const char*, Index);
+void parser_get_values(struct Parser*, Datum*, bool*);
 Datum parser_get_tuple(struct Parser*);
 
 #endif /* MGF_H_ */
@@ -0,0 +1,719 @@
+/* 
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mzML loader
+ *
+ * The document is scanned tag by tag from the reader, only the current tag
+ * and the text of the current <binary> element are kept, so memory does not
+ * depend on the file size. Each <spectrum> element becomes one row:
+ *     spectrum typed column - peaks decoded from m/z and intensity
+ *         binaryDataArray (base64, optionally zlib compressed, 32 or 64 bit
+ *         floats) straight into the float4 buffers
+ *     columns named as cvParam/userParam name or cvParam accession - the
+ *         value attribute of the param anywhere in the spectrum element
+ *         (the last one wins), valueless cvParams set bool columns to true
+ *     columns "id" and "index" - attributes of the spectrum element
+ * Remove precursor filter uses the param named by the precursor option or
+ * the selected ion m/z (MS:1000744).
+ */
+
+#include "filter.h"
+#include "pgms.h"
+#include "progress.h"
+#include "reader.h"
+#include "spectrum.h"
+
+#include <access/htup_details.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
+#include <common/base64.h>
+#include <funcapi.h>
+#include <port/pg_bswap.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/memutils.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#define MZML_BUFFER_SIZE            (1 << 20) //1MB
+#define MZML_PEAKS_INITIAL_SIZE     256
+
+// PSI-MS controlled vocabulary
+#define MS_MZ_ARRAY                 "MS:1000514"
+#define MS_INTENSITY_ARRAY          "MS:1000515"
+#define MS_FLOAT32                  "MS:1000521"
+#define MS_FLOAT64                  "MS:1000523"
+#define MS_ZLIB_COMPRESSION         "MS:1000574"
+#define MS_NO_COMPRESSION           "MS:1000576"
+#define MS_SELECTED_ION_MZ          "MS:1000744"
+
+#define MzmlTagIs(parser, str)      (!strcmp((parser)->name, (str)))
+
+typedef enum
+{
+    ARRAY_OTHER     = 0,
+    ARRAY_MZ        = 1,
+    ARRAY_INTENSITY = 2,
+}
+ArrayKind;
+
+typedef struct MzmlParser
+{
+    Reader              *reader;
+    char                *data;
+    size_t              size;
+    size_t              pos;
+    int64               offset;
+    StringInfoData      tag;
+    StringInfoData      text;
+    char                *name;
+    bool                end;
+    bool                empty;
+    AttInMetadata       *meta;
+    Index               spectrum_column;
+    Datum               *values;
+    bool                *isnull;
+    MemoryContext       record_context;
+    SpectrumFilter      *filter;
+    float4              precursor;
+    bool                precursor_key;
+    float4              *mzs;
+    float4              *intensities;
+    size_t              mzs_count;
+    size_t              intensities_count;
+    size_t              peaks_size;
+    ArrayKind           array_kind;
+    bool                array_double;
+    bool                array_zlib;
+    int64               array_length;
+    int64               default_length;
+    int64               records;
+    bool                progress;
+} MzmlParser;
+
+typedef Reader *(*MzmlOpen)(FunctionCallInfo fcinfo);
+
+static inline int mzml_getc(MzmlParser *parser)
+{
+    if(parser->pos == parser->size)
+    {
+        parser->offset += parser->size;
+        parser->pos = 0;
+        parser->size = reader_read(parser->reader, parser->data, MZML_BUFFER_SIZE);
+
+        if(parser->size == 0)
+            return EOF;
+    }
+
+    return (uint8) parser->data[parser->pos++];
+}
+
+static dummyret mzml_unexpected_end(void)
+{
+    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+        , errmsg("unexpected end of mzML input")));
+}
+
+// skips comment, processing instruction or declaration up to its terminator
+static dummyret mzml_skip_markup(MzmlParser *parser, const char *terminator)
+{
+    size_t len = strlen(terminator);
+    int c = EOF;
+
+    while((c = mzml_getc(parser)) != EOF)
+    {
+        appendStringInfoCharMacro(&parser->tag, (char) c);
+
+        if(parser->tag.len >= len && !memcmp(parser->tag.data + parser->tag.len - len, terminator, len))
+            return;
+    }
+
+    mzml_unexpected_end();
+}
+
+/*
+ * Reads the next element tag into parser->tag and splits off its name, text
+ * before the tag is appended to parser->text when capture is set. Returns
+ * false at the end of input.
+ */
+static bool mzml_next_tag(MzmlParser *parser, bool capture)
+{
+    while(true)
+    {
+        int c = EOF;
+        int quote = 0;
+        char *p = NULL;
+
+        while((c = mzml_getc(parser)) != EOF && c != '<')
+            if(capture)
+                appendStringInfoCharMacro(&parser->text, (char) c);
+
+        if(c == EOF)
+            return false;
+
+        resetStringInfo(&parser->tag);
+
+        if((c = mzml_getc(parser)) == '?')
+        {
+            mzml_skip_markup(parser, "?>");
+            continue;
+        }
+        else if(c == '!')
+        {
+            appendStringInfoCharMacro(&parser->tag, '!');
+            c = mzml_getc(parser);
+            appendStringInfoCharMacro(&parser->tag, (char) c);
+            mzml_skip_markup(parser, c == '-' ? "-->" : ">");
+            continue;
+        }
+
+        for(; c != EOF; c = mzml_getc(parser))
+        {
+            if(quote)
+                quote = c == quote ? 0 : quote;
+            else if(c == '"' || c == '\'')
+                quote = c;
+            else if(c == '>')
+                break;
+
+            appendStringInfoCharMacro(&parser->tag, (char) c);
+        }
+
+        if(c == EOF)
+            mzml_unexpected_end();
+
+        parser->end = parser->tag.data[0] == '/';
+        parser->empty = parser->tag.len > 0 && parser->tag.data[parser->tag.len - 1] == '/';
+        parser->name = parser->tag.data + (parser->end ? 1 : 0);
+
+        // name is terminated in place, attributes follow it
+        for(p = parser->name; *p && !isspace((uint8) *p) && *p != '/'; p++)
+            ;
+        if(*p)
+            *p++ = '\0';
+        parser->tag.cursor = p - parser->tag.data;
+
+        // namespace prefix is ignored
+        if((p = strchr(parser->name, ':')) != NULL)
+            parser->name = p + 1;
+
+        return true;
+    }
+}
+
+static void mzml_decode_entities(char *value)
+{
+    static const struct { const char *entity; char c; } entities[] = {
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}
+    };
+    char *out = value;
+
+    for(char *in = value; *in; )
+    {
+        bool found = false;
+
+        if(*in == '&')
+        {
+            for(int i = 0; i < lengthof(entities) && !found; i++)
+            {
+                size_t len = strlen(entities[i].entity);
+
+                if(!strncmp(in, entities[i].entity, len))
+                {
+                    *out++ = entities[i].c;
+                    in += len;
+                    found = true;
+                }
+            }
+        }
+
+        if(!found)
+            *out++ = *in++;
+    }
+
+    *out = '\0';
+}
+
+// value of the attribute of the current tag in record memory, NULL if missing
+static char *mzml_attribute(MzmlParser *parser, const char *name)
+{
+    const char *p = parser->tag.data + parser->tag.cursor;
+    size_t name_len = strlen(name);
+
+    while(*p)
+    {
+        const char *attr = NULL;
+        size_t attr_len = 0;
+        const char *value = NULL;
+        char quote = '\0';
+
+        while(*p && (isspace((uint8) *p) || *p == '/'))
+            p++;
+
+        attr = p;
+        while(*p && *p != '=' && !isspace((uint8) *p))
+            p++;
+        attr_len = p - attr;
+
+        while(*p && (isspace((uint8) *p) || *p == '='))
+            p++;
+
+        if(*p != '"' && *p != '\'')
+            break;
+
+        quote = *p++;
+        value = p;
+        while(*p && *p != quote)
+            p++;
+
+        if(attr_len == name_len && !memcmp(attr, name, name_len))
+        {
+            char *result = pnstrdup(value, p - value);
+
+            mzml_decode_entities(result);
+            return result;
+        }
+
+        if(*p)
+            p++;
+    }
+
+    return NULL;
+}
+
+static Index mzml_find_column(MzmlParser *parser, const char *name)
+{
+    TupleDesc tupdesc = parser->meta->tupdesc;
+    Index idx = 0;
+
+    if(name == NULL)
+        return ColumnCount(tupdesc);
+
+    while(idx < ColumnCount(tupdesc)
+        && (ColumnIsDropped(tupdesc, idx) || strcmp(name, NameStr(*ColumnName(tupdesc, idx)))))
+        idx++;
+
+    return idx;
+}
+
+static dummyret mzml_set_column(MzmlParser *parser, Index idx, const char *value)
+{
+    if(idx >= ColumnCount(parser->meta->tupdesc) || idx == parser->spectrum_column)
+        return;
+
+    parser->values[idx] = InputFunctionCall(&parser->meta->attinfuncs[idx]
+        , (char *) value
+        , parser->meta->attioparams[idx]
+        , parser->meta->atttypmods[idx]);
+    parser->isnull[idx] = false;
+}
+
+static dummyret mzml_set_parameter(MzmlParser *parser)
+{
+    char *name = mzml_attribute(parser, "name");
+    char *accession = mzml_attribute(parser, "accession");
+    char *value = mzml_attribute(parser, "value");
+    Index idx = mzml_find_column(parser, name);
+
+    if(idx == ColumnCount(parser->meta->tupdesc))
+        idx = mzml_find_column(parser, accession);
+
+    if(value && *value)
+        mzml_set_column(parser, idx, value);
+    else if(idx < ColumnCount(parser->meta->tupdesc) && ColumnType(parser->meta->tupdesc, idx) == BOOLOID)
+        mzml_set_column(parser, idx, "true");
+
+    if(parser->filter && value && *value)
+    {
+        bool key = (name && !strcmp(name, parser->filter->precursor))
+            || (accession && !strcmp(accession, parser->filter->precursor));
+
+        // explicitly named precursor param takes precedence over selected ion m/z
+        if(key || (!parser->precursor_key && accession && !strcmp(accession, MS_SELECTED_ION_MZ)))
+        {
+            if(!spectrum_parse_float4(value, value + strlen(value), &parser->precursor))
+                parser->precursor = get_float4_nan();
+            parser->precursor_key = key;
+        }
+    }
+}
+
+static dummyret mzml_array_parameter(MzmlParser *parser)
+{
+    char *accession = mzml_attribute(parser, "accession");
+
+    if(accession == NULL)
+        return;
+
+    if(!strcmp(accession, MS_MZ_ARRAY))
+        parser->array_kind = ARRAY_MZ;
+    else if(!strcmp(accession, MS_INTENSITY_ARRAY))
+        parser->array_kind = ARRAY_INTENSITY;
+    else if(!strcmp(accession, MS_FLOAT32))
+        parser->array_double = false;
+    else if(!strcmp(accession, MS_FLOAT64))
+        parser->array_double = true;
+    else if(!strcmp(accession, MS_ZLIB_COMPRESSION))
+        parser->array_zlib = true;
+    else if(!strcmp(accession, MS_NO_COMPRESSION))
+        parser->array_zlib = false;
+    else if(strstr(accession, "MS:10023") == accession || strstr(accession, "MS:10027") == accession)
+    { // numpress and its zlib variants are not supported
+        char *name = mzml_attribute(parser, "name");
+
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("mzML binary data compression \"%s\" is not supported", name ? name : accession)));
+    }
+}
+
+static dummyret mzml_begin_array(MzmlParser *parser)
+{
+    char *length = mzml_attribute(parser, "arrayLength");
+
+    parser->array_kind = ARRAY_OTHER;
+    parser->array_double = true;
+    parser->array_zlib = false;
+    parser->array_length = length ? pg_strtoint32(length) : parser->default_length;
+}
+
+/*
+ * Decodes base64 text of the <binary> element into m/z or intensity buffer,
+ * little endian 64 bit values are narrowed to float4.
+ */
+static dummyret mzml_decode_array(MzmlParser *parser)
+{
+    int element = parser->array_double ? sizeof(float8) : sizeof(float4);
+    char *decoded = NULL;
+    int len = 0;
+    size_t count = 0;
+    float4 *target = NULL;
+
+    if(parser->array_kind == ARRAY_OTHER)
+        return;
+
+    decoded = palloc(Max(pg_b64_dec_len(parser->text.len), 1));
+
+#if PG_VERSION_NUM >= 130000
+    len = pg_b64_decode(parser->text.data, parser->text.len, decoded, pg_b64_dec_len(parser->text.len));
+#else
+    len = pg_b64_decode(parser->text.data, parser->text.len, decoded);
+#endif
+
+    if(len < 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+            , errmsg("invalid base64 data in mzML binary data array")));
+
+    if(parser->array_zlib)
+    {
+#ifdef HAVE_LIBZ
+        uLongf inflated_len = parser->array_length * element;
+        char *inflated = palloc(Max(inflated_len, 1));
+
+        if(uncompress((Bytef *) inflated, &inflated_len, (Bytef *) decoded, len) != Z_OK)
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED)
+                , errmsg("could not decompress mzML binary data array of %lld values", (long long) parser->array_length)));
+
+        pfree(decoded);
+        decoded = inflated;
+        len = inflated_len;
+#else
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("zlib compressed mzML arrays are not supported by this build")));
+#endif
+    }
+
+    count = len / element;
+
+    if(count > parser->peaks_size)
+    {
+        parser->peaks_size = count;
+        parser->mzs = repalloc(parser->mzs, parser->peaks_size * sizeof(float4));
+        parser->intensities = repalloc(parser->intensities, parser->peaks_size * sizeof(float4));
+    }
+
+    target = parser->array_kind == ARRAY_MZ ? parser->mzs : parser->intensities;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(parser->array_double)
+        {
+            uint64 bits = 0;
+            float8 value = 0.0;
+
+            memcpy(&bits, decoded + i * sizeof(float8), sizeof(float8));
+#ifdef WORDS_BIGENDIAN
+            bits = pg_bswap64(bits);
+#endif
+            memcpy(&value, &bits, sizeof(float8));
+            target[i] = (float4) value;
+        }
+        else
+        {
+            uint32 bits = 0;
+
+            memcpy(&bits, decoded + i * sizeof(float4), sizeof(float4));
+#ifdef WORDS_BIGENDIAN
+            bits = pg_bswap32(bits);
+#endif
+            memcpy(&target[i], &bits, sizeof(float4));
+        }
+    }
+
+    if(parser->array_kind == ARRAY_MZ)
+        parser->mzs_count = count;
+    else
+        parser->intensities_count = count;
+
+    pfree(decoded);
+}
+
+static MzmlParser *mzml_init(Reader *reader, AttInMetadata *meta)
+{
+    MzmlParser *parser = palloc0(sizeof(MzmlParser));
+
+    parser->reader = reader;
+    parser->data = palloc(MZML_BUFFER_SIZE);
+    initStringInfo(&parser->tag);
+    initStringInfo(&parser->text);
+    parser->meta = meta;
+    parser->spectrum_column = ColumnCount(meta->tupdesc);
+    parser->values = palloc(ColumnCount(meta->tupdesc) * sizeof(Datum));
+    parser->isnull = palloc(ColumnCount(meta->tupdesc) * sizeof(bool));
+    parser->record_context = AllocSetContextCreate(CurrentMemoryContext, "pgms mzml record", ALLOCSET_DEFAULT_SIZES);
+    parser->peaks_size = MZML_PEAKS_INITIAL_SIZE;
+    parser->mzs = palloc(parser->peaks_size * sizeof(float4));
+    parser->intensities = palloc(parser->peaks_size * sizeof(float4));
+
+    for(Index idx = 0; idx < ColumnCount(meta->tupdesc); idx++)
+        if(!ColumnIsDropped(meta->tupdesc, idx) && ColumnType(meta->tupdesc, idx) == spectrumOid)
+        {
+            parser->spectrum_column = idx;
+            break;
+        }
+
+    parser->progress = progress_start(PROGRESS_PGMS_COMMAND_IMPORT, InvalidOid);
+    if(parser->progress && reader->size)
+        progress_update(PROGRESS_PGMS_BYTES_TOTAL, reader_size(reader));
+
+    return parser;
+}
+
+static void mzml_close(MzmlParser *parser)
+{
+    if(parser->progress)
+        progress_end();
+
+    reader_close(parser->reader);
+    MemoryContextDelete(parser->record_context);
+    pfree(parser->data);
+    pfree(parser->tag.data);
+    pfree(parser->text.data);
+    pfree(parser->values);
+    pfree(parser->isnull);
+    pfree(parser->mzs);
+    pfree(parser->intensities);
+    pfree(parser);
+}
+
+static dummyret mzml_begin_spectrum(MzmlParser *parser)
+{
+    char *length = mzml_attribute(parser, "defaultArrayLength");
+    char *value = NULL;
+
+    parser->default_length = length ? pg_strtoint32(length) : 0;
+
+    if((value = mzml_attribute(parser, "id")) != NULL)
+        mzml_set_column(parser, mzml_find_column(parser, "id"), value);
+    if((value = mzml_attribute(parser, "index")) != NULL)
+        mzml_set_column(parser, mzml_find_column(parser, "index"), value);
+}
+
+static dummyret mzml_end_spectrum(MzmlParser *parser)
+{
+    Index idx = parser->spectrum_column;
+    size_t count = parser->mzs_count;
+
+    if(parser->mzs_count != parser->intensities_count)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+            , errmsg("m/z and intensity arrays of mzML spectrum differ in length")));
+
+    if(parser->filter)
+        count = spectrum_filter_apply(parser->filter, parser->mzs, parser->intensities, count, parser->precursor);
+
+    if(count && idx < ColumnCount(parser->meta->tupdesc))
+    {
+        parser->values[idx] = spectrum_build(parser->mzs, parser->intensities, count);
+        parser->isnull[idx] = false;
+    }
+}
+
+// reads the next <spectrum> element into values, false at the end of input
+static bool mzml_next(MzmlParser *parser)
+{
+    MemoryContext oldcontext = NULL;
+    bool spectrum = false;
+    bool finished = false;
+    bool array = false;
+    bool binary = false;
+
+    // values of the previous record were already formed to tuple
+    MemoryContextReset(parser->record_context);
+    oldcontext = MemoryContextSwitchTo(parser->record_context);
+
+    for(Index i = 0; i < ColumnCount(parser->meta->tupdesc); i++)
+    {
+        parser->values[i] = (Datum) 0;
+        parser->isnull[i] = true;
+    }
+    parser->mzs_count = 0;
+    parser->intensities_count = 0;
+    parser->precursor = get_float4_nan();
+    parser->precursor_key = false;
+
+    while(mzml_next_tag(parser, binary))
+    {
+        if(!spectrum)
+        {
+            if(!parser->end && MzmlTagIs(parser, "spectrum"))
+            {
+                spectrum = true;
+                mzml_begin_spectrum(parser);
+            }
+        }
+        else if(parser->end && MzmlTagIs(parser, "spectrum"))
+        {
+            mzml_end_spectrum(parser);
+            finished = true;
+            break;
+        }
+        else if(MzmlTagIs(parser, "binaryDataArray"))
+        {
+            array = !parser->end;
+            if(array)
+                mzml_begin_array(parser);
+        }
+        else if(MzmlTagIs(parser, "binary"))
+        {
+            // text of empty element is reset as well and decoded at once
+            if(!parser->end)
+                resetStringInfo(&parser->text);
+            binary = !parser->end && !parser->empty;
+            if(!binary)
+                mzml_decode_array(parser);
+        }
+        else if(MzmlTagIs(parser, "cvParam") && array)
+            mzml_array_parameter(parser);
+        else if(MzmlTagIs(parser, "cvParam") || MzmlTagIs(parser, "userParam"))
+            mzml_set_parameter(parser);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if(!spectrum)
+        return false;
+
+    if(!finished)
+        mzml_unexpected_end();
+
+    if(parser->progress)
+    {
+        progress_update(PROGRESS_PGMS_RECORDS_PARSED, ++parser->records);
+        progress_update(PROGRESS_PGMS_BYTES_PROCESSED, parser->offset + parser->pos);
+    }
+
+    return true;
+}
+
+static Datum mzml_srf(FunctionCallInfo fcinfo, MzmlOpen open)
+{
+    FuncCallContext *funcctx = NULL;
+    MzmlParser *parser = NULL;
+    bool next = false;
+
+    if(SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext = NULL;
+        TupleDesc tuple_desc = NULL;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if(get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+                , errmsg("unsupported return type")));
+
+        if(!OidIsValid(spectrumOid))
+            spectrumOid = TypenameGetTypid("spectrum");
+
+        funcctx->attinmeta = TupleDescGetAttInMetadata(tuple_desc);
+        parser = mzml_init(open(fcinfo), funcctx->attinmeta);
+        if(parser->progress)
+            progress_end_at_shutdown(fcinfo);
+        if(PG_NARGS() > 1)
+            parser->filter = spectrum_filter_parse(&PG_GETARG_JSONB_P(1)->root);
+        funcctx->user_fctx = (void*) parser;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    parser = (MzmlParser*) funcctx->user_fctx;
+
+    PG_TRY();
+    {
+        next = mzml_next(parser);
+    }
+    PG_CATCH();
+    {
+        mzml_close(parser);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    if(next)
+    {
+        HeapTuple tuple = heap_form_tuple(funcctx->attinmeta->tupdesc, parser->values, parser->isnull);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    mzml_close(parser);
+    SRF_RETURN_DONE(funcctx);
+}
+
+static Reader *mzml_open_lo(FunctionCallInfo fcinfo)
+{
+    return reader_open_lo(PG_GETARG_OID(0));
+}
+
+static Reader *mzml_open_file(FunctionCallInfo fcinfo)
+{
+    return reader_open_file(text_to_cstring(PG_GETARG_TEXT_PP(0)));
+}
+
+PG_FUNCTION_INFO_V1(load_mzml_lo);
+Datum load_mzml_lo(PG_FUNCTION_ARGS)
+{
+    return mzml_srf(fcinfo, mzml_open_lo);
+}
+
+PG_FUNCTION_INFO_V1(load_mzml_file);
+Datum load_mzml_file(PG_FUNCTION_ARGS)
+{
+    return mzml_srf(fcinfo, mzml_open_file);
+}
@@ -1,17 +1,22 @@
 #include <postgres.h>
+#include <miscadmin.h>
 #include <plpgsql.h>
 
+#include <access/xact.h>
 #include <catalog/pg_type.h>
 #include <catalog/namespace.h>
 #include <utils/syscache.h>
 
+#include "library_cache.h"
 #include "spectrum.h"
+#include "sweep_join.h"
 
 PG_MODULE_MAGIC;
 
 void _PG_init()
 {
-    Oid spaceid = LookupExplicitNamespace("pgms", true);
+    // catalog is not accessible when preloaded
+    Oid spaceid = IsTransactionState() ? LookupExplicitNamespace("pgms", true) : InvalidOid;
     if(OidIsValid(spaceid))
     {
 #if PG_VERSION_NUM >= 120000
@@ -20,4 +25,7 @@ void _PG_init()
         spectrumOid = GetSysCacheOid2(TYPENAMENSP, PointerGetDatum("spectrum"), ObjectIdGetDatum(spaceid));
 #endif
     }
+
+    sweep_join_init();
+    library_cache_init();
 }
@@ -0,0 +1,113 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Progress reporting
+ *
+ * Imports and library searches report their progress through the backend
+ * progress infrastructure. There is no command slot for extensions, so the
+ * COPY slot is used with byte and row counters at the positions of COPY and
+ * pgms counters marked by PROGRESS_PGMS_COMMAND. Available since PostgreSQL
+ * 14, reporting is a no-op on older servers.
+ *
+ * Reporting is not nested, the outermost pgms command of the statement owns
+ * it and the inner ones only update its counters. Set returning functions
+ * abandoned before their last row (e.g. under LIMIT) end their progress at
+ * the shutdown of the calling expression context.
+ */
+
+#include "progress.h"
+
+#include <access/xact.h>
+#include <executor/executor.h>
+#if PG_VERSION_NUM >= 140000
+#include <commands/progress.h>
+#include <utils/backend_progress.h>
+#include <utils/backend_status.h>
+
+static bool progress_active = false;
+static TimestampTz progress_statement = 0;
+static uint32 progress_generation = 0;
+
+static void progress_shutdown(Datum arg)
+{
+    // the command ended already or other one took the reporting over
+    if(progress_active && progress_generation == DatumGetUInt32(arg))
+        progress_end();
+}
+#endif
+
+bool progress_start(int command, Oid relid)
+{
+#if PG_VERSION_NUM >= 140000
+    bool own = progress_active && MyBEEntry && MyBEEntry->st_progress_command == PROGRESS_COMMAND_COPY
+        && MyBEEntry->st_progress_param[PROGRESS_PGMS_COMMAND] != 0;
+
+    if(own && progress_statement == GetCurrentStatementStartTimestamp())
+        return false;
+
+    if(!own && MyBEEntry && MyBEEntry->st_progress_command != PROGRESS_COMMAND_INVALID)
+    { // progress of other command
+        progress_active = false;
+        return false;
+    }
+
+    pgstat_progress_start_command(PROGRESS_COMMAND_COPY, relid);
+    pgstat_progress_update_param(PROGRESS_PGMS_COMMAND, command);
+
+    if(command == PROGRESS_PGMS_COMMAND_IMPORT)
+    {
+        const int index[] = {PROGRESS_COPY_COMMAND, PROGRESS_COPY_TYPE};
+        const int64 values[] = {PROGRESS_COPY_COMMAND_FROM, PROGRESS_COPY_TYPE_CALLBACK};
+
+        pgstat_progress_update_multi_param(2, index, values);
+    }
+
+    progress_active = true;
+    progress_statement = GetCurrentStatementStartTimestamp();
+    progress_generation++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void progress_update(int index, int64 value)
+{
+#if PG_VERSION_NUM >= 140000
+    if(progress_active)
+        pgstat_progress_update_param(index, value);
+#endif
+}
+
+void progress_end(void)
+{
+#if PG_VERSION_NUM >= 140000
+    progress_active = false;
+    pgstat_progress_end_command();
+#endif
+}
+
+void progress_end_at_shutdown(FunctionCallInfo fcinfo)
+{
+#if PG_VERSION_NUM >= 140000
+    ReturnSetInfo *rsinfo = (ReturnSetInfo*) fcinfo->resultinfo;
+
+    if(progress_active && rsinfo && IsA(rsinfo, ReturnSetInfo))
+        RegisterExprContextCallback(rsinfo->econtext, progress_shutdown, UInt32GetDatum(progress_generation));
+#endif
+}
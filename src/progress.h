@@ -0,0 +1,42 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <postgres.h>
+#include <fmgr.h>
+
+// pgms commands report progress in COPY slots, see pgms.stat_progress view
+#define PROGRESS_PGMS_BYTES_PROCESSED   0
+#define PROGRESS_PGMS_BYTES_TOTAL       1
+#define PROGRESS_PGMS_ROWS_INSERTED     2
+#define PROGRESS_PGMS_RECORDS_PARSED    10
+#define PROGRESS_PGMS_ROWS_SCANNED      11
+#define PROGRESS_PGMS_ROWS_SCORED       12
+#define PROGRESS_PGMS_ROWS_TOTAL        13
+#define PROGRESS_PGMS_COMMAND           19
+
+#define PROGRESS_PGMS_COMMAND_IMPORT    1
+#define PROGRESS_PGMS_COMMAND_SEARCH    2
+
+bool progress_start(int command, Oid relid);
+void progress_update(int index, int64 value);
+void progress_end(void);
+void progress_end_at_shutdown(FunctionCallInfo fcinfo);
+
+#endif /* PROGRESS_H_ */
@@ -0,0 +1,517 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "reader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <catalog/pg_authid.h>
+#include <libpq/libpq-fs.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <storage/fd.h>
+#include <storage/large_object.h>
+#include <utils/acl.h>
+#include <utils/memutils.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#if PG_VERSION_NUM < 140000
+#define ROLE_PG_READ_SERVER_FILES   DEFAULT_ROLE_READ_SERVER_FILES
+#define ROLE_PG_WRITE_SERVER_FILES  DEFAULT_ROLE_WRITE_SERVER_FILES
+#endif
+
+#define DECOMPRESS_BUFFER_SIZE      (1 << 18) //256kB
+#define MAGIC_SIZE                  4
+
+static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+typedef enum
+{
+    COMPRESSION_GZIP    = 0,
+    COMPRESSION_ZSTD    = 1,
+}
+CompressionMethod;
+
+/*
+ * Decompresses stream of the source reader into the caller's buffer, only
+ * one input buffer is kept so memory is bounded regardless of input size.
+ */
+typedef struct DecompressReader
+{
+    Reader              reader;
+    Reader              *source;
+    CompressionMethod   method;
+    char                *input;
+    size_t              input_size;
+    size_t              input_pos;
+    bool                finished;
+#ifdef HAVE_LIBZ
+    z_stream            zstream;
+#endif
+#ifdef USE_ZSTD
+    ZSTD_DStream        *zstd;
+    bool                zstd_frame_end; // the last frame was completely decoded and flushed
+#endif
+} DecompressReader;
+
+typedef struct LargeObjectReader
+{
+    Reader              reader;
+    LargeObjectDesc     *desc;
+} LargeObjectReader;
+
+typedef struct FileReader
+{
+    Reader              reader;
+    int                 fd;
+    char                *path;
+    off_t               offset;
+    off_t               size;
+} FileReader;
+
+static size_t lo_reader_read(Reader *reader, char *buffer, size_t size)
+{
+    return inv_read(((LargeObjectReader*) reader)->desc, buffer, size);
+}
+
+static void lo_reader_seek(Reader *reader, int64 offset)
+{
+    inv_seek(((LargeObjectReader*) reader)->desc, offset, SEEK_SET);
+}
+
+static int64 lo_reader_size(Reader *reader)
+{
+    LargeObjectDesc *desc = ((LargeObjectReader*) reader)->desc;
+    int64 offset = inv_tell(desc);
+    int64 size = inv_seek(desc, 0, SEEK_END);
+
+    inv_seek(desc, offset, SEEK_SET);
+    return size;
+}
+
+static void lo_reader_close(Reader *reader)
+{
+    close_lo_relation(true);
+    inv_close(((LargeObjectReader*) reader)->desc);
+    pfree(reader);
+}
+
+static bool decompress_fill(DecompressReader *reader)
+{
+    if(reader->input_pos < reader->input_size)
+        return true;
+
+    reader->input_pos = 0;
+    reader->input_size = reader_read(reader->source, reader->input, DECOMPRESS_BUFFER_SIZE);
+
+    return reader->input_size > 0;
+}
+
+#ifdef HAVE_LIBZ
+// zlib state lives in memory context, so it is released on error as well
+static voidpf gzip_alloc(voidpf opaque, uInt items, uInt size)
+{
+    return palloc((Size) items * size);
+}
+
+static void gzip_free(voidpf opaque, voidpf address)
+{
+    pfree(address);
+}
+
+static size_t gzip_reader_read(Reader *reader, char *buffer, size_t size)
+{
+    DecompressReader *gzip = (DecompressReader*) reader;
+    size_t n = 0;
+
+    while(n < size && !gzip->finished)
+    {
+        int ret = Z_OK;
+
+        if(!decompress_fill(gzip))
+        {
+            if(gzip->zstream.total_in > 0)
+                ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED)
+                    , errmsg("unexpected end of gzip compressed input")));
+
+            gzip->finished = true;
+            break;
+        }
+
+        gzip->zstream.next_in = (Bytef*) gzip->input + gzip->input_pos;
+        gzip->zstream.avail_in = gzip->input_size - gzip->input_pos;
+        gzip->zstream.next_out = (Bytef*) buffer + n;
+        gzip->zstream.avail_out = size - n;
+
+        ret = inflate(&gzip->zstream, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED)
+                , errmsg("could not decompress gzip input: %s", gzip->zstream.msg ? gzip->zstream.msg : "unknown error")));
+
+        n = size - gzip->zstream.avail_out;
+        gzip->input_pos = gzip->input_size - gzip->zstream.avail_in;
+
+        if(ret == Z_STREAM_END)
+        { // concatenated members continue, otherwise stream ends here
+            if(!decompress_fill(gzip))
+                gzip->finished = true;
+            else
+                inflateReset(&gzip->zstream);
+        }
+    }
+
+    return n;
+}
+#endif
+
+#ifdef USE_ZSTD
+static size_t zstd_reader_read(Reader *reader, char *buffer, size_t size)
+{
+    DecompressReader *zstd = (DecompressReader*) reader;
+    ZSTD_outBuffer output = {buffer, size, 0};
+
+    while(output.pos < size && !zstd->finished)
+    {
+        ZSTD_inBuffer input;
+        size_t ret = 0;
+
+        // a frame may end exactly when the previous call filled the buffer
+        if(!decompress_fill(zstd))
+        {
+            if(!zstd->zstd_frame_end)
+                ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED)
+                    , errmsg("unexpected end of zstd compressed input")));
+
+            zstd->finished = true;
+            break;
+        }
+
+        input.src = zstd->input;
+        input.size = zstd->input_size;
+        input.pos = zstd->input_pos;
+
+        ret = ZSTD_decompressStream(zstd->zstd, &output, &input);
+        if(ZSTD_isError(ret))
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED)
+                , errmsg("could not decompress zstd input: %s", ZSTD_getErrorName(ret))));
+
+        zstd->zstd_frame_end = ret == 0;
+        zstd->input_pos = input.pos;
+    }
+
+    return output.pos;
+}
+#endif
+
+static void decompress_reader_close(Reader *reader)
+{
+    DecompressReader *decompress = (DecompressReader*) reader;
+
+#ifdef HAVE_LIBZ
+    if(decompress->method == COMPRESSION_GZIP)
+        inflateEnd(&decompress->zstream);
+#endif
+#ifdef USE_ZSTD
+    if(decompress->method == COMPRESSION_ZSTD)
+        ZSTD_freeDStream(decompress->zstd);
+#endif
+
+    reader_close(decompress->source);
+    pfree(decompress->input);
+    pfree(decompress);
+}
+
+/*
+ * Wraps the source by decompressing reader when it starts with gzip or zstd
+ * magic bytes. Compressed stream can not be seeked, so it can not be split.
+ */
+static Reader *reader_decompress(Reader *source)
+{
+    unsigned char magic[MAGIC_SIZE];
+    size_t n = reader_read(source, (char*) magic, MAGIC_SIZE);
+    DecompressReader *reader = NULL;
+
+    reader_seek(source, 0);
+
+    if(n >= sizeof(gzip_magic) && !memcmp(magic, gzip_magic, sizeof(gzip_magic)))
+    {
+#ifdef HAVE_LIBZ
+        reader = palloc0(sizeof(DecompressReader));
+        reader->method = COMPRESSION_GZIP;
+        reader->reader.read = gzip_reader_read;
+        reader->zstream.zalloc = gzip_alloc;
+        reader->zstream.zfree = gzip_free;
+
+        // 32 enables gzip header detection
+        if(inflateInit2(&reader->zstream, 15 + 32) != Z_OK)
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY)
+                , errmsg("could not initialize gzip decompression")));
+#else
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("gzip compressed input is not supported by this build")));
+#endif
+    }
+    else if(n >= sizeof(zstd_magic) && !memcmp(magic, zstd_magic, sizeof(zstd_magic)))
+    {
+#ifdef USE_ZSTD
+        reader = palloc0(sizeof(DecompressReader));
+        reader->method = COMPRESSION_ZSTD;
+        reader->reader.read = zstd_reader_read;
+        reader->zstd = ZSTD_createDStream();
+
+        if(reader->zstd == NULL || ZSTD_isError(ZSTD_initDStream(reader->zstd)))
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY)
+                , errmsg("could not initialize zstd decompression")));
+#else
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED)
+            , errmsg("zstd compressed input is not supported by this build")));
+#endif
+    }
+    else
+        return source;
+
+    reader->reader.seek = NULL;
+    reader->reader.size = NULL;
+    reader->reader.close = decompress_reader_close;
+    reader->source = source;
+    reader->input = palloc(DECOMPRESS_BUFFER_SIZE);
+    elog(DEBUG1, "reader: %s compressed input", reader->method == COMPRESSION_GZIP ? "gzip" : "zstd");
+
+    return &reader->reader;
+}
+
+Reader *reader_open_lo(Oid loid)
+{
+    LargeObjectReader *reader = palloc0(sizeof(LargeObjectReader));
+
+    reader->reader.read = lo_reader_read;
+    reader->reader.seek = lo_reader_seek;
+    reader->reader.size = lo_reader_size;
+    reader->reader.close = lo_reader_close;
+    reader->desc = inv_open(loid, INV_READ, CurrentMemoryContext);
+
+    return reader_decompress(&reader->reader);
+}
+
+static size_t file_reader_read(Reader *reader, char *buffer, size_t size)
+{
+    FileReader *file = (FileReader*) reader;
+    ssize_t n = 0;
+
+#if defined(USE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+    // ask kernel for the next block while the current one is parsed
+    if(file->offset + (off_t) size < file->size)
+        (void) posix_fadvise(file->fd, file->offset + size, size, POSIX_FADV_WILLNEED);
+#endif
+
+    pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_READ);
+    n = pg_pread(file->fd, buffer, size, file->offset);
+    pgstat_report_wait_end();
+
+    if(n < 0)
+        ereport(ERROR, (errcode_for_file_access()
+            , errmsg("could not read file \"%s\": %m", file->path)));
+
+    file->offset += n;
+    return n;
+}
+
+static void file_reader_seek(Reader *reader, int64 offset)
+{
+    ((FileReader*) reader)->offset = offset;
+}
+
+static int64 file_reader_size(Reader *reader)
+{
+    return ((FileReader*) reader)->size;
+}
+
+static void file_reader_close(Reader *reader)
+{
+    FileReader *file = (FileReader*) reader;
+
+    CloseTransientFile(file->fd);
+    pfree(file->path);
+    pfree(file);
+}
+
+Reader *reader_open_file(const char *path)
+{
+    FileReader *reader = NULL;
+    struct stat st;
+
+    if(!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE)
+            , errmsg("permission denied to read server file")
+            , errhint("Only roles with privileges of the \"pg_read_server_files\" role may read files on the server.")));
+
+    reader = palloc0(sizeof(FileReader));
+    reader->reader.read = file_reader_read;
+    reader->reader.seek = file_reader_seek;
+    reader->reader.size = file_reader_size;
+    reader->reader.close = file_reader_close;
+    reader->path = pstrdup(path);
+    // transient files are closed at the end of transaction in case of error
+    reader->fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+
+    if(reader->fd < 0)
+        ereport(ERROR, (errcode_for_file_access()
+            , errmsg("could not open file \"%s\": %m", path)));
+
+    if(fstat(reader->fd, &st) < 0)
+        ereport(ERROR, (errcode_for_file_access()
+            , errmsg("could not stat file \"%s\": %m", path)));
+
+    if(S_ISDIR(st.st_mode))
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE)
+            , errmsg("\"%s\" is a directory", path)));
+
+    reader->size = st.st_size;
+
+#if defined(USE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+    // doubles the kernel readahead window
+    (void) posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return reader_decompress(&reader->reader);
+}
+
+typedef struct LargeObjectWriter
+{
+    Writer              writer;
+    LargeObjectDesc     *desc;
+} LargeObjectWriter;
+
+typedef struct FileWriter
+{
+    Writer              writer;
+    int                 fd;
+    char                *path;
+} FileWriter;
+
+static void lo_writer_write(Writer *writer, const char *buffer, size_t size)
+{
+    while(size > 0)
+    {
+        int n = inv_write(((LargeObjectWriter*) writer)->desc, buffer, Min(size, MaxAllocSize));
+
+        buffer += n;
+        size -= n;
+    }
+}
+
+static void lo_writer_close(Writer *writer)
+{
+    close_lo_relation(true);
+    inv_close(((LargeObjectWriter*) writer)->desc);
+    pfree(writer);
+}
+
+/*
+ * Overwrites content of existing Large Object, privileges are checked by
+ * inv_open() as for lo_open().
+ */
+Writer *writer_open_lo(Oid loid)
+{
+    LargeObjectWriter *writer = palloc0(sizeof(LargeObjectWriter));
+
+    writer->writer.write = lo_writer_write;
+    writer->writer.close = lo_writer_close;
+    writer->desc = inv_open(loid, INV_WRITE, CurrentMemoryContext);
+    inv_truncate(writer->desc, 0);
+
+    return &writer->writer;
+}
+
+static void file_writer_write(Writer *writer, const char *buffer, size_t size)
+{
+    FileWriter *file = (FileWriter*) writer;
+
+    while(size > 0)
+    {
+        ssize_t n = 0;
+
+        errno = 0;
+        pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_WRITE);
+        n = write(file->fd, buffer, size);
+        pgstat_report_wait_end();
+
+        if(n <= 0)
+        {
+            // no error set by write means no space left on device
+            if(errno == 0)
+                errno = ENOSPC;
+            ereport(ERROR, (errcode_for_file_access()
+                , errmsg("could not write file \"%s\": %m", file->path)));
+        }
+
+        buffer += n;
+        size -= n;
+    }
+}
+
+static void file_writer_close(Writer *writer)
+{
+    FileWriter *file = (FileWriter*) writer;
+
+    if(CloseTransientFile(file->fd) != 0)
+        ereport(ERROR, (errcode_for_file_access()
+            , errmsg("could not close file \"%s\": %m", file->path)));
+
+    pfree(file->path);
+    pfree(file);
+}
+
+/*
+ * Creates or truncates server file, the path has to be absolute as for
+ * COPY TO.
+ */
+Writer *writer_open_file(const char *path)
+{
+    FileWriter *writer = NULL;
+
+    if(!has_privs_of_role(GetUserId(), ROLE_PG_WRITE_SERVER_FILES))
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE)
+            , errmsg("permission denied to write server file")
+            , errhint("Only roles with privileges of the \"pg_write_server_files\" role may write files on the server.")));
+
+    if(!is_absolute_path(path))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_NAME)
+            , errmsg("relative path not allowed for server file")));
+
+    writer = palloc0(sizeof(FileWriter));
+    writer->writer.write = file_writer_write;
+    writer->writer.close = file_writer_close;
+    writer->path = pstrdup(path);
+    // transient files are closed at the end of transaction in case of error
+    writer->fd = OpenTransientFilePerm(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if(writer->fd < 0)
+        ereport(ERROR, (errcode_for_file_access()
+            , errmsg("could not open file \"%s\" for writing: %m", path)));
+
+    return &writer->writer;
+}
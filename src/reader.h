@@ -0,0 +1,58 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+#include <postgres.h>
+
+/*
+ * Sequential byte source of the parsers. Seek is supported by sources which
+ * can be split for parallel processing, it is NULL otherwise.
+ */
+typedef struct Reader
+{
+    size_t  (*read)(struct Reader *reader, char *buffer, size_t size);
+    void    (*seek)(struct Reader *reader, int64 offset);
+    int64   (*size)(struct Reader *reader);
+    void    (*close)(struct Reader *reader);
+} Reader;
+
+#define reader_read(r, b, s)    ((r)->read((r), (b), (s)))
+#define reader_seek(r, o)       ((r)->seek((r), (o)))
+#define reader_size(r)          ((r)->size((r)))
+#define reader_close(r)         ((r)->close((r)))
+
+Reader *reader_open_lo(Oid loid);
+Reader *reader_open_file(const char *path);
+
+/*
+ * Sequential byte sink of the exporters.
+ */
+typedef struct Writer
+{
+    void    (*write)(struct Writer *writer, const char *buffer, size_t size);
+    void    (*close)(struct Writer *writer);
+} Writer;
+
+#define writer_write(w, b, s)   ((w)->write((w), (b), (s)))
+#define writer_close(w)         ((w)->close((w)))
+
+Writer *writer_open_lo(Oid loid);
+Writer *writer_open_file(const char *path);
+
+#endif /* READER_H_ */
@@ -19,40 +19,429 @@
 #include <postgres.h>
 #include "spectrum.h"
 
+#include <access/gist.h>
 #include <catalog/pg_type.h>
+#include <common/shortest_dec.h>
+#include <lib/stringinfo.h>
 #include <utils/lsyscache.h>
+#include <math.h>
 #include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/memutils.h>
+#include <utils/numeric.h>
+#include <utils/rangetypes.h>
+#include <utils/syscache.h>
+
+#define SPECTRUM_MAX_EXACT_MANTISSA     (UINT64CONST(1) << 53)
+#define SPECTRUM_MAX_EXACT_EXPONENT     22
+
+// on-disk numeric layout, mirrors the private definitions of utils/adt/numeric.c
+#define NUMERIC_BASE                    10000
+#define NUMERIC_BASE_DIGITS             4
+#define NUMERIC_SIGN_MASK               0xC000
+#define NUMERIC_NEG                     0x4000
+#define NUMERIC_SHORT                   0x8000
+#define NUMERIC_SPECIAL                 0xC000
+#define NUMERIC_SHORT_SIGN_MASK         0x2000
+#define NUMERIC_SHORT_WEIGHT_SIGN_MASK  0x0040
+#define NUMERIC_SHORT_WEIGHT_MASK       0x003F
+
+static const double powers_of_ten[SPECTRUM_MAX_EXACT_EXPONENT + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
 Oid spectrumOid;
 
+// float4[] input or output function for literals the fast paths do not handle
+static FmgrInfo *spectrum_array_function(FunctionCallInfo fcinfo, bool input)
+{
+    FmgrInfo *info = (FmgrInfo *) fcinfo->flinfo->fn_extra;
+
+    if(info == NULL)
+    {
+        Oid funcid = InvalidOid;
+        Oid ioparams = InvalidOid;
+        bool varlena = false;
+
+        if(input)
+            getTypeInputInfo(FLOAT4ARRAYOID, &funcid, &ioparams);
+        else
+            getTypeOutputInfo(FLOAT4ARRAYOID, &funcid, &varlena);
+
+        info = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(FmgrInfo));
+        fmgr_info_cxt(funcid, info, fcinfo->flinfo->fn_mcxt);
+        fcinfo->flinfo->fn_extra = info;
+    }
+
+    return info;
+}
+
+static dummyret spectrum_syntax_error(const char *data, const char *detail)
+{
+    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION)
+        , errmsg("malformed spectrum literal: \"%s\"", data)
+        , errdetail("%s", detail)));
+}
+
+static inline const char *spectrum_skip_space(const char *p)
+{
+    while(isspace((uint8) *p))
+        p++;
+    return p;
+}
+
+// one float4 token, exotic notations (NaN, Infinity, long mantissa) are left to float4in()
+static const char *spectrum_parse_value(const char *data, const char *p, float4 *value)
+{
+    const char *begin = p;
+
+    while(*p && *p != ',' && *p != '}' && *p != ':' && !isspace((uint8) *p))
+        p++;
+
+    if(p == begin)
+        spectrum_syntax_error(data, "Number expected.");
+
+    if(p - begin == 4 && !pg_strncasecmp(begin, "NULL", 4))
+        spectrum_syntax_error(data, "Spectrum values must not be null.");
+
+    // suffix sign is MGF notation, not accepted in literals
+    if(p[-1] == '+' || p[-1] == '-' || !spectrum_parse_float4(begin, p, value))
+        *value = DatumGetFloat4(DirectFunctionCall1(float4in, CStringGetDatum(pnstrdup(begin, p - begin))));
+
+    return p;
+}
+
+static inline void spectrum_grow(float4 **mzs, float4 **intensities, size_t *size, size_t count)
+{
+    if(count < *size)
+        return;
+
+    *size *= 2;
+    *mzs = repalloc(*mzs, *size * sizeof(float4));
+    if(intensities)
+        *intensities = repalloc(*intensities, *size * sizeof(float4));
+}
+
+// comma separated values of one {...} row, p points after the opening brace
+static const char *spectrum_parse_row(const char *data, const char *p, float4 **values, size_t *size, size_t *count)
+{
+    *count = 0;
+    p = spectrum_skip_space(p);
+
+    if(*p == '}')
+        return p + 1;
+
+    while(true)
+    {
+        spectrum_grow(values, NULL, size, *count);
+        p = spectrum_parse_value(data, p, &(*values)[(*count)++]);
+        p = spectrum_skip_space(p);
+
+        if(*p == '}')
+            return p + 1;
+        if(*p != ',')
+            spectrum_syntax_error(data, "Unexpected character, \",\" or \"}\" expected.");
+
+        p = spectrum_skip_space(p + 1);
+    }
+}
+
+/*
+ * Array notation {{mz, ...}, {intensity, ...}} parsed into one buffer per
+ * row, rows have to be of the same length. Peak order is kept as given.
+ */
+static Datum spectrum_parse_array(const char *data, const char *p)
+{
+    size_t mzs_size = 64;
+    size_t intensities_size = 64;
+    float4 *mzs = palloc(mzs_size * sizeof(float4));
+    float4 *intensities = palloc(intensities_size * sizeof(float4));
+    size_t mzs_count = 0;
+    size_t intensities_count = 0;
+    Datum result = 0;
+
+    // p points to the inner opening brace of m/z row
+    p = spectrum_parse_row(data, p + 1, &mzs, &mzs_size, &mzs_count);
+    p = spectrum_skip_space(p);
+    if(*p != ',')
+        spectrum_syntax_error(data, "Spectrum must have rows of m/z and intensity values.");
+
+    p = spectrum_skip_space(p + 1);
+    if(*p != '{')
+        spectrum_syntax_error(data, "Spectrum must have rows of m/z and intensity values.");
+
+    p = spectrum_parse_row(data, p + 1, &intensities, &intensities_size, &intensities_count);
+    p = spectrum_skip_space(p);
+    if(*p != '}' || *spectrum_skip_space(p + 1) != '\0')
+        spectrum_syntax_error(data, "Spectrum must have rows of m/z and intensity values.");
+
+    if(mzs_count != intensities_count)
+        spectrum_syntax_error(data, "Rows of m/z and intensity values differ in length.");
+
+    result = mzs_count ? spectrum_build(mzs, intensities, mzs_count) : PointerGetDatum(construct_empty_array(FLOAT4OID));
+
+    pfree(mzs);
+    pfree(intensities);
+    return result;
+}
+
+/*
+ * Compact notation "mz:intensity mz:intensity ..." with pairs separated by
+ * spaces or commas, m/z has to be ascending.
+ */
+static Datum spectrum_parse_peaks(const char *data, const char *p)
+{
+    size_t size = 64;
+    float4 *mzs = palloc(size * sizeof(float4));
+    float4 *intensities = palloc(size * sizeof(float4));
+    size_t count = 0;
+    Datum result = 0;
+
+    for(p = spectrum_skip_space(p); *p; p = spectrum_skip_space(p))
+    {
+        spectrum_grow(&mzs, &intensities, &size, count);
+        p = spectrum_parse_value(data, p, &mzs[count]);
+
+        if(*p != ':')
+            spectrum_syntax_error(data, "Peak must be written as mz:intensity.");
+
+        p = spectrum_parse_value(data, p + 1, &intensities[count]);
+
+        if(count > 0 && mzs[count] < mzs[count - 1])
+            spectrum_syntax_error(data, "Peaks must be sorted by m/z.");
+
+        count++;
+        p = spectrum_skip_space(p);
+        if(*p == ',')
+            p++;
+    }
+
+    result = count ? spectrum_build(mzs, intensities, count) : PointerGetDatum(construct_empty_array(FLOAT4OID));
+
+    pfree(mzs);
+    pfree(intensities);
+    return result;
+}
+
 PG_FUNCTION_INFO_V1(spectrum_input);
 Datum spectrum_input(PG_FUNCTION_ARGS)
 {
     char *data = PG_GETARG_CSTRING(0);
-    Oid	infuncid;
-    Oid ioparams;
-    FmgrInfo infuncinfo;
+    const char *p = spectrum_skip_space(data);
+    const char *inner = *p == '{' ? spectrum_skip_space(p + 1) : p;
 
-    elog(DEBUG1, "spectrum_input: %s", data);
-    getTypeInputInfo(FLOAT4ARRAYOID, &infuncid, &ioparams);
-    fmgr_info(infuncid, &infuncinfo);
-    elog(DEBUG1, "in_fnc(%d), ioparams(%d)",infuncid, ioparams);
-    PG_RETURN_DATUM(InputFunctionCall(&infuncinfo, data, ioparams, -1));
+    // two row array literal and peak list have dedicated parsers
+    if(*p == '{' && *inner == '{' && strchr(data, '"') == NULL)
+        PG_RETURN_DATUM(spectrum_parse_array(data, inner));
+    else if(*p != '{' && *p != '[')
+        PG_RETURN_DATUM(spectrum_parse_peaks(data, p));
+
+    // empty, one dimensional, quoted or dimension decorated literals as float4[]
+    PG_RETURN_DATUM(InputFunctionCall(spectrum_array_function(fcinfo, true), data, FLOAT4OID, -1));
 }
 
+static inline void spectrum_format_row(StringInfo buffer, const float4 *values, size_t len)
+{
+    appendStringInfoCharMacro(buffer, '{');
+
+    for(size_t i = 0; i < len; i++)
+    {
+        if(i)
+            appendStringInfoCharMacro(buffer, ',');
+        buffer->len += float_to_shortest_decimal_bufn(values[i], buffer->data + buffer->len);
+    }
+
+    appendStringInfoCharMacro(buffer, '}');
+}
 
 PG_FUNCTION_INFO_V1(spectrum_output);
 Datum spectrum_output(PG_FUNCTION_ARGS)
 {
-    Oid	outfuncid;
-    bool ioparams;
-    FmgrInfo outfuncinfo;
+    Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    ArrayType *array = DatumGetArrayTypeP(spectrum);
+    StringInfoData buffer;
+    size_t len = 0;
+    float4 *mzs = NULL;
+
+    // float4out() prints shortest exact text only for positive extra_float_digits
+    if(ARR_NDIM(array) != 2 || ARR_DIMS(array)[0] != 2 || ARR_HASNULL(array)
+        || ARR_LBOUND(array)[0] != 1 || ARR_LBOUND(array)[1] != 1 || extra_float_digits <= 0)
+        PG_RETURN_CSTRING(OutputFunctionCall(spectrum_array_function(fcinfo, false), spectrum));
+
+    len = ARR_DIMS(array)[1];
+    mzs = (float4 *) ARR_DATA_PTR(array);
+
+    initStringInfo(&buffer);
+    enlargeStringInfo(&buffer, 2 * len * (FLOAT_SHORTEST_DECIMAL_LEN + 1) + 8);
+
+    appendStringInfoCharMacro(&buffer, '{');
+    spectrum_format_row(&buffer, mzs, len);
+    appendStringInfoCharMacro(&buffer, ',');
+    spectrum_format_row(&buffer, mzs + len, len);
+    appendStringInfoCharMacro(&buffer, '}');
+
+    PG_RETURN_CSTRING(buffer.data);
+}
+
+#define SPECTRUM_STRATEGY_OVERLAPS      3
+#define SPECTRUM_STRATEGY_PEAK_WITHIN   7
+
+static Oid spectrumrangeOid = InvalidOid;
+
+// spectrumrange is looked up in the schema of the calling function
+static Oid spectrum_range_type(FunctionCallInfo fcinfo)
+{
+    if(!OidIsValid(spectrumrangeOid))
+    {
+        Oid namespace = get_func_namespace(fcinfo->flinfo->fn_oid);
+
+        spectrumrangeOid = GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid, CStringGetDatum("spectrumrange"), ObjectIdGetDatum(namespace));
+
+        if(!OidIsValid(spectrumrangeOid))
+            elog(ERROR, "type spectrumrange does not exist");
+    }
+
+    return spectrumrangeOid;
+}
+
+/*
+ * Range from the lowest to the highest m/z. Peaks of array literals need not
+ * be sorted, so the whole m/z row is scanned; the spectrum without peaks
+ * gives the empty range.
+ */
+static RangeType *spectrum_span(TypeCacheEntry *typcache, Datum spectrum, bool lower_inc, bool upper_inc)
+{
+    size_t len = spectrum_length(spectrum);
+    float4 *mzs = spectrum_data(spectrum);
+    RangeBound lower = {0};
+    RangeBound upper = {0};
+    float4 min = len ? mzs[0] : 0;
+    float4 max = len ? mzs[0] : 0;
+
+    for(size_t i = 1; i < len; i++)
+    {
+        min = Min(min, mzs[i]);
+        max = Max(max, mzs[i]);
+    }
+
+    lower.val = Float4GetDatum(min);
+    lower.inclusive = lower_inc;
+    lower.lower = true;
+    upper.val = Float4GetDatum(max);
+    upper.inclusive = upper_inc;
+    upper.lower = false;
+
+#if PG_VERSION_NUM >= 160000
+    return make_range(typcache, &lower, &upper, len == 0, NULL);
+#else
+    return make_range(typcache, &lower, &upper, len == 0);
+#endif
+}
+
+PG_FUNCTION_INFO_V1(spectrum_range);
+Datum spectrum_range(PG_FUNCTION_ARGS)
+{
+    Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    text *bounds = PG_GETARG_TEXT_PP(1);
+    const char *flags = VARDATA_ANY(bounds);
+    int flags_len = VARSIZE_ANY_EXHDR(bounds);
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, get_fn_expr_rettype(fcinfo->flinfo));
+
+    if(flags_len < 2 || (flags[0] != '[' && flags[0] != '(') || (flags[flags_len - 1] != ']' && flags[flags_len - 1] != ')'))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE)
+            , errmsg("invalid range bounds flags")
+            , errhint("Valid values are \"[]\", \"[)\", \"(]\", and \"()\".")));
+
+    if(spectrum_length(spectrum) == 0)
+        PG_RETURN_NULL();
+
+    PG_RETURN_RANGE_P(spectrum_span(typcache, spectrum, flags[0] == '[', flags[flags_len - 1] == ']'));
+}
+
+PG_FUNCTION_INFO_V1(spectrum_overlaps);
+Datum spectrum_overlaps(PG_FUNCTION_ARGS)
+{
+    Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    RangeType *window = PG_GETARG_RANGE_P(1);
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(window));
+
+    PG_RETURN_BOOL(range_overlaps_internal(typcache, spectrum_span(typcache, spectrum, true, true), window));
+}
+
+PG_FUNCTION_INFO_V1(spectrum_peak_within);
+Datum spectrum_peak_within(PG_FUNCTION_ARGS)
+{
+    Datum spectrum = PointerGetDatum(PG_DETOAST_DATUM(PG_GETARG_DATUM(0)));
+    RangeType *window = PG_GETARG_RANGE_P(1);
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(window));
+    size_t len = spectrum_length(spectrum);
+    float4 *mzs = spectrum_data(spectrum);
+    RangeBound lower;
+    RangeBound upper;
+    bool empty = false;
 
-    elog(DEBUG1, "spectrum_output");
-    getTypeOutputInfo(FLOAT4ARRAYOID, &outfuncid, &ioparams);
-    fmgr_info(outfuncid, &outfuncinfo);
-    elog(DEBUG1, "out_fnc(%d), ioparams(%d)",outfuncid, ioparams);
-    PG_RETURN_CSTRING(OutputFunctionCall(&outfuncinfo, PG_GETARG_DATUM(0)));
+    range_deserialize(typcache, window, &lower, &upper, &empty);
+
+    if(empty)
+        PG_RETURN_BOOL(false);
+
+    for(size_t i = 0; i < len; i++)
+    {
+        float4 mz = mzs[i];
+
+        if(!lower.infinite && (mz < DatumGetFloat4(lower.val) || (mz == DatumGetFloat4(lower.val) && !lower.inclusive)))
+            continue;
+        if(!upper.infinite && (mz > DatumGetFloat4(upper.val) || (mz == DatumGetFloat4(upper.val) && !upper.inclusive)))
+            continue;
+
+        PG_RETURN_BOOL(true);
+    }
+
+    PG_RETURN_BOOL(false);
+}
+
+/*
+ * GiST index of spectra keyed by their m/z span. Keys are spectrumrange
+ * values, so union, penalty, picksplit and same are the support functions
+ * of range types; only leaf spectra need to be converted.
+ */
+PG_FUNCTION_INFO_V1(spectrum_gist_compress);
+Datum spectrum_gist_compress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *result = NULL;
+    TypeCacheEntry *typcache = NULL;
+
+    if(!entry->leafkey)
+        PG_RETURN_POINTER(entry);
+
+    typcache = range_get_typcache(fcinfo, spectrum_range_type(fcinfo));
+    result = palloc(sizeof(GISTENTRY));
+    gistentryinit(*result, RangeTypePGetDatum(spectrum_span(typcache, PointerGetDatum(PG_DETOAST_DATUM(entry->key)), true, true)),
+        entry->rel, entry->page, entry->offset, false);
+
+    PG_RETURN_POINTER(result);
+}
+
+PG_FUNCTION_INFO_V1(spectrum_gist_consistent);
+Datum spectrum_gist_consistent(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    RangeType *window = PG_GETARG_RANGE_P(1);
+    StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    RangeType *key = DatumGetRangeTypeP(entry->key);
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(key));
+
+    // span overlap is exact for leaf keys, peaks inside of the window have to be checked
+    *recheck = strategy == SPECTRUM_STRATEGY_PEAK_WITHIN;
+
+    if(strategy != SPECTRUM_STRATEGY_OVERLAPS && strategy != SPECTRUM_STRATEGY_PEAK_WITHIN)
+        elog(ERROR, "unrecognized strategy number: %d", strategy);
+
+    PG_RETURN_BOOL(range_overlaps_internal(typcache, key, window));
 }
 
 size_t spectrum_length(Datum spectrum)
@@ -69,3 +458,208 @@ extern float4* spectrum_data(Datum spectrum)
     ArrayType *s = DatumGetArrayTypeP(spectrum);
     return (float4 *) ARR_DATA_PTR(s);
 }
+
+bool is_spectrum_type(Oid typid)
+{
+    Oid infuncid;
+    Oid ioparams;
+    FmgrInfo infuncinfo;
+
+    if(OidIsValid(spectrumOid))
+        return typid == spectrumOid;
+
+    if(!OidIsValid(typid) || !get_typisdefined(typid))
+        return false;
+
+    // the type is recognized by its input function
+    getTypeInputInfo(typid, &infuncid, &ioparams);
+    fmgr_info(infuncid, &infuncinfo);
+
+    if(infuncinfo.fn_addr != spectrum_input)
+        return false;
+
+    spectrumOid = typid;
+    return true;
+}
+
+/*
+ * Converts mantissa * 10^exponent to float4 by a single exactly rounded double
+ * operation, false is returned when the operands are not exact or the result
+ * does not fit into float4.
+ */
+static bool spectrum_decimal_float4(uint64 mantissa, int exponent, bool negative, float4 *value)
+{
+    double result = 0.0;
+
+    if(mantissa > SPECTRUM_MAX_EXACT_MANTISSA
+        || exponent < -SPECTRUM_MAX_EXACT_EXPONENT || exponent > SPECTRUM_MAX_EXACT_EXPONENT)
+        return false;
+
+    result = exponent < 0 ? (double) mantissa / powers_of_ten[-exponent] : (double) mantissa * powers_of_ten[exponent];
+    *value = (float4) (negative ? -result : result);
+
+    // out of range values are reported by float4in()
+    if(isinf(*value) || (*value == 0.0f && mantissa != 0))
+        return false;
+
+    return true;
+}
+
+/*
+ * Parses decimal number from [begin, end) without locale and without copying.
+ * Leading sign and MGF suffix sign notation ("1.5-") are accepted. Numbers
+ * having more than 2^53 in mantissa or exponent out of 1e-22 .. 1e22 are not
+ * exactly representable by one double operation and false is returned, the
+ * caller falls back to float4in() then.
+ */
+bool spectrum_parse_float4(const char *begin, const char *end, float4 *value)
+{
+    const char *p = begin;
+    bool negative = false;
+    bool dot = false;
+    uint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    if(p != end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    else if(p != end && (end[-1] == '+' || end[-1] == '-'))
+        negative = *--end == '-';
+
+    for(; p != end; p++)
+    {
+        if(isdigit((uint8) *p))
+        {
+            if(++digits > 19)
+                return false;
+
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent -= dot ? 1 : 0;
+        }
+        else if(*p == '.' && !dot)
+            dot = true;
+        else
+            break;
+    }
+
+    if(digits == 0)
+        return false;
+
+    if(p != end && (*p == 'e' || *p == 'E'))
+    {
+        bool exponent_negative = false;
+        int power = 0;
+
+        if(++p != end && (*p == '+' || *p == '-'))
+            exponent_negative = *p++ == '-';
+
+        if(p == end)
+            return false;
+
+        for(; p != end && isdigit((uint8) *p) && power < 1000; p++)
+            power = power * 10 + (*p - '0');
+
+        exponent += exponent_negative ? -power : power;
+    }
+
+    if(p != end)
+        return false;
+
+    return spectrum_decimal_float4(mantissa, exponent, negative, value);
+}
+
+/*
+ * Converts jsonb/numeric value to float4 straight from its base 10000 digits,
+ * numeric_float4() would print and reparse it. NaN, infinities and values not
+ * exactly convertible (see spectrum_parse_float4()) return false, the caller
+ * falls back to numeric_float4() then.
+ */
+bool spectrum_numeric_float4(Numeric num, float4 *value)
+{
+    uint16 header = 0;
+    bool negative = false;
+    int weight = 0;
+    const int16 *digits = NULL;
+    int ndigits = 0;
+    uint64 mantissa = 0;
+    int exponent = 0;
+
+    // packed short varlena headers are left to numeric_float4()
+    if(VARATT_IS_EXTENDED(num))
+        return false;
+
+    memcpy(&header, VARDATA(num), sizeof(uint16));
+
+    if((header & NUMERIC_SIGN_MASK) == NUMERIC_SPECIAL)
+        return false;
+
+    if((header & NUMERIC_SIGN_MASK) == NUMERIC_SHORT)
+    {
+        negative = (header & NUMERIC_SHORT_SIGN_MASK) != 0;
+        weight = (header & NUMERIC_SHORT_WEIGHT_SIGN_MASK ? ~NUMERIC_SHORT_WEIGHT_MASK : 0)
+            | (header & NUMERIC_SHORT_WEIGHT_MASK);
+        digits = (const int16 *) (VARDATA(num) + sizeof(uint16));
+    }
+    else
+    {
+        int16 long_weight = 0;
+
+        memcpy(&long_weight, VARDATA(num) + sizeof(uint16), sizeof(int16));
+        negative = (header & NUMERIC_SIGN_MASK) == NUMERIC_NEG;
+        weight = long_weight;
+        digits = (const int16 *) (VARDATA(num) + sizeof(uint16) + sizeof(int16));
+    }
+
+    ndigits = (VARSIZE(num) - ((const char *) digits - (const char *) num)) / sizeof(int16);
+
+    for(int i = 0; i < ndigits; i++)
+    {
+        if(mantissa > (PG_UINT64_MAX - NUMERIC_BASE) / NUMERIC_BASE)
+            return false;
+
+        mantissa = mantissa * NUMERIC_BASE + digits[i];
+    }
+
+    exponent = NUMERIC_BASE_DIGITS * (weight - ndigits + 1);
+
+    // trailing zeros of the last base 10000 digit only scale the exponent
+    while(mantissa != 0 && mantissa % 10 == 0)
+    {
+        mantissa /= 10;
+        exponent++;
+    }
+
+    if(mantissa == 0)
+        exponent = 0;
+
+    return spectrum_decimal_float4(mantissa, exponent, negative, value);
+}
+
+/*
+ * Builds spectrum datum of len peaks directly from m/z and intensity
+ * buffers, the same 2 x len float4 array as spectrum_input() produces.
+ */
+Datum spectrum_build(const float4 *mzs, const float4 *intensities, size_t len)
+{
+    int dims[2] = {2, (int) len};
+    int lbs[2] = {1, 1};
+    Size nbytes = 0;
+    ArrayType *result = NULL;
+
+    if(len > MaxArraySize / 2)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("spectrum of %zu peaks exceeds the maximum allowed size", len)));
+
+    nbytes = ARR_OVERHEAD_NONULLS(2) + 2 * len * sizeof(float4);
+    result = (ArrayType *) palloc0(nbytes);
+    SET_VARSIZE(result, nbytes);
+    result->ndim = 2;
+    result->dataoffset = 0;
+    result->elemtype = FLOAT4OID;
+    memcpy(ARR_DIMS(result), dims, sizeof(dims));
+    memcpy(ARR_LBOUND(result), lbs, sizeof(lbs));
+    memcpy(ARR_DATA_PTR(result), mzs, len * sizeof(float4));
+    memcpy((float4 *) ARR_DATA_PTR(result) + len, intensities, len * sizeof(float4));
+
+    return PointerGetDatum(result);
+}
@@ -18,11 +18,19 @@
 #pragma once
 
 #include <fmgr.h>
+#include <utils/numeric.h>
 
 extern Oid spectrumOid;
 
 extern Datum spectrum_input(PG_FUNCTION_ARGS);
 extern Datum spectrum_output(PG_FUNCTION_ARGS);
+extern Datum spectrum_range(PG_FUNCTION_ARGS);
+extern Datum spectrum_overlaps(PG_FUNCTION_ARGS);
+extern Datum spectrum_peak_within(PG_FUNCTION_ARGS);
 
 extern size_t spectrum_length(Datum);
 extern float4* spectrum_data(Datum);
+extern bool is_spectrum_type(Oid);
+extern bool spectrum_parse_float4(const char *, const char *, float4 *);
+extern bool spectrum_numeric_float4(Numeric, float4 *);
+extern Datum spectrum_build(const float4 *, const float4 *, size_t);
@@ -0,0 +1,1152 @@
+/*
+ * This file is part of the PGMS distribution (https://github.com/genesissoftware-tech/pgms or https://ip-147-251-124-124.flt.cloud.muni.cz/chemdb/pgms).
+ * Copyright (c) 2022 Marek Mosna (marek.mosna@genesissoftware.eu).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Precursor sweep join
+ *
+ * Joins of two spectrum relations on a predicate such as
+ *
+ *   cosine_greedy(a.spectrum, b.spectrum) > 0.7
+ *   AND abs(a.pepmass - b.pepmass) <= 2.0
+ *
+ * are planned by PostgreSQL as a nested loop calling the similarity
+ * function for every pair of rows. The custom scan provider below reads both
+ * inputs once, sorts them on precursor and slides a precursor window over the
+ * inner input. The similarity kernel is called in a batch for all inner rows
+ * of the window, pairs outside of the window are never scored.
+ *
+ * The precursor condition is kept as an ordinary join qual so the exact
+ * comparison semantics of the original clause are preserved, the window is
+ * only a (slightly widened) superset of it.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <miscadmin.h>
+
+#include <catalog/pg_type.h>
+#include <commands/explain.h>
+#include <executor/executor.h>
+#include <nodes/extensible.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <optimizer/cost.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/paths.h>
+#include <optimizer/restrictinfo.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/fmgroids.h>
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "cosine.h"
+#include "spectrum.h"
+#include "sweep_join.h"
+
+#define SWEEP_JOIN_NAME     "PgmsSweepJoin"
+
+#define SIDE_NONE           0
+#define SIDE_OUTER          1
+#define SIDE_INNER          2
+
+#if PG_VERSION_NUM >= 140000
+    #define PullVarnos(root, node)  pull_varnos((root), (node))
+#else
+    #define PullVarnos(root, node)  pull_varnos((node))
+#endif
+
+// abs(float4) and abs(float8) share their C functions with the @ operator,
+// fmgroids.h has names for them only since PG 14
+#ifndef F_ABS_FLOAT4
+    #define F_ABS_FLOAT4            1394
+#endif
+
+#ifndef F_ABS_FLOAT8
+    #define F_ABS_FLOAT8            1395
+#endif
+
+extern Datum precurzor_mz_match(PG_FUNCTION_ARGS);
+
+typedef struct SweepClauses
+{
+    RestrictInfo    *similarity;
+    RestrictInfo    *precursor;
+    RestrictInfo    *precursor_bound;
+    FuncExpr        *func;
+    bool            swapped;
+    bool            inclusive;
+    float8          threshold;
+    Expr            *outer_precursor;
+    Expr            *inner_precursor;
+    float8          tolerance;
+} SweepClauses;
+
+typedef struct PrecursorBound
+{
+    Expr            *outer;
+    Expr            *inner;
+    float8          offset;
+    bool            upper;
+} PrecursorBound;
+
+typedef struct SweepEntry
+{
+    float8          precursor;
+    Datum           spectrum;
+    MinimalTuple    tuple;
+} SweepEntry;
+
+typedef struct SweepSide
+{
+    PlanState       *ps;
+    TupleTableSlot  *slot;
+    int             offset;
+    int             natts;
+    ExprState       *spectrum;
+    AttrNumber      spectrum_attnum;    // spectrum column of the side, invalid for computed spectra
+    ExprState       *precursor;
+    Oid             precursor_type;
+    SweepEntry      *entries;
+    size_t          count;
+    size_t          capacity;
+} SweepSide;
+
+typedef struct SweepJoinState
+{
+    CustomScanState css;
+    SweepSide       outer;
+    SweepSide       inner;
+    List            *args;
+    int             nargs;
+    bool            swapped;
+    bool            inclusive;
+    float8          threshold;
+    float8          tolerance;
+    bool            bounded;
+    FmgrInfo        flinfo;
+    FunctionCallInfo fcinfo;
+    MemoryContext   context;
+    MemoryContext   batch_context;
+    bool            materialized;
+    bool            never;
+    size_t          outer_index;
+    size_t          window_low;
+    size_t          window_high;
+    bool            batch_ready;
+    size_t          batch_pos;
+    size_t          batch_len;
+    float4          *scores;
+    bool            *score_nulls;
+    uint64          pairs_considered;
+    uint64          pairs_scored;
+    uint64          pairs_pruned;
+} SweepJoinState;
+
+static bool enable_sweep_join = true;
+static set_join_pathlist_hook_type prev_join_pathlist_hook = NULL;
+
+static Plan* sweep_plan_path(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path,
+    List *tlist, List *clauses, List *custom_plans);
+static Node* sweep_create_state(CustomScan *cscan);
+static AttrNumber sweep_spectrum_attnum(SweepSide *side, Expr *expr)
+{
+    Var *var = (Var*) expr;
+
+    if(!IsA(expr, Var) || var->varattno <= side->offset || var->varattno > side->offset + side->natts)
+        return InvalidAttrNumber;
+
+    return var->varattno - side->offset;
+}
+
+static void sweep_begin(CustomScanState *node, EState *estate, int eflags);
+static TupleTableSlot* sweep_exec(CustomScanState *node);
+static void sweep_end(CustomScanState *node);
+static void sweep_rescan(CustomScanState *node);
+static void sweep_explain(CustomScanState *node, List *ancestors, ExplainState *es);
+
+static const CustomPathMethods sweep_path_methods = {
+    .CustomName = SWEEP_JOIN_NAME,
+    .PlanCustomPath = sweep_plan_path,
+};
+
+static const CustomScanMethods sweep_scan_methods = {
+    .CustomName = SWEEP_JOIN_NAME,
+    .CreateCustomScanState = sweep_create_state,
+};
+
+static const CustomExecMethods sweep_exec_methods = {
+    .CustomName = SWEEP_JOIN_NAME,
+    .BeginCustomScan = sweep_begin,
+    .ExecCustomScan = sweep_exec,
+    .EndCustomScan = sweep_end,
+    .ReScanCustomScan = sweep_rescan,
+    .ExplainCustomScan = sweep_explain,
+};
+
+static Node* strip_relabel(Node *node)
+{
+    while(PointerIsValid(node) && IsA(node, RelabelType))
+        node = (Node*) ((RelabelType*) node)->arg;
+
+    return node;
+}
+
+static bool const_float_value(Node *node, float8 *value)
+{
+    Const *c = (Const*) strip_relabel(node);
+
+    if(!PointerIsValid(c) || !IsA(c, Const) || c->constisnull)
+        return false;
+
+    switch(c->consttype)
+    {
+        case FLOAT4OID:
+            *value = DatumGetFloat4(c->constvalue);
+            break;
+        case FLOAT8OID:
+            *value = DatumGetFloat8(c->constvalue);
+            break;
+        case INT4OID:
+            *value = DatumGetInt32(c->constvalue);
+            break;
+        case NUMERICOID:
+            *value = DatumGetFloat8(DirectFunctionCall1(numeric_float8, c->constvalue));
+            break;
+        default:
+            return false;
+    }
+
+    return !isnan(*value);
+}
+
+static int expr_side(PlannerInfo *root, Node *expr, RelOptInfo *outerrel, RelOptInfo *innerrel)
+{
+    Relids relids = NULL;
+
+    if(contain_volatile_functions(expr))
+        return SIDE_NONE;
+
+    relids = PullVarnos(root, expr);
+
+    if(bms_is_empty(relids))
+        return SIDE_NONE;
+    else if(bms_is_subset(relids, outerrel->relids))
+        return SIDE_OUTER;
+    else if(bms_is_subset(relids, innerrel->relids))
+        return SIDE_INNER;
+
+    return SIDE_NONE;
+}
+
+static bool match_similarity(PlannerInfo *root, Expr *clause, RelOptInfo *outerrel, RelOptInfo *innerrel, SweepClauses *sc)
+{
+    OpExpr *op = (OpExpr*) clause;
+    FuncExpr *func = NULL;
+    ListCell *lc = NULL;
+    int side0 = SIDE_NONE;
+    int side1 = SIDE_NONE;
+    int idx = 0;
+
+    if(!IsA(op, OpExpr) || list_length(op->args) != 2)
+        return false;
+
+    set_opfuncid(op);
+    switch(op->opfuncid)
+    {
+        case F_FLOAT4GT:
+        case F_FLOAT48GT:
+            sc->inclusive = false;
+            break;
+        case F_FLOAT4GE:
+        case F_FLOAT48GE:
+            sc->inclusive = true;
+            break;
+        default:
+            return false;
+    }
+
+    func = (FuncExpr*) strip_relabel(linitial(op->args));
+
+    if(!IsA(func, FuncExpr) || func->funcretset
+        || func->funcresulttype != FLOAT4OID
+        || list_length(func->args) < 2
+        || !func_strict(func->funcid))
+        return false;
+
+    if(!const_float_value(lsecond(op->args), &sc->threshold))
+        return false;
+
+    if(!is_spectrum_type(exprType(linitial(func->args)))
+        || !is_spectrum_type(exprType(lsecond(func->args))))
+        return false;
+
+    side0 = expr_side(root, linitial(func->args), outerrel, innerrel);
+    side1 = expr_side(root, lsecond(func->args), outerrel, innerrel);
+
+    if(side0 == SIDE_OUTER && side1 == SIDE_INNER)
+        sc->swapped = false;
+    else if(side0 == SIDE_INNER && side1 == SIDE_OUTER)
+        sc->swapped = true;
+    else
+        return false;
+
+    // the rest of the arguments has to be the same for every pair
+    foreach(lc, func->args)
+    {
+        Node *arg = (Node*) lfirst(lc);
+
+        if(idx++ < 2)
+            continue;
+
+        if(!bms_is_empty(PullVarnos(root, arg)) || contain_volatile_functions(arg))
+            return false;
+    }
+
+    sc->func = func;
+    return true;
+}
+
+static bool is_float_abs(Oid funcid)
+{
+    return funcid == F_FLOAT4ABS || funcid == F_FLOAT8ABS || funcid == F_ABS_FLOAT4 || funcid == F_ABS_FLOAT8;
+}
+
+static Node* strip_abs(Node *node)
+{
+    node = strip_relabel(node);
+
+    if(IsA(node, FuncExpr))
+    {
+        FuncExpr *func = (FuncExpr*) node;
+
+        if(is_float_abs(func->funcid) && list_length(func->args) == 1)
+            return strip_relabel(linitial(func->args));
+    }
+    else if(IsA(node, OpExpr))
+    {
+        OpExpr *op = (OpExpr*) node;
+
+        set_opfuncid(op);
+        if(is_float_abs(op->opfuncid) && list_length(op->args) == 1)
+            return strip_relabel(linitial(op->args));
+    }
+
+    return NULL;
+}
+
+static bool match_precursor_pair(PlannerInfo *root, Node *left, Node *right, RelOptInfo *outerrel, RelOptInfo *innerrel, SweepClauses *sc)
+{
+    int left_side = expr_side(root, left, outerrel, innerrel);
+    int right_side = expr_side(root, right, outerrel, innerrel);
+
+    if((exprType(left) != FLOAT4OID && exprType(left) != FLOAT8OID)
+        || (exprType(right) != FLOAT4OID && exprType(right) != FLOAT8OID))
+        return false;
+
+    if(left_side == SIDE_OUTER && right_side == SIDE_INNER)
+    {
+        sc->outer_precursor = (Expr*) left;
+        sc->inner_precursor = (Expr*) right;
+    }
+    else if(left_side == SIDE_INNER && right_side == SIDE_OUTER)
+    {
+        sc->outer_precursor = (Expr*) right;
+        sc->inner_precursor = (Expr*) left;
+    }
+    else
+        return false;
+
+    return float8_ge(sc->tolerance, 0.0);
+}
+
+static bool match_precursor(PlannerInfo *root, Expr *clause, RelOptInfo *outerrel, RelOptInfo *innerrel, SweepClauses *sc)
+{
+    OpExpr *op = (OpExpr*) clause;
+
+    if(!IsA(op, OpExpr) || list_length(op->args) != 2)
+        return false;
+
+    set_opfuncid(op);
+    switch(op->opfuncid)
+    {
+        // abs(a.precursor - b.precursor) <= tolerance
+        case F_FLOAT4LE:
+        case F_FLOAT4LT:
+        case F_FLOAT8LE:
+        case F_FLOAT8LT:
+        case F_FLOAT48LE:
+        case F_FLOAT48LT:
+        case F_FLOAT84LE:
+        case F_FLOAT84LT:
+        {
+            OpExpr *minus = (OpExpr*) strip_abs(linitial(op->args));
+
+            if(!PointerIsValid(minus) || !IsA(minus, OpExpr) || list_length(minus->args) != 2)
+                return false;
+
+            set_opfuncid(minus);
+            if(minus->opfuncid != F_FLOAT4MI && minus->opfuncid != F_FLOAT8MI
+                && minus->opfuncid != F_FLOAT48MI && minus->opfuncid != F_FLOAT84MI)
+                return false;
+
+            if(!const_float_value(lsecond(op->args), &sc->tolerance))
+                return false;
+
+            return match_precursor_pair(root
+                , strip_relabel(linitial(minus->args))
+                , strip_relabel(lsecond(minus->args))
+                , outerrel, innerrel, sc);
+        }
+        // precurzor_mz_match(a.precursor, b.precursor, tolerance, 'Dalton') > 0
+        case F_FLOAT4GT:
+        case F_FLOAT48GT:
+        case F_FLOAT4GE:
+        case F_FLOAT48GE:
+        case F_FLOAT4EQ:
+        case F_FLOAT48EQ:
+        {
+            FuncExpr *func = (FuncExpr*) strip_relabel(linitial(op->args));
+            FmgrInfo finfo;
+            float8 level = 0.0;
+
+            if(!IsA(func, FuncExpr) || list_length(func->args) < 3)
+                return false;
+
+            if(!const_float_value(lsecond(op->args), &level))
+                return false;
+
+            // the match function scores 1.0 for a hit and 0.0 for a miss
+            if((op->opfuncid == F_FLOAT4GT || op->opfuncid == F_FLOAT48GT) && !(level >= 0.0 && level < 1.0))
+                return false;
+            else if((op->opfuncid == F_FLOAT4GE || op->opfuncid == F_FLOAT48GE) && !(level > 0.0 && level <= 1.0))
+                return false;
+            else if((op->opfuncid == F_FLOAT4EQ || op->opfuncid == F_FLOAT48EQ) && level != 1.0)
+                return false;
+
+            fmgr_info(func->funcid, &finfo);
+            if(finfo.fn_addr != precurzor_mz_match)
+                return false;
+
+            if(list_length(func->args) > 3)
+            {
+                Const *type = (Const*) strip_relabel(lfourth(func->args));
+
+                if(!IsA(type, Const) || type->constisnull
+                    || strcmp(TextDatumGetCString(type->constvalue), "Dalton"))
+                    return false;
+            }
+
+            if(!const_float_value(lthird(func->args), &sc->tolerance))
+                return false;
+
+            return match_precursor_pair(root
+                , strip_relabel(linitial(func->args))
+                , strip_relabel(lsecond(func->args))
+                , outerrel, innerrel, sc);
+        }
+        default:
+            return false;
+    }
+}
+
+static void split_offset(Node *node, Node **expr, float8 *offset)
+{
+    OpExpr *op = (OpExpr*) strip_relabel(node);
+    float8 value = 0.0;
+
+    *expr = (Node*) op;
+    *offset = 0.0;
+
+    if(!IsA(op, OpExpr) || list_length(op->args) != 2)
+        return;
+
+    set_opfuncid(op);
+    switch(op->opfuncid)
+    {
+        case F_FLOAT4PL:
+        case F_FLOAT8PL:
+        case F_FLOAT48PL:
+        case F_FLOAT84PL:
+            if(const_float_value(lsecond(op->args), &value))
+            {
+                *expr = strip_relabel(linitial(op->args));
+                *offset = value;
+            }
+            else if(const_float_value(linitial(op->args), &value))
+            {
+                *expr = strip_relabel(lsecond(op->args));
+                *offset = value;
+            }
+            break;
+        case F_FLOAT4MI:
+        case F_FLOAT8MI:
+        case F_FLOAT48MI:
+        case F_FLOAT84MI:
+            if(const_float_value(lsecond(op->args), &value))
+            {
+                *expr = strip_relabel(linitial(op->args));
+                *offset = -value;
+            }
+            break;
+    }
+}
+
+// a.precursor <= b.precursor + offset or a.precursor >= b.precursor - offset,
+// normalized to outer - inner <= offset (upper) or outer - inner >= offset
+static bool match_precursor_bound(PlannerInfo *root, Expr *clause, RelOptInfo *outerrel, RelOptInfo *innerrel, PrecursorBound *bound)
+{
+    OpExpr *op = (OpExpr*) clause;
+    Node *left = NULL;
+    Node *right = NULL;
+    float8 left_offset = 0.0;
+    float8 right_offset = 0.0;
+    int left_side = SIDE_NONE;
+    int right_side = SIDE_NONE;
+
+    if(!IsA(op, OpExpr) || list_length(op->args) != 2)
+        return false;
+
+    set_opfuncid(op);
+    switch(op->opfuncid)
+    {
+        case F_FLOAT4LE:
+        case F_FLOAT4LT:
+        case F_FLOAT8LE:
+        case F_FLOAT8LT:
+        case F_FLOAT48LE:
+        case F_FLOAT48LT:
+        case F_FLOAT84LE:
+        case F_FLOAT84LT:
+            bound->upper = true;
+            break;
+        case F_FLOAT4GE:
+        case F_FLOAT4GT:
+        case F_FLOAT8GE:
+        case F_FLOAT8GT:
+        case F_FLOAT48GE:
+        case F_FLOAT48GT:
+        case F_FLOAT84GE:
+        case F_FLOAT84GT:
+            bound->upper = false;
+            break;
+        default:
+            return false;
+    }
+
+    split_offset(linitial(op->args), &left, &left_offset);
+    split_offset(lsecond(op->args), &right, &right_offset);
+
+    if((exprType(left) != FLOAT4OID && exprType(left) != FLOAT8OID)
+        || (exprType(right) != FLOAT4OID && exprType(right) != FLOAT8OID))
+        return false;
+
+    left_side = expr_side(root, left, outerrel, innerrel);
+    right_side = expr_side(root, right, outerrel, innerrel);
+
+    if(left_side == SIDE_OUTER && right_side == SIDE_INNER)
+    {
+        bound->outer = (Expr*) left;
+        bound->inner = (Expr*) right;
+        bound->offset = right_offset - left_offset;
+    }
+    else if(left_side == SIDE_INNER && right_side == SIDE_OUTER)
+    {
+        bound->outer = (Expr*) right;
+        bound->inner = (Expr*) left;
+        bound->offset = left_offset - right_offset;
+        bound->upper = !bound->upper;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+static bool find_sweep_clauses(PlannerInfo *root, List *restrictlist, RelOptInfo *outerrel, RelOptInfo *innerrel, SweepClauses *sc)
+{
+    ListCell *lc = NULL;
+    RestrictInfo *lower_rinfo = NULL;
+    RestrictInfo *upper_rinfo = NULL;
+    PrecursorBound lower = {0};
+    PrecursorBound upper = {0};
+    PrecursorBound bound = {0};
+
+    memset(sc, 0, sizeof(SweepClauses));
+
+    foreach(lc, restrictlist)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+        if(rinfo->pseudoconstant)
+            continue;
+
+        if(!sc->similarity && match_similarity(root, rinfo->clause, outerrel, innerrel, sc))
+            sc->similarity = rinfo;
+        else if(!sc->precursor && match_precursor(root, rinfo->clause, outerrel, innerrel, sc))
+            sc->precursor = rinfo;
+        else if(match_precursor_bound(root, rinfo->clause, outerrel, innerrel, &bound))
+        {
+            if(bound.upper && upper_rinfo == NULL)
+            {
+                upper = bound;
+                upper_rinfo = rinfo;
+            }
+            else if(!bound.upper && lower_rinfo == NULL)
+            {
+                lower = bound;
+                lower_rinfo = rinfo;
+            }
+        }
+    }
+
+    // a.precursor BETWEEN b.precursor - tolerance AND b.precursor + tolerance
+    // is planned as two bounds, the window has to cover both of them
+    if(!sc->precursor && lower_rinfo && upper_rinfo
+        && equal(lower.outer, upper.outer) && equal(lower.inner, upper.inner))
+    {
+        sc->precursor = lower_rinfo;
+        sc->precursor_bound = upper_rinfo;
+        sc->outer_precursor = upper.outer;
+        sc->inner_precursor = upper.inner;
+        sc->tolerance = Max(fabs(lower.offset), fabs(upper.offset));
+    }
+
+    return sc->similarity && sc->precursor;
+}
+
+// rows of both inputs are kept in memory as minimal tuples
+static double sweep_side_bytes(Path *path)
+{
+    return path->rows * (sizeof(SweepEntry) + MAXALIGN(SizeofMinimalTupleHeader) + MAXALIGN(path->pathtarget->width));
+}
+
+static void sweep_join_pathlist(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel, RelOptInfo *innerrel,
+    JoinType jointype, JoinPathExtraData *extra)
+{
+    SweepClauses sc;
+    CustomPath *cpath = NULL;
+    Path *outer_path = NULL;
+    Path *inner_path = NULL;
+    Selectivity window = 0.0;
+    double pairs = 0.0;
+    Cost kernel = 0.0;
+
+    if(prev_join_pathlist_hook)
+        prev_join_pathlist_hook(root, joinrel, outerrel, innerrel, jointype, extra);
+
+    if(!enable_sweep_join || jointype != JOIN_INNER)
+        return;
+
+    outer_path = outerrel->cheapest_total_path;
+    inner_path = innerrel->cheapest_total_path;
+
+    if(!PointerIsValid(outer_path) || !PointerIsValid(inner_path)
+        || outer_path->param_info || inner_path->param_info)
+        return;
+
+    if(!find_sweep_clauses(root, extra->restrictlist, outerrel, innerrel, &sc))
+        return;
+
+    // inputs are not spilled to disk, the join is not planned unless they fit in work_mem
+    if(sweep_side_bytes(outer_path) + sweep_side_bytes(inner_path) > work_mem * 1024.0)
+    {
+        elog(DEBUG1, "sweep join path: inputs exceed work_mem");
+        return;
+    }
+
+    window = clauselist_selectivity(root, sc.precursor_bound ? list_make2(sc.precursor, sc.precursor_bound)
+        : list_make1(sc.precursor), 0, JOIN_INNER, NULL);
+    pairs = clamp_row_est(outer_path->rows * inner_path->rows * window);
+    kernel = get_func_cost(sc.func->funcid) * cpu_operator_cost;
+
+    cpath = makeNode(CustomPath);
+    cpath->path.pathtype = T_CustomScan;
+    cpath->path.parent = joinrel;
+    cpath->path.pathtarget = joinrel->reltarget;
+    cpath->path.param_info = NULL;
+    cpath->path.parallel_aware = false;
+    cpath->path.parallel_safe = false;
+    cpath->path.parallel_workers = 0;
+    cpath->path.rows = joinrel->rows;
+    cpath->path.pathkeys = NIL;
+    cpath->path.startup_cost = outer_path->total_cost + inner_path->total_cost
+        + 2.0 * cpu_operator_cost * (outer_path->rows * log2(Max(outer_path->rows, 2.0))
+            + inner_path->rows * log2(Max(inner_path->rows, 2.0)));
+    cpath->path.total_cost = cpath->path.startup_cost
+        + pairs * (kernel + cpu_operator_cost)
+        + joinrel->rows * cpu_tuple_cost;
+    cpath->flags = 0;
+    cpath->custom_paths = list_make2(outer_path, inner_path);
+    cpath->custom_private = extra->restrictlist;
+    cpath->methods = &sweep_path_methods;
+
+    elog(DEBUG1, "sweep join path: %f pairs in window of %f", pairs, window);
+    add_path(joinrel, &cpath->path);
+}
+
+static List* sweep_child_tlist(List *scan_tlist, Plan *plan)
+{
+    ListCell *lc = NULL;
+
+    foreach(lc, plan->targetlist)
+    {
+        TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+        scan_tlist = lappend(scan_tlist, makeTargetEntry(copyObject(tle->expr)
+            , list_length(scan_tlist) + 1, NULL, false));
+    }
+
+    return scan_tlist;
+}
+
+static Plan* sweep_plan_path(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path,
+    List *tlist, List *clauses, List *custom_plans)
+{
+    CustomScan *cscan = makeNode(CustomScan);
+    Path *outer_path = (Path*) linitial(best_path->custom_paths);
+    Path *inner_path = (Path*) lsecond(best_path->custom_paths);
+    List *quals = NIL;
+    ListCell *lc = NULL;
+    SweepClauses sc;
+
+    if(!find_sweep_clauses(root, best_path->custom_private, outer_path->parent, inner_path->parent, &sc))
+        elog(ERROR, "sweep join clauses not found");
+
+    // the similarity clause is evaluated by the node itself
+    foreach(lc, best_path->custom_private)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+        if(rinfo != sc.similarity)
+            quals = lappend(quals, rinfo->clause);
+    }
+
+    cscan->scan.plan.targetlist = tlist;
+    cscan->scan.plan.qual = quals;
+    cscan->scan.scanrelid = 0;
+    cscan->flags = best_path->flags;
+    cscan->custom_plans = custom_plans;
+    cscan->custom_exprs = list_make3(sc.func, sc.outer_precursor, sc.inner_precursor);
+    cscan->custom_private = lappend(lappend(lappend(lappend(NIL
+        , makeInteger(sc.swapped))
+        , makeInteger(sc.inclusive))
+        , makeFloat(psprintf("%.17g", sc.threshold)))
+        , makeFloat(psprintf("%.17g", sc.tolerance)));
+    cscan->custom_scan_tlist = sweep_child_tlist(
+        sweep_child_tlist(NIL, (Plan*) linitial(custom_plans))
+        , (Plan*) lsecond(custom_plans));
+    cscan->custom_relids = rel->relids;
+    cscan->methods = &sweep_scan_methods;
+
+    return &cscan->scan.plan;
+}
+
+static Node* sweep_create_state(CustomScan *cscan)
+{
+    SweepJoinState *state = (SweepJoinState*) newNode(sizeof(SweepJoinState), T_CustomScanState);
+
+    state->css.methods = &sweep_exec_methods;
+
+    return (Node*) state;
+}
+
+static void sweep_side_init(SweepSide *side, Plan *plan, EState *estate, int eflags, int offset)
+{
+    side->ps = ExecInitNode(plan, estate, eflags);
+    side->slot = MakeSingleTupleTableSlot(ExecGetResultType(side->ps), &TTSOpsMinimalTuple);
+    side->offset = offset;
+    side->natts = list_length(plan->targetlist);
+    side->entries = NULL;
+    side->count = 0;
+    side->capacity = 0;
+}
+
+static void sweep_begin(CustomScanState *node, EState *estate, int eflags)
+{
+    SweepJoinState *state = (SweepJoinState*) node;
+    CustomScan *cscan = (CustomScan*) node->ss.ps.plan;
+    FuncExpr *func = (FuncExpr*) linitial(cscan->custom_exprs);
+    Expr *outer_precursor = (Expr*) lsecond(cscan->custom_exprs);
+    Expr *inner_precursor = (Expr*) lthird(cscan->custom_exprs);
+    Plan *outer_plan = (Plan*) linitial(cscan->custom_plans);
+
+    // both inputs are read once and kept in memory
+    eflags &= ~(EXEC_FLAG_REWIND | EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK);
+
+    sweep_side_init(&state->outer, outer_plan, estate, eflags, 0);
+    sweep_side_init(&state->inner, (Plan*) lsecond(cscan->custom_plans), estate, eflags
+        , list_length(outer_plan->targetlist));
+    node->custom_ps = list_make2(state->outer.ps, state->inner.ps);
+
+    state->swapped = intVal(linitial(cscan->custom_private));
+    state->inclusive = intVal(lsecond(cscan->custom_private));
+    state->threshold = floatVal(lthird(cscan->custom_private));
+    state->tolerance = floatVal(lfourth(cscan->custom_private));
+
+    state->args = ExecInitExprList(func->args, &node->ss.ps);
+    state->nargs = list_length(func->args);
+    state->outer.spectrum = (ExprState*) list_nth(state->args, state->swapped ? 1 : 0);
+    state->inner.spectrum = (ExprState*) list_nth(state->args, state->swapped ? 0 : 1);
+    state->outer.spectrum_attnum = sweep_spectrum_attnum(&state->outer, (Expr*) list_nth(func->args, state->swapped ? 1 : 0));
+    state->inner.spectrum_attnum = sweep_spectrum_attnum(&state->inner, (Expr*) list_nth(func->args, state->swapped ? 0 : 1));
+    state->outer.precursor = ExecInitExpr(outer_precursor, &node->ss.ps);
+    state->outer.precursor_type = exprType((Node*) outer_precursor);
+    state->inner.precursor = ExecInitExpr(inner_precursor, &node->ss.ps);
+    state->inner.precursor_type = exprType((Node*) inner_precursor);
+
+    fmgr_info(func->funcid, &state->flinfo);
+    fmgr_info_set_expr((Node*) func, &state->flinfo);
+    state->bounded = cosine_upper_bound_supported(state->flinfo.fn_addr);
+    state->fcinfo = (FunctionCallInfo) palloc0(SizeForFunctionCallInfo(state->nargs));
+    InitFunctionCallInfoData(*state->fcinfo, &state->flinfo, state->nargs, func->inputcollid, NULL, NULL);
+
+    state->context = AllocSetContextCreate(estate->es_query_cxt
+        , "pgms sweep join", ALLOCSET_DEFAULT_SIZES);
+    state->batch_context = AllocSetContextCreate(estate->es_query_cxt
+        , "pgms sweep join batch", ALLOCSET_DEFAULT_SIZES);
+    state->materialized = false;
+}
+
+static int sweep_entry_cmp(const void *a, const void *b)
+{
+    float8 pa = ((const SweepEntry*) a)->precursor;
+    float8 pb = ((const SweepEntry*) b)->precursor;
+
+    return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+static void sweep_side_load(SweepJoinState *state, SweepSide *side)
+{
+    ExprContext *econtext = state->css.ss.ps.ps_ExprContext;
+    TupleTableSlot *scanslot = state->css.ss.ss_ScanTupleSlot;
+    int scan_natts = scanslot->tts_tupleDescriptor->natts;
+
+    side->count = 0;
+
+    while(true)
+    {
+        TupleTableSlot *slot = ExecProcNode(side->ps);
+        MemoryContext oldcontext = NULL;
+        SweepEntry *entry = NULL;
+        Datum value;
+        bool isnull = false;
+        float8 precursor = 0.0;
+
+        if(TupIsNull(slot))
+            break;
+
+        // expressions are compiled against the joined scan tuple
+        ExecClearTuple(scanslot);
+        slot_getallattrs(slot);
+        for(int i = 0; i < scan_natts; i++)
+        {
+            bool inside = i >= side->offset && i < side->offset + side->natts;
+
+            scanslot->tts_values[i] = inside ? slot->tts_values[i - side->offset] : (Datum) 0;
+            scanslot->tts_isnull[i] = inside ? slot->tts_isnull[i - side->offset] : true;
+        }
+        ExecStoreVirtualTuple(scanslot);
+        econtext->ecxt_scantuple = scanslot;
+
+        value = ExecEvalExprSwitchContext(side->precursor, econtext, &isnull);
+        if(isnull)
+        {
+            ResetExprContext(econtext);
+            continue;
+        }
+
+        precursor = side->precursor_type == FLOAT4OID ? DatumGetFloat4(value) : DatumGetFloat8(value);
+        value = ExecEvalExprSwitchContext(side->spectrum, econtext, &isnull);
+
+        if(isnull || isnan(precursor))
+        {
+            ResetExprContext(econtext);
+            continue;
+        }
+
+        oldcontext = MemoryContextSwitchTo(state->context);
+
+        if(side->count == side->capacity)
+        {
+            side->capacity = side->capacity ? 2 * side->capacity : 1024;
+            side->entries = side->entries
+                ? repalloc_huge(side->entries, side->capacity * sizeof(SweepEntry))
+                : palloc_extended(side->capacity * sizeof(SweepEntry), MCXT_ALLOC_HUGE);
+        }
+
+        entry = &side->entries[side->count++];
+        entry->precursor = precursor;
+        entry->tuple = ExecCopySlotMinimalTuple(slot);
+
+        // spectrum column is read from the copied tuple, only compressed or toasted values are copied again
+        if(side->spectrum_attnum != InvalidAttrNumber)
+        {
+            ExecStoreMinimalTuple(entry->tuple, side->slot, false);
+            entry->spectrum = PointerGetDatum(PG_DETOAST_DATUM(slot_getattr(side->slot, side->spectrum_attnum, &isnull)));
+            ExecClearTuple(side->slot);
+        }
+        else
+        {
+            entry->spectrum = PointerGetDatum(PG_DETOAST_DATUM_COPY(value));
+        }
+
+        MemoryContextSwitchTo(oldcontext);
+        ResetExprContext(econtext);
+    }
+
+    if(side->count > 1)
+        qsort(side->entries, side->count, sizeof(SweepEntry), sweep_entry_cmp);
+
+    elog(DEBUG1, "sweep join side loaded: %ld rows", side->count);
+}
+
+static void sweep_materialize(SweepJoinState *state)
+{
+    ExprContext *econtext = state->css.ss.ps.ps_ExprContext;
+    MemoryContext oldcontext = NULL;
+    ListCell *lc = NULL;
+    int i = 0;
+
+    state->never = false;
+
+    // constant arguments of the kernel are evaluated once per scan
+    oldcontext = MemoryContextSwitchTo(state->context);
+    econtext->ecxt_scantuple = NULL;
+    foreach(lc, state->args)
+    {
+        if(i >= 2)
+        {
+            bool isnull = false;
+
+            state->fcinfo->args[i].value = ExecEvalExpr((ExprState*) lfirst(lc), econtext, &isnull);
+            state->fcinfo->args[i].isnull = isnull;
+            state->never |= isnull;
+        }
+        i++;
+    }
+    MemoryContextSwitchTo(oldcontext);
+
+    sweep_side_load(state, &state->outer);
+    sweep_side_load(state, &state->inner);
+
+    state->scores = MemoryContextAllocHuge(state->context, Max(state->inner.count, 1) * sizeof(float4));
+    state->score_nulls = MemoryContextAllocHuge(state->context, Max(state->inner.count, 1) * sizeof(bool));
+    state->outer_index = 0;
+    state->window_low = 0;
+    state->window_high = 0;
+    state->batch_ready = false;
+    state->materialized = true;
+}
+
+static void sweep_score_batch(SweepJoinState *state)
+{
+    SweepEntry *outer = &state->outer.entries[state->outer_index];
+    SweepEntry *inner = state->inner.entries;
+    float8 slack = (fabs(outer->precursor) + state->tolerance) * 1e-6;
+    float8 low = outer->precursor - state->tolerance - slack;
+    float8 high = outer->precursor + state->tolerance + slack;
+    FunctionCallInfo fcinfo = state->fcinfo;
+    int outer_arg = state->swapped ? 1 : 0;
+    int inner_arg = state->swapped ? 0 : 1;
+    MemoryContext oldcontext = NULL;
+
+    // outer rows are sorted, so both window bounds only move forward
+    while(state->window_low < state->inner.count && inner[state->window_low].precursor < low)
+        state->window_low++;
+
+    if(state->window_high < state->window_low)
+        state->window_high = state->window_low;
+
+    while(state->window_high < state->inner.count && inner[state->window_high].precursor <= high)
+        state->window_high++;
+
+    state->batch_len = state->window_high - state->window_low;
+    state->batch_pos = 0;
+    state->batch_ready = true;
+    state->pairs_considered += state->batch_len;
+    state->pairs_pruned += state->inner.count - state->batch_len;
+
+    if(state->never)
+    {
+        state->batch_len = 0;
+        return;
+    }
+
+    MemoryContextReset(state->batch_context);
+    oldcontext = MemoryContextSwitchTo(state->batch_context);
+
+    fcinfo->args[outer_arg].value = outer->spectrum;
+    fcinfo->args[outer_arg].isnull = false;
+    fcinfo->args[inner_arg].isnull = false;
+
+    for(size_t i = 0; i < state->batch_len; i++)
+    {
+        Datum score;
+
+        fcinfo->args[inner_arg].value = inner[state->window_low + i].spectrum;
+
+        // pairs which can not reach the threshold are not scored at all
+        if(state->bounded)
+        {
+            float8 bound = cosine_upper_bound_calc(fcinfo->args[0].value, fcinfo->args[1].value,
+                DatumGetFloat4(fcinfo->args[2].value), DatumGetFloat4(fcinfo->args[3].value),
+                DatumGetFloat4(fcinfo->args[4].value));
+
+            if(state->inclusive ? float8_lt(bound, state->threshold) : float8_le(bound, state->threshold))
+            {
+                state->score_nulls[i] = true;
+                state->pairs_pruned++;
+                continue;
+            }
+        }
+
+        fcinfo->isnull = false;
+        score = FunctionCallInvoke(fcinfo);
+
+        state->score_nulls[i] = fcinfo->isnull;
+        state->scores[i] = fcinfo->isnull ? 0.0f : DatumGetFloat4(score);
+        state->pairs_scored++;
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+}
+
+static void sweep_store_side(TupleTableSlot *scanslot, SweepSide *side, MinimalTuple tuple)
+{
+    ExecStoreMinimalTuple(tuple, side->slot, false);
+    slot_getallattrs(side->slot);
+
+    memcpy(scanslot->tts_values + side->offset, side->slot->tts_values, side->natts * sizeof(Datum));
+    memcpy(scanslot->tts_isnull + side->offset, side->slot->tts_isnull, side->natts * sizeof(bool));
+}
+
+static TupleTableSlot* sweep_next(ScanState *node)
+{
+    SweepJoinState *state = (SweepJoinState*) node;
+    TupleTableSlot *scanslot = node->ss_ScanTupleSlot;
+
+    if(!state->materialized)
+        sweep_materialize(state);
+
+    while(state->outer_index < state->outer.count)
+    {
+        if(!state->batch_ready)
+            sweep_score_batch(state);
+
+        while(state->batch_pos < state->batch_len)
+        {
+            size_t i = state->batch_pos++;
+            float8 score = state->scores[i];
+
+            if(state->score_nulls[i])
+                continue;
+
+            if(state->inclusive ? float8_ge(score, state->threshold) : float8_gt(score, state->threshold))
+            {
+                ExecClearTuple(scanslot);
+                sweep_store_side(scanslot, &state->outer, state->outer.entries[state->outer_index].tuple);
+                sweep_store_side(scanslot, &state->inner, state->inner.entries[state->window_low + i].tuple);
+                return ExecStoreVirtualTuple(scanslot);
+            }
+        }
+
+        state->outer_index++;
+        state->batch_ready = false;
+    }
+
+    return ExecClearTuple(scanslot);
+}
+
+static bool sweep_recheck(ScanState *node, TupleTableSlot *slot)
+{
+    return true;
+}
+
+static TupleTableSlot* sweep_exec(CustomScanState *node)
+{
+    return ExecScan(&node->ss, (ExecScanAccessMtd) sweep_next, (ExecScanRecheckMtd) sweep_recheck);
+}
+
+static void sweep_end(CustomScanState *node)
+{
+    SweepJoinState *state = (SweepJoinState*) node;
+
+    ExecDropSingleTupleTableSlot(state->outer.slot);
+    ExecDropSingleTupleTableSlot(state->inner.slot);
+    ExecEndNode(state->outer.ps);
+    ExecEndNode(state->inner.ps);
+    MemoryContextDelete(state->batch_context);
+    MemoryContextDelete(state->context);
+}
+
+static void sweep_rescan(CustomScanState *node)
+{
+    SweepJoinState *state = (SweepJoinState*) node;
+
+    MemoryContextReset(state->batch_context);
+    MemoryContextReset(state->context);
+    state->outer.entries = NULL;
+    state->outer.count = state->outer.capacity = 0;
+    state->inner.entries = NULL;
+    state->inner.count = state->inner.capacity = 0;
+    state->materialized = false;
+
+    if(state->outer.ps->chgParam == NULL)
+        ExecReScan(state->outer.ps);
+
+    if(state->inner.ps->chgParam == NULL)
+        ExecReScan(state->inner.ps);
+}
+
+static void sweep_explain(CustomScanState *node, List *ancestors, ExplainState *es)
+{
+    SweepJoinState *state = (SweepJoinState*) node;
+
+    ExplainPropertyText("Similarity Function", get_func_name(state->flinfo.fn_oid), es);
+    ExplainPropertyFloat("Similarity Threshold", NULL, state->threshold, 4, es);
+    ExplainPropertyFloat("Precursor Tolerance", NULL, state->tolerance, 4, es);
+
+    if(es->analyze)
+    {
+        ExplainPropertyInteger("Pairs Considered", NULL, (int64) state->pairs_considered, es);
+        ExplainPropertyInteger("Pairs Scored", NULL, (int64) state->pairs_scored, es);
+        ExplainPropertyInteger("Pairs Pruned", NULL, (int64) state->pairs_pruned, es);
+    }
+}
+
+void sweep_join_init(void)
+{
+    DefineCustomBoolVariable("pgms.enable_sweep_join",
+        "Enables the precursor sweep join for spectrum similarity predicates.",
+        NULL,
+        &enable_sweep_join,
+        true,
+        PGC_USERSET,
+        0,
+        NULL,
+        NULL,
+        NULL);
+
+    RegisterCustomScanMethods(&sweep_scan_methods);
+
+    prev_join_pathlist_hook = set_join_pathlist_hook;
+    set_join_pathlist_hook = sweep_join_pathlist;
+}
@@ -0,0 +1,102 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(11);
+
+CREATE TABLE library (id integer, pepmass float4, spectrum spectrum);
+
+INSERT INTO library VALUES
+    (1, 100.0, '{{100, 200, 300}, {1.0, 1.0, 1.0}}'),
+    (2, 100.5, '{{100, 200, 400}, {1.0, 1.0, 1.0}}'),
+    (3, 150.0, '{{100, 500, 600}, {1.0, 1.0, 1.0}}'),
+    (4, 99.5,  '{{700, 800}, {1.0, 1.0}}'),
+    (5, 250.0, '{{100, 200, 300, 400}, {1.0, 1.0, 1.0, 1.0}}'),
+    (6, NULL,  NULL);
+
+CREATE TEMPORARY TABLE heap_scores AS
+    SELECT l.id, round(s.score::numeric, 4) AS score
+        FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 0, 0) s
+        JOIN library l ON l.ctid = s.ctid;
+
+SELECT is(
+    library_load('library', 'spectrum', 'pepmass'),
+    5::bigint,
+    'library_load should load spectra of library'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 0, 0) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ SELECT id, score FROM heap_scores ORDER BY id $$,
+    'library_search should score loaded library as heap'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 0, 2) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ SELECT id, score FROM heap_scores ORDER BY id $$,
+    'library_search should score loaded library with parallel workers'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM library_search_precursor('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 100.0, 1.0, 'library', 'spectrum', 0.1, 0.0, 10) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ SELECT h.id, h.score FROM heap_scores h JOIN library l USING (id) WHERE l.pepmass BETWEEN 99.0 AND 101.0 ORDER BY h.id $$,
+    'library_search_precursor should score precursor window of loaded library'
+);
+
+INSERT INTO library VALUES (7, 100.2, '{{100, 200, 300}, {1.0, 1.0, 1.0}}');
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_precursor('{{100}, {1.0}}', 100.0, 1.0, 'library', 'spectrum') $$,
+    '55000',
+    'library "library" is not loaded with precursor column',
+    'library_cache_invalidate trigger should drop loaded library'
+);
+
+SELECT is(
+    library_load('library', 'spectrum', 'pepmass'),
+    6::bigint,
+    'library_load should load modified library'
+);
+
+SELECT is(
+    library_unload('library'),
+    true,
+    'library_unload should drop loaded library'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_precursor('{{100}, {1.0}}', 100.0, 1.0, 'library', 'spectrum') $$,
+    '55000',
+    'library "library" is not loaded with precursor column',
+    'library_search_precursor should not read unloaded library'
+);
+
+SELECT is(
+    library_load('library', 'spectrum', 'pepmass'),
+    6::bigint,
+    'library_load should load unloaded library'
+);
+
+SELECT is(
+    (SELECT count(*) FROM pg_trigger WHERE tgrelid = 'library'::regclass AND tgfoid = 'library_cache_invalidate'::regproc),
+    1::bigint,
+    'library_load should create library_cache_invalidate trigger once'
+);
+
+CREATE INDEX library_id ON library (id);
+CLUSTER library USING library_id;
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_precursor('{{100}, {1.0}}', 100.0, 1.0, 'library', 'spectrum') $$,
+    '55000',
+    'library "library" is not loaded with precursor column',
+    'library cache should drop rewritten library'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -4,7 +4,7 @@ BEGIN;
 \i test/pgtap-core.sql
 \i sql/pgms.sql
 
-SELECT plan(31);
+SELECT plan(83);
 
 SELECT has_type('spectrum');
 ---SELECT has_type('spectrumrange');
@@ -48,6 +48,70 @@ SELECT has_function('cosine_neutral_losses');
 SELECT has_function('cosine_neutral_losses', ARRAY['spectrum', 'spectrum', 'real', 'real', 'real', 'real', 'real']);
 SELECT function_returns('cosine_neutral_losses', 'real');
 
+SELECT has_function('cosine_upper_bound');
+SELECT has_function('cosine_upper_bound', ARRAY['spectrum', 'spectrum', 'real', 'real', 'real']);
+SELECT function_returns('cosine_upper_bound', 'real');
+SELECT has_function('cosine_greedy_above', ARRAY['spectrum', 'spectrum', 'real', 'real', 'real', 'real']);
+SELECT function_returns('cosine_greedy_above', 'boolean');
+SELECT has_function('cosine_hungarian_above', ARRAY['spectrum', 'spectrum', 'real', 'real', 'real', 'real']);
+SELECT function_returns('cosine_hungarian_above', 'boolean');
+
+SELECT has_function('library_search');
+SELECT has_function('library_search', ARRAY['spectrum', 'regclass', 'name', 'real', 'real', 'integer', 'integer']);
+SELECT function_returns('library_search', 'setof record');
+
+SELECT has_function('library_load', ARRAY['regclass', 'name', 'name']);
+SELECT function_returns('library_load', 'bigint');
+SELECT has_function('library_unload', ARRAY['regclass']);
+SELECT function_returns('library_unload', 'boolean');
+SELECT has_function('library_search_precursor', ARRAY['spectrum', 'real', 'real', 'regclass', 'name', 'real', 'real', 'integer']);
+SELECT function_returns('library_search_precursor', 'setof record');
+
+SELECT has_function('library_pack', ARRAY['regclass', 'name', 'name', 'text', 'integer']);
+SELECT function_returns('library_pack', 'bigint');
+SELECT has_function('library_search_packed', ARRAY['spectrum', 'regclass', 'real', 'real', 'real', 'real', 'integer']);
+SELECT function_returns('library_search_packed', 'setof record');
+
+SELECT has_function('import_mgf', ARRAY['oid', 'regclass', 'jsonb']);
+SELECT function_returns('import_mgf', 'bigint');
+SELECT has_function('import_mgf_parallel', ARRAY['oid', 'regclass', 'jsonb', 'integer']);
+SELECT function_returns('import_mgf_parallel', 'bigint');
+
+SELECT has_function('load_from_mgf_file', ARRAY['text']);
+SELECT function_returns('load_from_mgf_file', 'setof record');
+
+SELECT has_function('import_mgf_checkpoint', ARRAY['oid', 'regclass', 'jsonb']);
+
+SELECT ok(to_regclass('stat_progress') IS NOT NULL, 'View stat_progress should exist');
+SELECT is_empty($$ SELECT * FROM stat_progress $$, 'View stat_progress should be empty without running commands');
+
+SELECT has_function('load_from_mgf', ARRAY['oid', 'jsonb']);
+SELECT has_function('load_from_mgf', ARRAY['character varying', 'jsonb']);
+SELECT has_function('load_from_mgf_file', ARRAY['text', 'jsonb']);
+SELECT has_function('load_from_json', ARRAY['jsonb', 'jsonb']);
+
+SELECT has_function('load_from_json_lo', ARRAY['oid']);
+SELECT has_function('load_from_json_lo', ARRAY['oid', 'jsonb']);
+SELECT has_function('load_from_json_file', ARRAY['text']);
+SELECT has_function('load_from_json_file', ARRAY['text', 'jsonb']);
+
+SELECT has_function('export_mgf', ARRAY['text', 'oid']);
+SELECT has_function('export_mgf', ARRAY['text', 'text']);
+SELECT has_function('export_arrow', ARRAY['text', 'oid']);
+SELECT has_function('export_arrow', ARRAY['text', 'text']);
+
+SELECT has_function('load_from_mzml', ARRAY['oid']);
+SELECT has_function('load_from_mzml', ARRAY['oid', 'jsonb']);
+SELECT has_function('load_from_mzml_file', ARRAY['text']);
+SELECT has_function('load_from_mzml_file', ARRAY['text', 'jsonb']);
+SELECT has_function('spectrum_overlaps', ARRAY['spectrum', 'spectrumrange']);
+SELECT has_function('spectrum_peak_within', ARRAY['spectrum', 'spectrumrange']);
+SELECT has_function('spectrum_filter', ARRAY['spectrum', 'jsonb', 'real']);
+SELECT has_function('to_neutral_losses', ARRAY['spectrum', 'real']);
+SELECT has_function('cosine_neutral_losses_greedy', ARRAY['spectrum', 'spectrum', 'real', 'real', 'real']);
+SELECT has_function('cosine_modified_shifts', ARRAY['spectrum', 'spectrum', 'real[]', 'real', 'real', 'real']);
+SELECT has_function('cosine_modified_best', ARRAY['spectrum', 'spectrum', 'real[]', 'real', 'real', 'real']);
+
 
 SELECT * FROM finish();
 ROLLBACK;
@@ -4,7 +4,7 @@ BEGIN;
 \i test/pgtap-core.sql
 \i sql/pgms.sql
 
-SELECT plan(4);
+SELECT plan(7);
 
 SELECT is(
     ROUND(
@@ -35,5 +35,31 @@ SELECT is(
     )
 ) v(ref, query, tolerance, shift, expected_score);
 
+SELECT is(
+    (SELECT array_agg(ROUND(v::numeric, 6)) FROM unnest(cosine_modified_shifts(spectrum_normalize(ref), spectrum_normalize(query), shifts, tolerance)) AS v),
+    (SELECT array_agg(ROUND(cosine_modified(spectrum_normalize(ref), spectrum_normalize(query), v, tolerance)::numeric, 6)) FROM unnest(shifts) AS v),
+    'cosine_modified_shifts should match cosine_modified of each shift'
+) FROM (VALUES
+    (
+        '{{100, 150, 200, 300, 500, 510, 1100}, {0.7,0.2,0.1,1,0.2,0.005,0.5}}'::spectrum,
+        '{{55, 105, 205, 304.5, 494.5, 515.5, 1045}, {0.7,0.2,0.1,1,0.2,0.005,0.5}}'::spectrum,
+        0.1::float4, '{5.0, 0.0, -5.0, 55.0}'::float4[]
+    ),
+    (
+        '{{100, 110, 200, 300, 400, 500, 600}, {1, 0.5, 0.01, 0.8, 0.01, 0.01, 0.5}}'::spectrum,
+        '{{110, 200, 300, 310, 700, 800}, {1, 0.01, 0.9, 0.9, 0.01, 1}}'::spectrum,
+        0.1::float4, '{10.0, 22.0, -18.0}'::float4[]
+    )
+) v(ref, query, tolerance, shifts);
+
+SELECT results_eq(
+    $$ SELECT ROUND(score::numeric, 6), shift FROM cosine_modified_best(
+        spectrum_normalize('{{100, 299, 300, 301, 500, 510}, {0.02,1,0.2,0.4,0.04,0.2}}'),
+        spectrum_normalize('{{105, 305, 306, 505, 517}, {0.02,1,0.2,0.04,0.2}}'),
+        '{0.0, 5.0, 22.0}', 2.0) $$,
+    $$ VALUES (0.967873, 5.0::float4) $$,
+    'cosine_modified_best should return the best shift'
+);
+
 SELECT * FROM finish();
 ROLLBACK;
@@ -0,0 +1,83 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(6);
+
+CREATE TEMPORARY TABLE pairs AS SELECT * FROM (VALUES
+    (
+        '{{100, 200, 300, 500, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum,
+        '{{100, 200, 290, 490, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum,
+        0.1::float4, 0.0::float4, 1.0::float4
+    ),
+    (
+        '{{100, 299, 300, 301, 510}, {0.1, 1.0, 0.2, 0.3, 0.4}}'::spectrum,
+        '{{100, 300, 301, 511}, {0.1, 1.0, 0.3, 0.4}}'::spectrum,
+        0.2::float4, 0.0::float4, 1.0::float4
+    ),
+    (
+        '{{100, 299, 300, 301, 510}, {0.1, 1.0, 0.2, 0.3, 0.4}}'::spectrum,
+        '{{100, 300, 301, 511}, {0.1, 1.0, 0.3, 0.4}}'::spectrum,
+        2.0::float4, 0.0::float4, 1.0::float4
+    ),
+    (
+        '{{100, 200, 300, 500, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum,
+        '{{100, 200, 290, 490, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum,
+        1.0::float4, 0.5::float4, 2.0::float4
+    ),
+    (
+        '{{100, 100.05}, {1.0, 0.5}}'::spectrum,
+        '{{100.02, 500}, {1.0, 1.0}}'::spectrum,
+        0.1::float4, 0.0::float4, 1.0::float4
+    )
+) v(ref, query, tolerance, mz_power, intensity_power);
+
+SELECT ok(
+    bool_and(cosine_upper_bound(ref, query, tolerance, mz_power, intensity_power)
+        >= cosine_greedy(ref, query, tolerance, mz_power, intensity_power)),
+    'cosine_upper_bound should not be lower than cosine_greedy'
+) FROM pairs;
+
+SELECT ok(
+    bool_and(cosine_upper_bound(ref, query, tolerance, mz_power, intensity_power)
+        >= cosine_hungarian(ref, query, tolerance, mz_power, intensity_power)),
+    'cosine_upper_bound should not be lower than cosine_hungarian'
+) FROM pairs;
+
+SELECT is(
+    ROUND(cosine_upper_bound(
+        '{{100, 200, 300, 500, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum,
+        '{{100, 200, 290, 490, 510}, {0.1, 0.2, 1.0, 0.3, 0.4}}'::spectrum)::numeric, 4),
+    0.1616,
+    'cosine_upper_bound should be 0.1616'
+);
+
+SELECT is(
+    ROUND(cosine_greedy(
+        '{{100, 100.05}, {1.0, 0.5}}'::spectrum,
+        '{{100.02, 500}, {1.0, 1.0}}'::spectrum)::numeric, 4),
+    0.6325,
+    'cosine_greedy should match query peak at most once'
+);
+
+SELECT is(
+    cosine_upper_bound(
+        '{{100, 200}, {0.1, 0.2}}'::spectrum,
+        '{{150, 250}, {0.1, 0.2}}'::spectrum),
+    0.0::float4,
+    'cosine_upper_bound should be 0 for spectra without matching peaks'
+);
+
+SELECT ok(
+    bool_and(
+        cosine_greedy_above(ref, query, threshold, tolerance, mz_power, intensity_power)
+            = (cosine_greedy(ref, query, tolerance, mz_power, intensity_power) >= threshold)
+        AND cosine_hungarian_above(ref, query, threshold, tolerance, mz_power, intensity_power)
+            = (cosine_hungarian(ref, query, tolerance, mz_power, intensity_power) >= threshold)),
+    'threshold functions should agree with full scores'
+) FROM pairs, (VALUES (0.1::float4), (0.2::float4), (0.5::float4), (0.9::float4)) t(threshold);
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -0,0 +1,41 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(4);
+
+CREATE TABLE library (id serial PRIMARY KEY, title varchar, score float4, spectrum spectrum);
+
+INSERT INTO library (title, score, spectrum) VALUES
+    ('first', 0.5, '{{189.48956, 200}, {1.9, 0.25}}'),
+    (NULL, NULL, NULL);
+
+SELECT lo_create(0) AS loid \gset
+
+SELECT is(
+    export_arrow($$ SELECT id, title, score, spectrum FROM library ORDER BY id $$, :loid),
+    2::bigint,
+    'export_arrow should export all rows'
+);
+
+SELECT is(
+    substring(lo_get(:loid) FROM 1 FOR 4),
+    '\xffffffff'::bytea,
+    'export_arrow should start with encapsulated message'
+);
+
+SELECT is(
+    substring(lo_get(:loid) FROM length(lo_get(:loid)) - 7),
+    '\xffffffff00000000'::bytea,
+    'export_arrow should end with end of stream marker'
+);
+
+SELECT ok(
+    position(convert_to('intensity', 'UTF8') IN lo_get(:loid)) > 0,
+    'export_arrow should describe spectrum as list of peak structs'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -0,0 +1,51 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(5);
+
+CREATE TABLE library (id serial PRIMARY KEY, title varchar, pepmass float4[], spectrum spectrum);
+
+INSERT INTO library (title, pepmass, spectrum) VALUES
+    ('first', ARRAY[100.5, 2], '{{189.48956, 200}, {1.9, 0.25}}'),
+    (E'second\nline', NULL, '{{100}, {1}}');
+
+SELECT lo_create(0) AS loid \gset
+
+SELECT is(
+    export_mgf($$ SELECT title AS "TITLE", pepmass AS "PEPMASS", spectrum FROM library ORDER BY id $$, :loid),
+    2::bigint,
+    'export_mgf should export all rows'
+);
+
+SELECT is(
+    convert_from(lo_get(:loid), 'UTF8'),
+    E'BEGIN IONS\nTITLE=first\nPEPMASS=100.5 2\n189.48956 1.9\n200 0.25\nEND IONS\n\n'
+    || E'BEGIN IONS\nTITLE=second line\n100 1\nEND IONS\n\n',
+    'export_mgf should write metadata and shortest peak values'
+);
+
+SELECT results_eq(
+    $$ SELECT "TITLE", "PEPMASS", spectrum FROM load_from_mgf( ('$$||:loid||$$')::Oid ) AS ("TITLE" varchar, "PEPMASS" float4[], spectrum spectrum) $$,
+    $$ SELECT replace(title, E'\n', ' ')::varchar, pepmass, spectrum FROM library ORDER BY id $$,
+    'exported mgf should load back'
+);
+
+SELECT throws_ok(
+    $$ SELECT export_mgf('DELETE FROM library', $$||:loid||$$) $$,
+    '42809',
+    'export query must return rows',
+    'export_mgf should reject queries without result'
+);
+
+SELECT throws_ok(
+    $$ SELECT export_mgf('SELECT * FROM library', 'pgms.mgf') $$,
+    '42602',
+    'relative path not allowed for server file',
+    'export_mgf should reject relative server file path'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
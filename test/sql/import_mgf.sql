@@ -0,0 +1,93 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(8);
+
+CREATE TABLE library (id serial PRIMARY KEY, title varchar NOT NULL, pepmass float4, spectrum spectrum);
+
+SELECT lo_from_bytea(0, convert_to('TITLE=global
+BEGIN IONS
+PEPMASS=100.5
+189.48956 1.9
+END IONS
+BEGIN IONS
+TITLE=local
+PEPMASS=3.14-
+100 1
+200 2
+END IONS
+', 'UTF8')) AS loid \gset
+
+SELECT is(
+    import_mgf(:loid, 'library', '{"batch_size": 1, "columns": {"PEPMASS": "pepmass"}}'),
+    2::bigint,
+    'import_mgf should import all records'
+);
+
+SELECT results_eq(
+    $$ SELECT id, title, pepmass, spectrum FROM library ORDER BY id $$,
+    $$ VALUES (1, 'global'::varchar, 100.5::float4, '{{189.48956}, {1.9}}'::spectrum),
+        (2, 'local'::varchar, -3.14::float4, '{{100, 200}, {1, 2}}'::spectrum) $$,
+    'import_mgf should map keys to columns and fill defaults'
+);
+
+SELECT throws_ok(
+    $$ SELECT import_mgf($$ || :loid || $$, 'library', '{"unknown": 1}') $$,
+    '22023',
+    'invalid import option "unknown"',
+    'import_mgf should refuse unknown options'
+);
+
+SELECT throws_ok(
+    $$ SELECT import_mgf($$ || :loid || $$, 'library', '{"columns": {"TITLE": "name"}}') $$,
+    '42703',
+    'column "name" of relation "library" does not exist',
+    'import_mgf should refuse mapping to missing column'
+);
+
+SELECT throws_ok(
+    $$ SELECT import_mgf_parallel($$ || :loid || $$, 'library', '{}', 0) $$,
+    '22023',
+    'number of workers must be positive',
+    'import_mgf_parallel should require workers'
+);
+
+SELECT lo_from_bytea(0, convert_to('BEGIN IONS
+TITLE=first
+100 1
+END IONS
+BEGIN IONS
+TITLE=bad
+100 x
+END IONS
+BEGIN IONS
+TITLE=last
+200 2
+END IONS
+', 'UTF8')) AS loid \gset
+
+CALL import_mgf_checkpoint(:loid, 'library', '{"checkpoint": 1}');
+
+SELECT results_eq(
+    $$ SELECT title FROM library WHERE title IN ('first', 'bad', 'last') ORDER BY id $$,
+    $$ VALUES ('first'::varchar), ('last'::varchar) $$,
+    'import_mgf_checkpoint should skip failed records'
+);
+
+SELECT results_eq(
+    $$ SELECT "offset", sqlstate FROM mgf_import_error WHERE loid = $$ || :loid,
+    $$ VALUES (38::bigint, '22P02'::text) $$,
+    'import_mgf_checkpoint should log failed records'
+);
+
+SELECT results_eq(
+    $$ SELECT imported, failed, finished FROM mgf_import_checkpoint WHERE loid = $$ || :loid,
+    $$ VALUES (2::bigint, 1::bigint, true) $$,
+    'import_mgf_checkpoint should record finished import'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
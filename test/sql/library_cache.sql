@@ -0,0 +1,42 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(4);
+
+CREATE TABLE library (id integer, pepmass float4, spectrum spectrum);
+
+CREATE TRIGGER library_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON library
+    FOR EACH STATEMENT EXECUTE FUNCTION library_cache_invalidate();
+
+SELECT lives_ok(
+    $$ INSERT INTO library VALUES
+        (1, 100.0, '{{100, 200, 300}, {1.0, 1.0, 1.0}}'),
+        (2, 150.0, '{{100, 200, 400}, {1.0, 1.0, 1.0}}') $$,
+    'library_cache_invalidate trigger should allow changes of library'
+);
+
+SELECT is(
+    library_unload('library'),
+    false,
+    'library_unload should report library which is not loaded'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_precursor('{{100}, {1.0}}', 100.0, 1.0, 'library', 'spectrum') $$,
+    '55000',
+    'library "library" is not loaded with precursor column',
+    'library_search_precursor should require loaded library'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 1, 0) s
+        JOIN library l ON l.ctid = s.ctid $$,
+    $$ VALUES (1) $$,
+    'library_search should read library which is not loaded'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
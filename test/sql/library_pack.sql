@@ -0,0 +1,62 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(6);
+
+CREATE TABLE library (id integer, pepmass float8, spectrum spectrum);
+
+INSERT INTO library VALUES
+    (1, 150.0, '{{100, 200, 300}, {1.0, 1.0, 1.0}}'),
+    (2, 100.0, '{{100, 200, 400}, {1.0, 1.0, 1.0}}'),
+    (3, 200.0, '{{100, 200, 300}, {1.0, 1.0, 1.0}}'),
+    (4, NULL, '{{100, 200, 300}, {1.0, 1.0, 1.0}}');
+
+SELECT is(
+    library_pack('library', 'spectrum', 'pepmass', 'library_packed', 2),
+    3::bigint,
+    'library_pack should pack spectra with precursor'
+);
+
+SELECT results_eq(
+    $$ SELECT chunk, count, min_precursor, max_precursor FROM library_packed ORDER BY chunk $$,
+    $$ VALUES (0, 2, 100.0::float4, 150.0::float4), (1, 1, 200.0::float4, 200.0::float4) $$,
+    'library_pack should sort spectra by precursor into chunks'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id FROM library_search_packed('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library_packed', 160.0, 50.0, 0.1, 0.9, 0) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ VALUES (1), (3) $$,
+    'library_search_packed should score spectra within precursor window'
+);
+
+UPDATE library SET pepmass = 160.0 WHERE id = 1;
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_packed('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library_packed', 160.0, 50.0) $$,
+    '55000',
+    'packed library public.library_packed is stale',
+    'library_search_packed should refuse chunks of changed library'
+);
+
+SELECT is(
+    library_pack('library', 'spectrum', 'pepmass', 'library_repacked', 2),
+    3::bigint,
+    'library_pack should pack changed library again'
+);
+
+CREATE INDEX library_id ON library (id);
+CLUSTER library USING library_id;
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search_packed('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library_repacked', 160.0, 50.0) $$,
+    '55000',
+    'packed library public.library_repacked is stale',
+    'library_search_packed should refuse chunks of rewritten library'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
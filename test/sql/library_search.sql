@@ -0,0 +1,71 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(6);
+
+CREATE TABLE library (id integer, spectrum spectrum);
+
+INSERT INTO library VALUES
+    (1, '{{100, 200, 300}, {1.0, 1.0, 1.0}}'),
+    (2, '{{100, 200, 400}, {1.0, 1.0, 1.0}}'),
+    (3, '{{100, 500, 600}, {1.0, 1.0, 1.0}}'),
+    (4, '{{700, 800}, {1.0, 1.0}}'),
+    (5, '{{100, 200, 300, 400}, {1.0, 1.0, 1.0, 1.0}}'),
+    (6, NULL);
+
+SELECT results_eq(
+    $$ SELECT l.id FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 2, 0) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY s.score DESC, l.id $$,
+    $$ VALUES (1), (5) $$,
+    'library_search should return top-k hits'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.0, 2, 2) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY s.score DESC, l.id $$,
+    $$ VALUES (1), (5) $$,
+    'library_search should return top-k hits with parallel workers'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM library_search('{{100, 200, 300}, {1.0, 1.0, 1.0}}', 'library', 'spectrum', 0.1, 0.5, 0, 2) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY s.score DESC, l.id $$,
+    $$ VALUES (1, 1.0000), (5, 0.8660), (2, 0.6667) $$,
+    'library_search should return all hits above threshold'
+);
+
+CREATE TEMPORARY TABLE long_query AS
+    SELECT ARRAY[array_agg(m ORDER BY m), array_agg(0.1 + (m * 2)::integer % 7 ORDER BY m)]::float4[]::float[]::spectrum AS spectrum
+        FROM generate_series(50, 1000, 0.5) AS m;
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM long_query q
+        CROSS JOIN LATERAL library_search(q.spectrum, 'library', 'spectrum', 0.1, 0.0, 0, 0) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ SELECT l.id, round(cosine_greedy(l.spectrum, q.spectrum, 0.1)::numeric, 4) FROM long_query q, library l
+        WHERE cosine_greedy(l.spectrum, q.spectrum, 0.1) > 0 ORDER BY l.id $$,
+    'library_search should match cosine_greedy for long query'
+);
+
+INSERT INTO library SELECT 7, spectrum FROM long_query;
+
+SELECT results_eq(
+    $$ SELECT l.id, round(s.score::numeric, 4) FROM library_search('{{100, 200.02, 300, 450.5}, {1.0, 0.5, 1.0, 2.0}}', 'library', 'spectrum', 0.1, 0.0, 0, 0) s
+        JOIN library l ON l.ctid = s.ctid ORDER BY l.id $$,
+    $$ SELECT id, round(cosine_greedy(spectrum, '{{100, 200.02, 300, 450.5}, {1.0, 0.5, 1.0, 2.0}}', 0.1)::numeric, 4) FROM library
+        WHERE cosine_greedy(spectrum, '{{100, 200.02, 300, 450.5}, {1.0, 0.5, 1.0, 2.0}}', 0.1) > 0 ORDER BY id $$,
+    'library_search should match cosine_greedy for long library spectrum'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM library_search('{{100}, {1.0}}', 'library', 'id') $$,
+    '42703',
+    'column "id" of type spectrum does not exist',
+    'library_search should reject column of other type'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -4,7 +4,7 @@ BEGIN;
 \i test/pgtap-core.sql
 \i sql/pgms.sql
 
-SELECT plan(4);
+SELECT plan(9);
 
 SELECT is_empty(
     $$ SELECT FROM load_from_json(NULL) AS (s spectrum) $$,
@@ -47,5 +47,42 @@ SELECT results_eq(
 }'
 ]) AS v;
 
+SELECT results_eq(
+    $$ SELECT s FROM load_from_json('$$||v||$$'::jsonb, '{"min_intensity": 0.3, "normalize": true, "remove_precursor": 0.5}') AS (s spectrum) $$,
+    $$ VALUES('{ {100, 300}, {0.5, 1} }'::spectrum) $$,
+    'json parser should apply preprocessing filters'
+)FROM unnest(ARRAY[
+'{"s": [[300, 4], [100, 2], [150, 1], [200, 5]], "PEPMASS": 200}'
+]) AS v;
+
+SELECT results_eq(
+    $$ SELECT * FROM load_from_json('$$||v||$$'::jsonb) AS (f float4, d float8, i int4, l int8, n numeric, t text, b bool) $$,
+    $$ VALUES(189.48956::float4, 1.5e300::float8, 42, 12345678901, 0.000012::numeric, 'title', true) $$,
+    'json parser should convert scalar values to column types'
+)FROM unnest(ARRAY[
+'{"f": 189.48956, "d": 1.5e300, "i": 42, "l": 12345678901, "n": 0.000012, "t": "title", "b": true}'
+]) AS v;
+
+\lo_import ./test/data.json
+
+SELECT results_eq(
+    $$ SELECT "TITLE", "PEPMASS", peaks FROM load_from_json_lo( ('$$||:LASTOID||$$')::Oid ) AS ("TITLE" varchar, "PEPMASS" float4, peaks spectrum) $$,
+    $$ VALUES('first "quoted} title'::varchar, 200::float4, '{ {100, 300}, {2, 4} }'::spectrum), ('second'::varchar, NULL, '{ {189.48956}, {1.9} }'::spectrum) $$,
+    'json stream parser should split top level array'
+);
+
+SELECT results_eq(
+    $$ SELECT peaks FROM load_from_json_lo( ('$$||:LASTOID||$$')::Oid, '{"top_n": 1}' ) AS (peaks spectrum) $$,
+    $$ VALUES('{ {300}, {4} }'::spectrum), ('{ {189.48956}, {1.9} }'::spectrum) $$,
+    'json stream parser should apply preprocessing filters'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM load_from_json_file('/nonexistent/pgms.json') AS (s spectrum) $$,
+    '58P01',
+    'could not open file "/nonexistent/pgms.json": No such file or directory',
+    'json file parser should report missing file'
+);
+
 SELECT * FROM finish();
 ROLLBACK;
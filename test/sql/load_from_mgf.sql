@@ -4,7 +4,7 @@ BEGIN;
 \i test/pgtap-core.sql
 \i sql/pgms.sql
 
-SELECT plan(13);
+SELECT plan(21);
 
 SELECT is_empty(
     $$ SELECT FROM load_from_mgf('$$||v||$$') AS (s spectrum) $$,
@@ -93,6 +93,57 @@ END IONS
 '
 ]) AS v;
 
+SELECT results_eq(
+    $$ SELECT s FROM load_from_mgf('$$||v||$$') AS (s spectrum) $$,
+    $$ VALUES('{ {189.48956, 1.5e2}, {1.9, 25E-1} }'::spectrum) $$,
+    'mgf parser should deal with tab separated peaks and exponents'
+)FROM unnest(ARRAY[
+'BEGIN IONS
+189.48956	1.9
+1.5e2 25E-1
+END IONS'
+]) AS v;
+
+SELECT results_eq(
+    $$ SELECT "TITLE", s IS NULL FROM load_from_mgf('$$||v||$$') AS ("TITLE" varchar, s spectrum) $$,
+    $$ VALUES('local'::varchar, false), ('global'::varchar, true) $$,
+    'mgf parser should not carry record values to next record'
+)FROM unnest(ARRAY[
+'TITLE=global
+BEGIN IONS
+TITLE=local
+189.48956 1.9
+END IONS
+BEGIN IONS
+END IONS'
+]) AS v;
+
+SELECT results_eq(
+    $$ SELECT "TITLE", s FROM load_from_mgf('$$||v||$$') AS ("TITLE" varchar, s spectrum) $$,
+    $$ VALUES('crlf'::varchar, '{ {189.48956}, {1.9} }'::spectrum) $$,
+    'mgf parser should deal with crlf line endings'
+)FROM unnest(ARRAY[
+    replace('BEGIN IONS
+TITLE=crlf
+189.48956 1.9
+END IONS', chr(10), chr(13) || chr(10))
+]) AS v;
+
+SELECT results_eq(
+    $$ SELECT s FROM load_from_mgf('$$||v||$$', '{"normalize": true, "mz_range": [50, 500], "remove_precursor": 1, "top_n": 2}') AS (s spectrum) $$,
+    $$ VALUES('{ {100, 300}, {0.5, 1} }'::spectrum) $$,
+    'mgf parser should apply preprocessing filters'
+)FROM unnest(ARRAY[
+'BEGIN IONS
+PEPMASS=200.5 1000
+300 4
+200 3
+100 2
+40 9
+150 1
+END IONS'
+]) AS v;
+
 \lo_import ./test/data.mgf
 
 SELECT results_eq(
@@ -101,5 +152,31 @@ SELECT results_eq(
     'mgf parser should deal with global parameters'
 );
 
+\lo_import ./test/data.mgf.gz
+
+SELECT results_eq(
+    $$ SELECT "TITLE" FROM load_from_mgf( ('$$||:LASTOID||$$')::Oid ) AS ("TITLE" varchar) $$,
+    $$ VALUES('Global title'), ('Local title') $$,
+    'mgf parser should deal with gzip compressed input'
+);
+
+SELECT results_eq(
+    $$ SELECT "TITLE" FROM load_from_mgf( ('$$||:LASTOID||$$')::Oid ) AS ("TITLE" varchar) LIMIT 1 $$,
+    $$ VALUES('Global title') $$,
+    'mgf parser should stop at limit'
+);
+
+SELECT is_empty(
+    $$ SELECT * FROM stat_progress WHERE pid = pg_backend_pid() $$,
+    'mgf parser stopped at limit should end its progress'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM load_from_mgf_file('/nonexistent/pgms.mgf') AS (s spectrum) $$,
+    '58P01',
+    'could not open file "/nonexistent/pgms.mgf": No such file or directory',
+    'mgf file parser should report missing file'
+);
+
 SELECT * FROM finish();
 ROLLBACK;
@@ -0,0 +1,28 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(1);
+
+CREATE FUNCTION pg_temp.zstd_supported(data oid) RETURNS boolean AS $$
+BEGIN
+    PERFORM FROM load_from_mgf(data) AS ("TITLE" varchar) LIMIT 1;
+    RETURN true;
+EXCEPTION WHEN feature_not_supported THEN
+    RETURN false;
+END
+$$ LANGUAGE plpgsql;
+
+-- decompressed input is exactly one read buffer of the mgf parser
+\lo_import ./test/data_buffer.mgf.zst
+
+SELECT CASE WHEN pg_temp.zstd_supported(:LASTOID) THEN results_eq(
+    $$ SELECT count(*), sum(length("TITLE")) FROM load_from_mgf( ('$$||:LASTOID||$$')::Oid ) AS ("TITLE" varchar) $$,
+    $$ VALUES (21623::bigint, 248525::bigint) $$,
+    'mgf parser should deal with zstd input ending at read buffer boundary'
+) ELSE skip('zstd compressed input is not supported by this build') END;
+
+SELECT * FROM finish();
+ROLLBACK;
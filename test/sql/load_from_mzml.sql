@@ -0,0 +1,32 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(3);
+
+\lo_import ./test/data.mzML
+
+SELECT results_eq(
+    $$ SELECT * FROM load_from_mzml( ('$$||:LASTOID||$$')::Oid ) AS (id varchar, index integer, "ms level" integer, "centroid spectrum" boolean, title text, "MS:1000744" float4, s spectrum) $$,
+    $$ VALUES('scan=1'::varchar, 0, 2, true, 'first & "best"'::text, 200.3::float4, '{ {100.5, 200.25, 300.125}, {10, 20, 5} }'::spectrum),
+        ('scan=2'::varchar, 1, 1, NULL, NULL, NULL, NULL) $$,
+    'mzml parser should decode binary arrays and map params'
+);
+
+SELECT results_eq(
+    $$ SELECT s FROM load_from_mzml( ('$$||:LASTOID||$$')::Oid, '{"remove_precursor": 0.5}' ) AS (s spectrum) $$,
+    $$ VALUES('{ {100.5, 300.125}, {10, 5} }'::spectrum), (NULL) $$,
+    'mzml parser should apply preprocessing filters with selected ion precursor'
+);
+
+SELECT throws_ok(
+    $$ SELECT * FROM load_from_mzml_file('/nonexistent/pgms.mzML') AS (s spectrum) $$,
+    '58P01',
+    'could not open file "/nonexistent/pgms.mzML": No such file or directory',
+    'mzml file parser should report missing file'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -0,0 +1,61 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(9);
+
+SELECT is(
+    '{ {189.48956, 1.5e2}, {1.9, 25E-1} }'::spectrum::text,
+    '{{189.48956,150},{1.9,2.5}}',
+    'spectrum should be printed in shortest exact notation'
+);
+
+SELECT is(
+    '{{300, 100.25}, {4, 2}}'::spectrum::text,
+    '{{300,100.25},{4,2}}',
+    'spectrum array notation should keep peak order'
+);
+
+SELECT is(
+    v::spectrum::text,
+    '{{100.25,300},{2,0.004}}',
+    'spectrum should be accepted in compact peak notation'
+)FROM unnest(ARRAY[
+    '100.25:2 300:4e-3',
+    ' 100.25:2,
+      300:0.004 '
+]) AS v;
+
+SELECT is(
+    v::spectrum::text,
+    '{}',
+    'empty spectrum should be accepted'
+)FROM unnest(ARRAY[
+    '{}',
+    ''
+]) AS v;
+
+SELECT is(
+    '[1:2][1:1]={{1.5},{2}}'::spectrum::text,
+    '{{1.5},{2}}',
+    'spectrum should accept decorated array notation'
+);
+
+SELECT throws_ok(
+    $$ SELECT '300:4 100.25:2'::spectrum $$,
+    '22P02',
+    'malformed spectrum literal: "300:4 100.25:2"',
+    'compact peak notation should require ascending m/z'
+);
+
+SELECT throws_ok(
+    $$ SELECT '{{1, 2}, {3}}'::spectrum $$,
+    '22P02',
+    'malformed spectrum literal: "{{1, 2}, {3}}"',
+    'spectrum rows should have the same length'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
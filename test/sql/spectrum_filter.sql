@@ -0,0 +1,34 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(4);
+
+SELECT is(
+    spectrum_filter('{{300, 200, 100, 40, 150}, {4, 3, 2, 9, 1}}', '{"normalize": true, "mz_range": [50, 500], "remove_precursor": 1, "top_n": 2}', 200.5)::text,
+    '{{100,300},{0.5,1}}',
+    'spectrum_filter should apply preprocessing filters'
+);
+
+SELECT is(
+    spectrum_filter('{{200, 100.5, 100}, {2, 1, 1}}', '{"merge_tolerance": 1}')::text,
+    '{{100.25,200},{2,2}}',
+    'spectrum_filter should merge close peaks'
+);
+
+SELECT is(
+    spectrum_filter('{{100, 200}, {1, 2}}', '{"mz_range": [500, 600]}')::text,
+    '{}',
+    'spectrum_filter should deal with all peaks removed'
+);
+
+SELECT is(
+    spectrum_filter(NULL, '{"top_n": 2}'),
+    NULL,
+    'spectrum_filter should return null for null spectrum'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
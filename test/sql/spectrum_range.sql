@@ -0,0 +1,55 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(8);
+
+SELECT is(
+    spectrum_range('{{300, 100, 200}, {1, 1, 1}}', v),
+    v::spectrumrange,
+    'spectrum_range should span unsorted peaks'
+)FROM (VALUES ('[100,300]'), ('(100,300)')) AS t(v);
+
+SELECT is(
+    spectrum_range('{}', '[]'),
+    NULL,
+    'spectrum_range should be null for spectrum without peaks'
+);
+
+SELECT ok(
+    '{{100, 300}, {1, 1}}'::spectrum && '[250, 400]'::spectrumrange,
+    'spectrum should overlap window by its m/z span'
+);
+
+SELECT is(
+    '{{100, 300}, {1, 1}}'::spectrum @> v::spectrumrange,
+    false,
+    'spectrum should not match window between its peaks'
+)FROM (VALUES ('[150, 250]'), ('(300, 400]')) AS t(v);
+
+CREATE TEMPORARY TABLE library (id integer, spectrum spectrum);
+
+INSERT INTO library
+    SELECT i, format('{{%s, %s}, {1, 1}}', i, i + 0.25)::spectrum FROM generate_series(1, 1000) AS i;
+INSERT INTO library VALUES (1001, '{}'), (1002, NULL);
+
+CREATE INDEX ON library USING gist (spectrum);
+ANALYZE library;
+SET LOCAL enable_seqscan TO off;
+
+SELECT results_eq(
+    $$ SELECT id FROM library WHERE spectrum && '[100.5, 102.1]' ORDER BY id $$,
+    $$ VALUES (101), (102) $$,
+    'spectrum index should find overlapping spans'
+);
+
+SELECT results_eq(
+    $$ SELECT id FROM library WHERE spectrum @> '[100.3, 101.1]' ORDER BY id $$,
+    $$ VALUES (101) $$,
+    'spectrum index should find peaks within window'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
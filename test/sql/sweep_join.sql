@@ -0,0 +1,118 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(8);
+
+CREATE TEMPORARY TABLE library (id integer, pepmass float4, spectrum spectrum);
+CREATE TEMPORARY TABLE queries (id integer, pepmass float4, spectrum spectrum);
+
+INSERT INTO library VALUES
+    (1, 100.0, '{{100, 200, 300}, {0.1, 0.2, 1.0}}'),
+    (2, 101.5, '{{100, 200, 300}, {0.1, 0.2, 1.0}}'),
+    (3, 250.0, '{{100, 200, 300}, {0.1, 0.2, 1.0}}'),
+    (4, 100.5, '{{110, 210, 310}, {0.1, 0.2, 1.0}}'),
+    (5, NULL,  '{{100, 200, 300}, {0.1, 0.2, 1.0}}');
+
+INSERT INTO queries VALUES
+    (1, 100.2, '{{100, 200, 300}, {0.1, 0.2, 1.0}}'),
+    (2, 250.5, '{{100, 200, 300}, {0.1, 0.2, 1.0}}'),
+    (3, 400.0, NULL);
+
+SET LOCAL pgms.enable_sweep_join TO off;
+
+CREATE TEMPORARY TABLE nested_loop AS
+    SELECT l.id AS library_id, q.id AS query_id
+        FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND abs(l.pepmass - q.pepmass) <= 1.0;
+
+SET LOCAL pgms.enable_sweep_join TO on;
+
+SELECT results_eq(
+    $$ SELECT l.id, q.id FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND abs(l.pepmass - q.pepmass) <= 1.0
+        ORDER BY 1, 2 $$,
+    $$ SELECT library_id, query_id FROM nested_loop ORDER BY 1, 2 $$,
+    'sweep join should match nested loop results'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, q.id FROM library l JOIN queries q
+        ON abs(q.pepmass - l.pepmass) < 1.0 AND cosine_greedy(q.spectrum, l.spectrum, 0.1) >= 0.7
+        ORDER BY 1, 2 $$,
+    $$ VALUES (1, 1), (3, 2) $$,
+    'sweep join should deal with swapped arguments'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, q.id FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND precurzor_mz_match(l.pepmass, q.pepmass, 1.0) > 0
+        ORDER BY 1, 2 $$,
+    $$ VALUES (1, 1), (3, 2) $$,
+    'sweep join should deal with precursor match function'
+);
+
+SELECT results_eq(
+    $$ SELECT l.id, q.id FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND l.pepmass BETWEEN q.pepmass - 1.0 AND q.pepmass + 1.0
+        ORDER BY 1, 2 $$,
+    $$ VALUES (1, 1), (3, 2) $$,
+    'sweep join should deal with between precursor condition'
+);
+
+CREATE FUNCTION pg_temp.sweep_explain(query text) RETURNS SETOF text AS $$
+DECLARE
+    line text;
+BEGIN
+    FOR line IN EXECUTE 'EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF) ' || query
+    LOOP
+        IF line ~ 'PgmsSweepJoin|Pairs (Considered|Scored|Pruned):' THEN
+            RETURN NEXT substring(line from 'PgmsSweepJoin|Pairs (?:Considered|Scored|Pruned)');
+        END IF;
+    END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+-- the nested loop is the only other plan of the join
+SET LOCAL enable_nestloop TO off;
+
+SELECT set_eq(
+    $$ SELECT pg_temp.sweep_explain('SELECT l.id, q.id FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND abs(l.pepmass - q.pepmass) <= 1.0') $$,
+    ARRAY['PgmsSweepJoin', 'Pairs Considered', 'Pairs Scored', 'Pairs Pruned'],
+    'sweep join should be planned for abs precursor condition'
+);
+
+SELECT set_eq(
+    $$ SELECT pg_temp.sweep_explain('SELECT l.id, q.id FROM library l JOIN queries q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND l.pepmass BETWEEN q.pepmass - 1.0 AND q.pepmass + 1.0') $$,
+    ARRAY['PgmsSweepJoin', 'Pairs Considered', 'Pairs Scored', 'Pairs Pruned'],
+    'sweep join should be planned for between precursor condition'
+);
+
+CREATE TEMPORARY TABLE large_library AS
+    SELECT i AS id, i::float4 AS pepmass,
+        ARRAY[array_agg(m ORDER BY m), array_agg(1.0 + m % 3 ORDER BY m)]::float4[]::float[]::spectrum AS spectrum
+        FROM generate_series(1, 600) AS i, generate_series(100, 120) AS m GROUP BY i;
+
+ANALYZE large_library;
+
+SELECT set_eq(
+    $$ SELECT pg_temp.sweep_explain('SELECT l.id, q.id FROM large_library l JOIN large_library q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND abs(l.pepmass - q.pepmass) <= 1.0') $$,
+    ARRAY['PgmsSweepJoin', 'Pairs Considered', 'Pairs Scored', 'Pairs Pruned'],
+    'sweep join should be planned for inputs within work_mem'
+);
+
+SET LOCAL work_mem TO '64kB';
+
+SELECT is_empty(
+    $$ SELECT pg_temp.sweep_explain('SELECT l.id, q.id FROM large_library l JOIN large_library q
+        ON cosine_greedy(l.spectrum, q.spectrum) > 0.7 AND abs(l.pepmass - q.pepmass) <= 1.0') $$,
+    'sweep join should not be planned for inputs exceeding work_mem'
+);
+
+SELECT * FROM finish();
+ROLLBACK;
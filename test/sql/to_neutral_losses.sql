@@ -0,0 +1,33 @@
+\set ECHO none
+BEGIN;
+
+\i test/pgtap-core.sql
+\i sql/pgms.sql
+
+SELECT plan(4);
+
+SELECT is(
+    to_neutral_losses(v, 1000)::text,
+    '{{700,800,900},{3,2,1}}',
+    'to_neutral_losses should produce sorted losses of lighter fragments'
+)FROM unnest(ARRAY[
+    '{{100, 200, 300, 1100}, {1, 2, 3, 4}}'::spectrum,
+    '{{300, 1100, 100, 200}, {3, 4, 1, 2}}'::spectrum
+]) AS v;
+
+SELECT is(
+    to_neutral_losses('{{100, 200}, {1, 2}}', 50)::text,
+    '{}',
+    'to_neutral_losses should deal with fragments heavier than precursor'
+);
+
+SELECT is(
+    ROUND(cosine_neutral_losses_greedy(
+        to_neutral_losses('{{100, 200, 300}, {0.25, 0.25, 1}}', 1000),
+        to_neutral_losses('{{105, 205, 305}, {0.25, 0.25, 1}}', 1005))::numeric, 6),
+    1.000000,
+    'cosine_neutral_losses_greedy should match shifted fragments'
+);
+
+SELECT * FROM finish();
+ROLLBACK;